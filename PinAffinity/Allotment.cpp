@@ -0,0 +1,89 @@
+#include "stdafx.h"
+#include "PinAffinity.h"
+#include "Allotment.h"
+#include "Topology.h"
+#include "Log.h"
+
+// CPU topology, as of the last AllotInit()
+static CpuTopology s_topo;
+static bool s_topoValid = false;
+
+// CPUs currently allotted from each type's pool
+static std::vector<DWORD_PTR> s_used;
+
+void AllotInit()
+{
+	s_topoValid = GetCpuTopology(s_topo);
+	s_used.assign(g_procTypes.size(), 0);
+}
+
+DWORD_PTR AllotSlice(int iType, int weight, DWORD_PTR related)
+{
+	if (!s_topoValid || iType < 0 || iType >= (int)s_used.size())
+		return 0;
+
+	// Figure which L2 and L3 domains the related slices are in.  The
+	// domain lists are small, so bit sets are enough.
+	UINT64 relatedL2 = 0, relatedL3 = 0;
+	for (auto const &core : s_topo.cores)
+	{
+		if ((core.mask & related) != 0)
+		{
+			if (core.l2 >= 0 && core.l2 < 64)
+				relatedL2 |= (UINT64)1 << core.l2;
+			if (core.l3 < 64)
+				relatedL3 |= (UINT64)1 << core.l3;
+		}
+	}
+
+	// Pick cores one at a time, taking the free core with the best cache
+	// affinity each time.  Each core we pick counts as related for the
+	// next pick, so that a multi-core slice stays together.  A core's
+	// share of the pool is whichever of its logical processors are in
+	// the pool; a core is free if none of them are in use.
+	DWORD_PTR pool = g_procTypes[iType].affinityMask;
+	DWORD_PTR slice = 0;
+	for (int n = 0; n < weight; ++n)
+	{
+		const CpuCore *best = NULL;
+		int bestScore = -1;
+		for (auto const &core : s_topo.cores)
+		{
+			DWORD_PTR mask = core.mask & pool;
+			if (mask == 0 || (mask & (s_used[iType] | slice)) != 0)
+				continue;
+
+			int score = 0;
+			if (core.l2 >= 0 && core.l2 < 64 && (relatedL2 & ((UINT64)1 << core.l2)) != 0)
+				score += 2;
+			if (core.l3 < 64 && (relatedL3 & ((UINT64)1 << core.l3)) != 0)
+				score += 1;
+
+			// the cores are in number order, so ties go to the lowest number
+			if (score > bestScore)
+			{
+				best = &core;
+				bestScore = score;
+			}
+		}
+
+		// if we ran out of cores, the process will have to share
+		if (best == NULL)
+			return 0;
+
+		slice |= best->mask & pool;
+		if (best->l2 >= 0 && best->l2 < 64)
+			relatedL2 |= (UINT64)1 << best->l2;
+		if (best->l3 < 64)
+			relatedL3 |= (UINT64)1 << best->l3;
+	}
+
+	s_used[iType] |= slice;
+	return slice;
+}
+
+void AllotRelease(int iType, DWORD_PTR slice)
+{
+	if (iType >= 0 && iType < (int)s_used.size())
+		s_used[iType] &= ~slice;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+// Exclusive core allotment.
+//
+// Normally, all of the processes of a type share the type's whole
+// affinity mask.  A type with the "allot=exclusive" option instead
+// treats its mask as a pool, and gives each of its processes its own
+// slice of the pool, so that (say) the game, the ROM emulator and the
+// backglass don't compete with one another for the same cores.  Each
+// process's slice is sized by its saved program entry's weight, which
+// is the number of physical cores it gets.  Without a weight, the size
+// comes from the program's learned profile (see ProfileStore.h), or is
+// 1 for a program we haven't seen before.
+//
+// Slices are made up of whole physical cores, and are handed out as
+// processes start and returned when they exit; starting or stopping
+// one process never moves the others.  When choosing cores for a new
+// slice, the allocator prefers cores that share an L2 cache, and then
+// an L3 cache, with the slices already given to the type's other
+// processes, since processes of the same type usually work together
+// and trade data.  If the pool doesn't have enough free cores left for
+// a process, the process shares the whole pool instead, the same as
+// without allotment, until enough cores come free.
+
+// Set up the allotment pools from the current type list and CPU
+// topology.  This discards all existing slices, so the caller has to
+// re-allot any running processes afterwards.
+void AllotInit();
+
+// Allot a slice of a type's pool.  weight is the number of physical
+// cores wanted, and related is the union of the slices already given to
+// the type's other processes.  Returns the slice's CPU mask, or zero if
+// there aren't enough free cores, in which case the process should
+// share the pool.
+DWORD_PTR AllotSlice(int iType, int weight, DWORD_PTR related);
+
+// return a slice to its type's pool
+void AllotRelease(int iType, DWORD_PTR slice);
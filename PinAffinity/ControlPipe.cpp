@@ -0,0 +1,132 @@
+#include "stdafx.h"
+#include "ControlPipe.h"
+#include "Log.h"
+
+// server thread state
+static HANDLE s_hThread = NULL;
+static HWND s_hWnd = NULL;
+static UINT s_msg = 0;
+static volatile LONG s_stop = 0;
+
+void ReleaseControlMsg(ControlMsg *msg)
+{
+	if (InterlockedDecrement(&msg->refs) == 0)
+		delete msg;
+}
+
+// Serve one client connection until the client disconnects
+static void ServeClient(HANDLE hPipe)
+{
+	for (;;)
+	{
+		// read the next request; a read error means the client is gone
+		ControlMsg *msg = new ControlMsg();
+		msg->refs = 1;
+		msg->reqLen = 0;
+		if (!ReadFile(hPipe, msg->req, sizeof(msg->req), &msg->reqLen, NULL))
+		{
+			// a message longer than our buffer is a malformed request,
+			// but we still have to drain the rest of it
+			if (GetLastError() != ERROR_MORE_DATA)
+			{
+				ReleaseControlMsg(msg);
+				return;
+			}
+			DWORD extra;
+			while (!ReadFile(hPipe, msg->req, sizeof(msg->req), &extra, NULL) && GetLastError() == ERROR_MORE_DATA) { }
+			msg->reqLen = 0;
+		}
+
+		if (s_stop)
+		{
+			ReleaseControlMsg(msg);
+			return;
+		}
+
+		// Hand the request to the window thread, which owns the process
+		// table.  If the window is gone or hung, we can't do anything.
+		// The window thread gets its own reference, since if the send
+		// times out, the message stays queued and the window thread can
+		// still get to it after we've moved on.  If the window is gone,
+		// the message was never queued, so its reference is ours to drop.
+		DWORD_PTR result;
+		InterlockedIncrement(&msg->refs);
+		bool ok = SendMessageTimeout(s_hWnd, s_msg, 0, (LPARAM)msg, SMTO_ABORTIFHUNG, 2000, &result) != 0;
+		if (!ok && GetLastError() == ERROR_INVALID_WINDOW_HANDLE)
+			ReleaseControlMsg(msg);
+
+		// send the response
+		DWORD actual;
+		ok = ok && msg->resp.size() != 0
+			&& WriteFile(hPipe, msg->resp.data(), (DWORD)msg->resp.size(), &actual, NULL);
+		ReleaseControlMsg(msg);
+		if (!ok)
+			return;
+	}
+}
+
+// Server thread.  We serve one client at a time: requests are handled
+// on the window thread anyway, so there'd be nothing to gain from
+// concurrent pipe instances, and clients are short-lived.
+static DWORD WINAPI ControlPipeThread(LPVOID)
+{
+	while (!s_stop)
+	{
+		HANDLE hPipe = CreateNamedPipeW(CONTROL_PIPE_NAME, PIPE_ACCESS_DUPLEX,
+			PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+			1, 4096, CONTROL_MAX_REQUEST, 0, NULL);
+		if (hPipe == INVALID_HANDLE_VALUE)
+		{
+			LOG_ERROR(_T("Unable to create the control pipe, Windows error %lu"), GetLastError());
+			return 0;
+		}
+
+		// wait for a client; ERROR_PIPE_CONNECTED means one connected
+		// between the create and the wait, which is fine
+		if (ConnectNamedPipe(hPipe, NULL) || GetLastError() == ERROR_PIPE_CONNECTED)
+		{
+			if (!s_stop)
+				ServeClient(hPipe);
+			FlushFileBuffers(hPipe);
+			DisconnectNamedPipe(hPipe);
+		}
+		CloseHandle(hPipe);
+	}
+	return 0;
+}
+
+bool StartControlPipe(HWND hWnd, UINT msg)
+{
+	s_hWnd = hWnd;
+	s_msg = msg;
+	s_stop = 0;
+	s_hThread = CreateThread(NULL, 0, ControlPipeThread, NULL, 0, NULL);
+	if (s_hThread == NULL)
+	{
+		LOG_ERROR(_T("Unable to start the control pipe thread, Windows error %lu"), GetLastError());
+		return false;
+	}
+	return true;
+}
+
+void StopControlPipe()
+{
+	if (s_hThread == NULL)
+		return;
+
+	// Tell the thread to stop, then connect to the pipe ourselves to
+	// wake it up if it's waiting for a client.  If a client is
+	// connected, the thread will notice the stop flag on its next
+	// request, or when the client disconnects.
+	InterlockedExchange(&s_stop, 1);
+	HANDLE hPipe = CreateFileW(CONTROL_PIPE_NAME, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if (hPipe != INVALID_HANDLE_VALUE)
+		CloseHandle(hPipe);
+
+	// Wait briefly for the thread to exit.  If a client is holding the
+	// connection open without sending anything, don't hold up the exit
+	// for it; the thread goes away with the process.
+	WaitForSingleObject(s_hThread, 1000);
+	CloseHandle(s_hThread);
+	s_hThread = NULL;
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+// Control pipe.  While the main instance is running, it listens on a
+// local named pipe for requests from front ends and launchers.  A
+// front end usually knows exactly which process it just launched and
+// what it is, so rather than waiting for the next process list scan
+// to notice the new process and look up its program name, it can tell
+// us directly.  Requests are handed to the main window thread, which
+// owns the process table, and are answered immediately, without a
+// process list scan.
+//
+// The pipe is in message mode: each request is a single message, and
+// each request gets exactly one response message.  A client can send
+// any number of requests over one connection.  The pipe only accepts
+// local clients, and the default pipe security only lets the same
+// user (or an administrator) write to it.
+//
+// All of the protocol structures use fixed-size fields, so that 32-
+// and 64-bit clients can talk to either build.  Strings are UTF-16.
+
+// pipe name
+#define CONTROL_PIPE_NAME L"\\\\.\\pipe\\Pinscape.PinAffinity"
+
+// maximum request message size
+const DWORD CONTROL_MAX_REQUEST = 4096;
+
+// Request commands
+enum ControlCommand
+{
+	// Classify a running process.  pid is the process ID, and the
+	// text is the type name.  This assigns the type to this process
+	// instance only, the same as the /Run launcher does, and applies
+	// the type's affinity before replying.  Responds with the
+	// process's ControlProcInfo.
+	CTL_CLASSIFY = 1,
+
+	// Pre-register the next launch of a program.  pid is ignored, and
+	// the text is the type name, a null character, and the program's
+	// path or file name.  The next new process we see running that
+	// program (by file name) within CONTROL_EXEC_TIMEOUT milliseconds
+	// gets the type, as though it had been classified individually.
+	// This is for front ends that launch through something else (a
+	// shell verb, say) and so don't know the process ID.  No data.
+	CTL_REGISTER_EXEC = 2,
+
+	// Query a process.  pid is the process ID.  Responds with one
+	// ControlProcInfo.
+	CTL_QUERY = 3,
+
+	// List all tracked processes.  pid is ignored.  Responds with a
+	// ControlProcInfo for each process.
+	CTL_LIST = 4,
+
+	// Get scheduling statistics for a process's threads.  pid is the
+	// process ID.  Responds with a ControlThreadInfo for each thread
+	// with statistics, from its latest summary window.  There are only
+	// statistics for reserved-type processes, and only when PinAffinity
+	// is running with /SchedStats.
+	CTL_THREAD_STATS = 5,
+};
+
+// how long a pre-registered launch stays pending, in milliseconds
+const DWORD CONTROL_EXEC_TIMEOUT = 60000;
+
+// Maximum number of pre-registered launches pending at once, and the
+// maximum program file name length for a registration
+const size_t CONTROL_MAX_PENDING_EXEC = 32;
+const size_t CONTROL_MAX_EXEC_NAME = MAX_PATH;
+
+// Request header.  For commands that take text, the text follows the
+// header, and runs to the end of the message.
+struct ControlRequest
+{
+	// command, from ControlCommand
+	DWORD cmd;
+
+	// process ID, for commands that refer to a process
+	DWORD pid;
+};
+
+// Response status codes
+enum ControlStatus
+{
+	CTL_OK = 0,					// success
+	CTL_ERR_REQUEST = 1,		// malformed request or unknown command
+	CTL_ERR_TYPE = 2,			// unknown type name
+	CTL_ERR_PID = 3,			// process not found
+	CTL_ERR_LIMIT = 4,			// too many pending launch registrations
+};
+
+// Response header.  'count' ControlProcInfo records (or ControlThreadInfo
+// records, for CTL_THREAD_STATS) follow the header.
+struct ControlResponse
+{
+	// status, from ControlStatus
+	DWORD status;
+
+	// number of records following
+	DWORD count;
+};
+
+// Process information record
+struct ControlProcInfo
+{
+	// process ID
+	DWORD pid;
+
+	// effective type index, in AffinityTypes.txt order
+	INT32 type;
+
+	// current affinity mask, as far as we know
+	UINT64 affinity;
+
+	// original affinity mask, to be restored at exit, or zero if we
+	// haven't changed the process's affinity
+	UINT64 origAffinity;
+
+	// program file name
+	WCHAR name[64];
+
+	// effective type name
+	WCHAR typeName[64];
+};
+
+// Thread scheduling statistics record
+struct ControlThreadInfo
+{
+	// thread ID
+	DWORD tid;
+
+	// estimated time spent waiting for a CPU, and CPU time used, in
+	// tenths of a percent of the window
+	UINT16 runDelay;
+	UINT16 cpu;
+
+	// context switches and estimated preemptions per second
+	DWORD switchRate;
+	DWORD preemptRate;
+};
+
+// Start the control pipe server thread.  Requests are sent to the
+// given window as PAMSG_CONTROL messages, with a ControlMsg in lParam.
+bool StartControlPipe(HWND hWnd, UINT msg);
+
+// stop the server thread
+void StopControlPipe();
+
+// PAMSG_CONTROL message payload.  The server thread allocates one of
+// these for each request and sends it to the window with a timeout, so
+// the window thread can get to it after the server thread has given
+// up waiting.  Each side therefore holds a reference, and whichever
+// side finishes with it last frees it, via ReleaseControlMsg().
+struct ControlMsg
+{
+	// references held (server thread and window thread)
+	volatile LONG refs;
+
+	// request message
+	BYTE req[CONTROL_MAX_REQUEST];
+	DWORD reqLen;
+
+	// response message, filled in by the window thread
+	std::vector<BYTE> resp;
+};
+
+// release a reference to a control message, freeing it with the last one
+void ReleaseControlMsg(ControlMsg *msg);
+
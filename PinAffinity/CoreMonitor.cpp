@@ -0,0 +1,436 @@
+#include "stdafx.h"
+#include "PinAffinity.h"
+#include "CoreMonitor.h"
+#include "NtApi.h"
+#include "CpuAccounting.h"
+#include "Log.h"
+
+// Fixed-size ring buffer of samples
+template<typename T> struct SampleRing
+{
+	T samples[CORE_MONITOR_RING_SIZE];
+	int head;		// next slot to write
+	int count;		// number of valid samples
+
+	void Add(const T &s)
+	{
+		samples[head] = s;
+		head = (head + 1) % CORE_MONITOR_RING_SIZE;
+		if (count < CORE_MONITOR_RING_SIZE)
+			++count;
+	}
+
+	int CopyOut(T *buf, int maxSamples) const
+	{
+		int n = min(count, maxSamples);
+		for (int i = 0, idx = (head - n + CORE_MONITOR_RING_SIZE) % CORE_MONITOR_RING_SIZE; i < n; ++i)
+		{
+			buf[i] = samples[idx];
+			idx = (idx + 1) % CORE_MONITOR_RING_SIZE;
+		}
+		return n;
+	}
+};
+
+// Partition process being tracked for CPU time
+struct TrackedProc
+{
+	DWORD pid;
+	int type;
+	HANDLE hProc;
+
+	// total CPU time (kernel + user) at the last sample, in 100ns units
+	ULONGLONG cpuTime;
+};
+
+// Monitor state.  Everything is allocated up front; the sampler thread
+// doesn't allocate memory once it's running.
+struct CoreMonitorState
+{
+	// sampler thread
+	HANDLE hThread;
+	HANDLE hStopEvent;
+
+	// alert notification window and message
+	HWND hWnd;
+	UINT alertMsg;
+
+	// number of CPUs monitored
+	int nCpus;
+
+	// partition owning each CPU
+	int owner[CORE_MONITOR_MAX_CPUS];
+
+	// alert threshold for each partition, in tenths of a percent, or -1
+	int alertThreshold[CORE_MONITOR_MAX_PARTITIONS];
+
+	// is an alert currently raised for the partition?
+	bool alerting[CORE_MONITOR_MAX_PARTITIONS];
+
+	// counters from the previous sample
+	NtProcessorPerformanceInfo perf[2][CORE_MONITOR_MAX_CPUS];
+	NtInterruptInfo intr[2][CORE_MONITOR_MAX_CPUS];
+	int cur;
+	bool havePrev;
+
+	// partition processes, as published by the main thread
+	DWORD pubPid[CORE_MONITOR_MAX_PROCS];
+	int pubType[CORE_MONITOR_MAX_PROCS];
+	int nPub;
+	LONG pubGen;
+
+	// partition processes the sampler thread is tracking, and a
+	// scratch list for updating it
+	TrackedProc tracked[CORE_MONITOR_MAX_PROCS];
+	TrackedProc newTracked[CORE_MONITOR_MAX_PROCS];
+	int nTracked;
+	LONG trackedGen;
+
+	// time series
+	SampleRing<CoreSample> cores[CORE_MONITOR_MAX_CPUS];
+	SampleRing<PartitionSample> partitions[CORE_MONITOR_MAX_PARTITIONS];
+
+	// Lock protecting the published process list and the time series.
+	// The sampler thread only holds it while copying data in and out,
+	// never across a system call.
+	CRITICAL_SECTION lock;
+};
+static CoreMonitorState *s_mon = NULL;
+
+// Housekeeping CPU mask.  This is kept outside of the monitor state,
+// since other threads read it when they start, and the state is
+// replaced when the monitor restarts.
+static DWORD_PTR s_housekeepingMask = 0;
+
+// Bring the tracked process list up to date with the published list.
+// Processes we were already tracking keep their handles and CPU time
+// baselines; new ones are opened, and ones no longer listed are closed.
+static void SyncTrackedProcesses()
+{
+	// copy out the published list if it's changed
+	EnterCriticalSection(&s_mon->lock);
+	if (s_mon->pubGen == s_mon->trackedGen)
+	{
+		LeaveCriticalSection(&s_mon->lock);
+		return;
+	}
+	int n = s_mon->nPub;
+	for (int i = 0; i < n; ++i)
+	{
+		s_mon->newTracked[i].pid = s_mon->pubPid[i];
+		s_mon->newTracked[i].type = s_mon->pubType[i];
+		s_mon->newTracked[i].hProc = NULL;
+	}
+	s_mon->trackedGen = s_mon->pubGen;
+	LeaveCriticalSection(&s_mon->lock);
+
+	// carry over existing entries, and close the ones that are gone
+	for (int j = 0; j < s_mon->nTracked; ++j)
+	{
+		TrackedProc &old = s_mon->tracked[j];
+		bool kept = false;
+		for (int i = 0; i < n && !kept; ++i)
+		{
+			if (s_mon->newTracked[i].pid == old.pid && s_mon->newTracked[i].hProc == NULL)
+			{
+				s_mon->newTracked[i].hProc = old.hProc;
+				s_mon->newTracked[i].cpuTime = old.cpuTime;
+				kept = true;
+			}
+		}
+		if (!kept && old.hProc != NULL)
+			CloseHandle(old.hProc);
+	}
+
+	// open the new entries, and take their CPU time baselines
+	for (int i = 0; i < n; ++i)
+	{
+		TrackedProc &p = s_mon->newTracked[i];
+		if (p.hProc == NULL)
+		{
+			p.cpuTime = 0;
+			if ((p.hProc = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, p.pid)) != NULL)
+				GetProcessCpuTime(p.hProc, p.cpuTime);
+		}
+	}
+
+	memcpy(s_mon->tracked, s_mon->newTracked, n * sizeof(TrackedProc));
+	s_mon->nTracked = n;
+}
+
+// Take a sample
+static void TakeSample(NtQuerySystemInformation_t NtQSI)
+{
+	// read the counters
+	int cur = s_mon->cur;
+	ULONG len;
+	ULONG perfLen = s_mon->nCpus * sizeof(NtProcessorPerformanceInfo);
+	ULONG intrLen = s_mon->nCpus * sizeof(NtInterruptInfo);
+	if (NtQSI(NtSystemProcessorPerformanceInformation, s_mon->perf[cur], perfLen, &len) < 0
+		|| NtQSI(NtSystemInterruptInformation, s_mon->intr[cur], intrLen, &len) < 0)
+		return;
+
+	// figure the CPU time used by each partition's processes since the
+	// last sample
+	ULONGLONG gameTime[CORE_MONITOR_MAX_PARTITIONS] = { 0 };
+	SyncTrackedProcesses();
+	for (int i = 0; i < s_mon->nTracked; ++i)
+	{
+		TrackedProc &p = s_mon->tracked[i];
+		ULONGLONG t;
+		if (p.hProc != NULL && GetProcessCpuTime(p.hProc, t))
+		{
+			if (p.type >= 0 && p.type < CORE_MONITOR_MAX_PARTITIONS && t > p.cpuTime)
+				gameTime[p.type] += t - p.cpuTime;
+			p.cpuTime = t;
+		}
+	}
+
+	// we need a previous sample to figure the deltas
+	int prev = cur ^ 1;
+	s_mon->cur = prev;
+	if (!s_mon->havePrev)
+	{
+		s_mon->havePrev = true;
+		return;
+	}
+
+	// figure the per-core deltas, and sum them by partition
+	ULONGLONG now = GetTickCount64();
+	ULONGLONG partTotal[CORE_MONITOR_MAX_PARTITIONS] = { 0 };
+	ULONGLONG partBusy[CORE_MONITOR_MAX_PARTITIONS] = { 0 };
+	ULONGLONG partIntr[CORE_MONITOR_MAX_PARTITIONS] = { 0 };
+	static CoreSample coreSamples[CORE_MONITOR_MAX_CPUS];
+	auto Permille = [](ULONGLONG part, ULONGLONG total) {
+		return (UINT16)(total == 0 ? 0 : min(part, total) * 1000 / total); };
+	for (int cpu = 0; cpu < s_mon->nCpus; ++cpu)
+	{
+		const NtProcessorPerformanceInfo &a = s_mon->perf[prev][cpu], &b = s_mon->perf[cur][cpu];
+		const NtInterruptInfo &ia = s_mon->intr[prev][cpu], &ib = s_mon->intr[cur][cpu];
+		ULONGLONG idle = b.IdleTime.QuadPart - a.IdleTime.QuadPart;
+		ULONGLONG total = (b.KernelTime.QuadPart - a.KernelTime.QuadPart) + (b.UserTime.QuadPart - a.UserTime.QuadPart);
+		ULONGLONG busy = total > idle ? total - idle : 0;
+		ULONGLONG intr = b.InterruptTime.QuadPart - a.InterruptTime.QuadPart;
+		ULONGLONG dpc = b.DpcTime.QuadPart - a.DpcTime.QuadPart;
+
+		CoreSample &s = coreSamples[cpu];
+		s.time = now;
+		s.busy = Permille(busy, total);
+		s.interrupt = Permille(intr, total);
+		s.dpc = Permille(dpc, total);
+		s.owner = (INT16)s_mon->owner[cpu];
+		s.interrupts = b.InterruptCount - a.InterruptCount;
+		s.dpcs = ib.DpcCount - ia.DpcCount;
+		s.contextSwitches = ib.ContextSwitches - ia.ContextSwitches;
+
+		int owner = s_mon->owner[cpu];
+		if (owner >= 0 && owner < CORE_MONITOR_MAX_PARTITIONS)
+		{
+			partTotal[owner] += total;
+			partBusy[owner] += busy;
+			partIntr[owner] += intr + dpc;
+		}
+	}
+
+	// figure the partition samples
+	static PartitionSample partSamples[CORE_MONITOR_MAX_PARTITIONS];
+	for (int p = 0; p < CORE_MONITOR_MAX_PARTITIONS; ++p)
+	{
+		PartitionSample &s = partSamples[p];
+		s.time = now;
+		s.busy = Permille(partBusy[p], partTotal[p]);
+		s.nonGame = Permille(partBusy[p] > gameTime[p] ? partBusy[p] - gameTime[p] : 0, partTotal[p]);
+		s.interruptDpc = Permille(partIntr[p], partTotal[p]);
+	}
+
+	// add the samples to the time series
+	EnterCriticalSection(&s_mon->lock);
+	for (int cpu = 0; cpu < s_mon->nCpus; ++cpu)
+		s_mon->cores[cpu].Add(coreSamples[cpu]);
+	for (int p = 0; p < CORE_MONITOR_MAX_PARTITIONS; ++p)
+	{
+		if (partTotal[p] != 0)
+			s_mon->partitions[p].Add(partSamples[p]);
+	}
+	LeaveCriticalSection(&s_mon->lock);
+
+	// check the reserved partitions against their alert thresholds
+	for (int p = 1; p < CORE_MONITOR_MAX_PARTITIONS; ++p)
+	{
+		int threshold = s_mon->alertThreshold[p];
+		if (threshold < 0 || partTotal[p] == 0)
+			continue;
+
+		int share = partSamples[p].nonGame;
+		if (share > threshold && !s_mon->alerting[p])
+		{
+			LOG_WARNING(_T("Core monitor: other activity is using %.1lf%% of the %s cores (interrupts/DPCs %.1lf%%)"),
+				share / 10.0, g_procTypes[p].name.c_str(), partSamples[p].interruptDpc / 10.0);
+			s_mon->alerting[p] = true;
+			PostMessage(s_mon->hWnd, s_mon->alertMsg, p, share);
+		}
+		else if (share <= threshold && s_mon->alerting[p])
+		{
+			LOG_INFO(_T("Core monitor: the %s cores are back under the alert threshold"), g_procTypes[p].name.c_str());
+			s_mon->alerting[p] = false;
+			PostMessage(s_mon->hWnd, s_mon->alertMsg, p, 0);
+		}
+	}
+}
+
+static DWORD WINAPI CoreMonitorThread(LPVOID)
+{
+	// stay off the reserved cores, and run in background mode, since
+	// the sample timing doesn't need to be exact
+	if (s_housekeepingMask != 0)
+		SetThreadAffinityMask(GetCurrentThread(), s_housekeepingMask);
+	SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+	NtQuerySystemInformation_t NtQSI = GetNtQuerySystemInformation();
+	while (WaitForSingleObject(s_mon->hStopEvent, CORE_MONITOR_INTERVAL) == WAIT_TIMEOUT)
+		TakeSample(NtQSI);
+
+	return 0;
+}
+
+bool StartCoreMonitor(HWND hWnd, UINT alertMsg)
+{
+	// we need the native API for the per-processor counters
+	if (GetNtQuerySystemInformation() == NULL)
+	{
+		LOG_WARNING(_T("Core monitor: NtQuerySystemInformation isn't available"));
+		return false;
+	}
+
+	// Allocate and set up the monitor state.  We only publish it in
+	// s_mon once it's complete, just before starting the thread.
+	CoreMonitorState *mon = new CoreMonitorState;
+	ZeroMemory(mon, sizeof(*mon));
+	InitializeCriticalSection(&mon->lock);
+	mon->hWnd = hWnd;
+	mon->alertMsg = alertMsg;
+
+	// figure the CPUs we can monitor
+	DWORD_PTR procMask, sysMask;
+	GetProcessAffinityMask(GetCurrentProcess(), &procMask, &sysMask);
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	mon->nCpus = min((int)si.dwNumberOfProcessors, CORE_MONITOR_MAX_CPUS);
+
+	// Figure each core's partition: the first non-default type that
+	// includes it, otherwise the default type.
+	DWORD_PTR housekeepingMask = 0;
+	for (int cpu = 0; cpu < mon->nCpus; ++cpu)
+	{
+		DWORD_PTR bit = (DWORD_PTR)1 << cpu;
+		mon->owner[cpu] = 0;
+		for (int t = 1; t < (int)g_procTypes.size() && t < CORE_MONITOR_MAX_PARTITIONS; ++t)
+		{
+			if ((g_procTypes[t].affinityMask & bit) != 0)
+			{
+				mon->owner[cpu] = t;
+				break;
+			}
+		}
+		if (mon->owner[cpu] == 0 && (sysMask & bit) != 0)
+			housekeepingMask |= bit;
+	}
+
+	// note the alert thresholds
+	for (int t = 0; t < CORE_MONITOR_MAX_PARTITIONS; ++t)
+		mon->alertThreshold[t] = t < (int)g_procTypes.size() ? g_procTypes[t].alertThreshold : -1;
+
+	// publish the state, and start the sampler thread
+	mon->hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	s_mon = mon;
+	s_housekeepingMask = housekeepingMask;
+	mon->hThread = CreateThread(NULL, 0, CoreMonitorThread, NULL, 0, NULL);
+	if (mon->hThread == NULL)
+	{
+		LOG_ERROR(_T("Unable to start the core monitor thread, Windows error %lu"), GetLastError());
+		StopCoreMonitor();
+		return false;
+	}
+	return true;
+}
+
+void StopCoreMonitor()
+{
+	if (s_mon == NULL)
+		return;
+
+	// stop the thread
+	CoreMonitorState *mon = s_mon;
+	if (mon->hThread != NULL)
+	{
+		SetEvent(mon->hStopEvent);
+		WaitForSingleObject(mon->hThread, INFINITE);
+		CloseHandle(mon->hThread);
+	}
+	if (mon->hStopEvent != NULL)
+		CloseHandle(mon->hStopEvent);
+
+	// close the process handles
+	for (int i = 0; i < mon->nTracked; ++i)
+	{
+		if (mon->tracked[i].hProc != NULL)
+			CloseHandle(mon->tracked[i].hProc);
+	}
+
+	// free the state
+	s_mon = NULL;
+	s_housekeepingMask = 0;
+	DeleteCriticalSection(&mon->lock);
+	delete mon;
+}
+
+void CoreMonitorSetProcesses(const DWORD *pids, const int *types, int n)
+{
+	if (s_mon == NULL)
+		return;
+
+	n = min(n, CORE_MONITOR_MAX_PROCS);
+	EnterCriticalSection(&s_mon->lock);
+	if (n != s_mon->nPub
+		|| memcmp(pids, s_mon->pubPid, n * sizeof(DWORD)) != 0
+		|| memcmp(types, s_mon->pubType, n * sizeof(int)) != 0)
+	{
+		memcpy(s_mon->pubPid, pids, n * sizeof(DWORD));
+		memcpy(s_mon->pubType, types, n * sizeof(int));
+		s_mon->nPub = n;
+		++s_mon->pubGen;
+	}
+	LeaveCriticalSection(&s_mon->lock);
+}
+
+DWORD_PTR GetHousekeepingMask()
+{
+	return s_housekeepingMask;
+}
+
+int GetCoreOwner(int cpu)
+{
+	return s_mon != NULL && cpu >= 0 && cpu < s_mon->nCpus ? s_mon->owner[cpu] : -1;
+}
+
+int GetCoreSamples(int cpu, CoreSample *buf, int maxSamples)
+{
+	if (s_mon == NULL || cpu < 0 || cpu >= s_mon->nCpus)
+		return 0;
+
+	EnterCriticalSection(&s_mon->lock);
+	int n = s_mon->cores[cpu].CopyOut(buf, maxSamples);
+	LeaveCriticalSection(&s_mon->lock);
+	return n;
+}
+
+int GetPartitionSamples(int iType, PartitionSample *buf, int maxSamples)
+{
+	if (s_mon == NULL || iType < 0 || iType >= CORE_MONITOR_MAX_PARTITIONS)
+		return 0;
+
+	EnterCriticalSection(&s_mon->lock);
+	int n = s_mon->partitions[iType].CopyOut(buf, maxSamples);
+	LeaveCriticalSection(&s_mon->lock);
+	return n;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+// Per-core health monitor.
+//
+// The point of reserving cores for a type is that nothing else runs on
+// them.  This monitor keeps a continuous check on how well that's
+// working.  A background thread samples the system's per-processor
+// counters once a second (busy and idle time, interrupt and DPC time,
+// interrupt, DPC and context switch counts) and keeps a time series for
+// each core in a fixed ring buffer, so the last several minutes of
+// history are always available at a constant memory cost.
+//
+// Each core is attributed to the partition that owns it: the first
+// type after the default type whose affinity mask includes the core,
+// or the default type (the "housekeeping" partition) if no other type
+// claims it.  For each partition other than housekeeping, the monitor
+// also tracks the share of the partition's core time that went to
+// anything other than the type's own processes (other programs that
+// couldn't be moved, system threads, interrupts and DPCs), by taking
+// the partition's total busy time less the CPU time consumed by the
+// type's processes.  When that share exceeds the type's "alert="
+// threshold from AffinityTypes.txt, the monitor logs a warning and
+// notifies the main window.
+//
+// The sampler thread runs only on the housekeeping cores, so that the
+// monitor itself never disturbs the cores it's watching.
+
+// maximum number of CPUs monitored (processor group 0, the same as the
+// affinity masks)
+const int CORE_MONITOR_MAX_CPUS = 64;
+
+// maximum number of partitions (types) with a time series
+const int CORE_MONITOR_MAX_PARTITIONS = 32;
+
+// maximum number of partition processes tracked for CPU time
+const int CORE_MONITOR_MAX_PROCS = 128;
+
+// sampling interval, in milliseconds
+const DWORD CORE_MONITOR_INTERVAL = 1000;
+
+// samples kept per series (10 minutes at the default interval)
+const int CORE_MONITOR_RING_SIZE = 600;
+
+// Per-core sample, covering one sampling interval.  The times are in
+// tenths of a percent of the interval.
+struct CoreSample
+{
+	// GetTickCount64() time at the end of the interval
+	ULONGLONG time;
+
+	// busy time (everything but the idle thread), including the
+	// interrupt and DPC time
+	UINT16 busy;
+
+	// time spent in interrupt handlers
+	UINT16 interrupt;
+
+	// time spent in deferred procedure calls (the second half of
+	// most device driver interrupt handling)
+	UINT16 dpc;
+
+	// partition owning the core (type index)
+	INT16 owner;
+
+	// number of interrupts, DPCs, and thread context switches
+	DWORD interrupts;
+	DWORD dpcs;
+	DWORD contextSwitches;
+};
+
+// Per-partition sample, covering one sampling interval.  The times are
+// in tenths of a percent of the partition's total core time.
+struct PartitionSample
+{
+	// GetTickCount64() time at the end of the interval
+	ULONGLONG time;
+
+	// busy time across the partition's cores
+	UINT16 busy;
+
+	// time that went to anything other than the type's own processes
+	UINT16 nonGame;
+
+	// interrupt and DPC time across the partition's cores
+	UINT16 interruptDpc;
+};
+
+// Start the monitor.  Call this after the process types are loaded.
+// Purity alerts are posted to hWnd as alertMsg, with the type index in
+// wParam and the non-game share (in tenths of a percent) in lParam, or
+// zero in lParam when the share drops back under the threshold.
+bool StartCoreMonitor(HWND hWnd, UINT alertMsg);
+
+// stop the monitor
+void StopCoreMonitor();
+
+// Update the list of processes belonging to each partition.  The main
+// thread calls this after each process list update, with the process
+// IDs and types of the processes of non-default types.
+void CoreMonitorSetProcesses(const DWORD *pids, const int *types, int n);
+
+// Get the housekeeping CPU mask: the CPUs owned by the default type.
+// Other background samplers use this to stay off the reserved cores.
+// Returns zero if the monitor isn't running.
+DWORD_PTR GetHousekeepingMask();
+
+// Get the partition owning a CPU, or -1 if the CPU isn't monitored
+int GetCoreOwner(int cpu);
+
+// Copy out the time series for a CPU or a partition, oldest first.
+// Returns the number of samples copied, up to maxSamples (the most
+// recent ones are copied if there are more).
+int GetCoreSamples(int cpu, CoreSample *buf, int maxSamples);
+int GetPartitionSamples(int iType, PartitionSample *buf, int maxSamples);
@@ -0,0 +1,15 @@
+#include "stdafx.h"
+#include "CpuAccounting.h"
+
+std::vector<CpuHistory> g_typeCpu;
+
+bool GetProcessCpuTime(HANDLE hProc, ULONGLONG &cpuTime)
+{
+	FILETIME createTime, exitTime, kernelTime, userTime;
+	if (!GetProcessTimes(hProc, &createTime, &exitTime, &kernelTime, &userTime))
+		return false;
+
+	cpuTime = ((ULONGLONG)kernelTime.dwHighDateTime << 32) + kernelTime.dwLowDateTime
+		+ ((ULONGLONG)userTime.dwHighDateTime << 32) + userTime.dwLowDateTime;
+	return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+// Per-process and per-type CPU accounting.
+//
+// Once a second, we read each tracked process's cumulative CPU time
+// (kernel plus user) and record the change since the last reading in a
+// small fixed-size history, one per process and one per type.  The
+// process handle used for this is opened once and kept, so each
+// reading is a single system call.  CPU usage figures are in tenths of
+// a percent of one CPU, so a program keeping two cores busy reads 2000.
+
+// accounting interval, in milliseconds
+const DWORD CPU_ACCOUNTING_INTERVAL = 1000;
+
+// number of samples kept per history (one minute at the default interval)
+const int CPU_HISTORY_LENGTH = 60;
+
+// CPU usage history
+struct CpuHistory
+{
+	CpuHistory() : head(0), count(0) { }
+
+	// add a sample
+	void Add(UINT16 sample)
+	{
+		samples[head] = sample;
+		head = (BYTE)((head + 1) % CPU_HISTORY_LENGTH);
+		if (count < CPU_HISTORY_LENGTH)
+			++count;
+	}
+
+	// most recent sample, or zero if there are none
+	UINT16 Latest() const { return count == 0 ? 0 : samples[(head + CPU_HISTORY_LENGTH - 1) % CPU_HISTORY_LENGTH]; }
+
+	// highest of the most recent n samples
+	UINT16 Peak(int n = CPU_HISTORY_LENGTH) const
+	{
+		UINT16 peak = 0;
+		for (int i = 1; i <= n && i <= count; ++i)
+			peak = max(peak, samples[(head + CPU_HISTORY_LENGTH - i) % CPU_HISTORY_LENGTH]);
+		return peak;
+	}
+
+	// average of the most recent n samples
+	UINT16 Average(int n = CPU_HISTORY_LENGTH) const
+	{
+		UINT32 sum = 0;
+		int i = 1;
+		for (; i <= n && i <= count; ++i)
+			sum += samples[(head + CPU_HISTORY_LENGTH - i) % CPU_HISTORY_LENGTH];
+		return i > 1 ? (UINT16)(sum / (i - 1)) : 0;
+	}
+
+	// samples, as a circular buffer
+	UINT16 samples[CPU_HISTORY_LENGTH];
+
+	// next slot to write, and number of valid samples
+	BYTE head;
+	BYTE count;
+};
+
+// Per-type CPU history, indexed like g_procTypes.  Each sample is the
+// total for all of the type's running processes.
+extern std::vector<CpuHistory> g_typeCpu;
+
+// Figure a CPU usage sample from a CPU time delta (100ns units) over
+// an elapsed time (milliseconds), in tenths of a percent of one CPU
+inline UINT16 CpuUsageSample(ULONGLONG cpuDelta, ULONGLONG elapsedMs)
+{
+	return elapsedMs == 0 ? 0 : (UINT16)min(cpuDelta * 100 / elapsedMs, (ULONGLONG)0xFFFF);
+}
+
+// read a process's cumulative CPU time (kernel + user), in 100ns units
+bool GetProcessCpuTime(HANDLE hProc, ULONGLONG &cpuTime);
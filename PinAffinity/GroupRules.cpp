@@ -0,0 +1,111 @@
+#include "stdafx.h"
+#include "PinAffinity.h"
+#include "GroupRules.h"
+#include "Log.h"
+
+// Rule tables: tree root program keys (interned, so the pointer
+// identifies the key) and session IDs, mapped to type indices
+static std::unordered_map<const TCHAR*, int> s_treeRoots;
+static std::unordered_map<DWORD, int> s_sessions;
+
+// Recently exited group members, by PID
+struct GroupExit
+{
+	int groupType;
+	INT64 startTime;
+	DWORD lastScan;
+};
+static std::unordered_map<DWORD, GroupExit> s_exits;
+
+void GroupRulesInit()
+{
+	s_treeRoots.clear();
+	s_sessions.clear();
+
+	// The first type to claim a program or session gets it.  The
+	// program keys are already interned, so the tables never need to
+	// compare strings.
+	for (size_t i = 0; i < g_procTypes.size(); ++i)
+	{
+		ProcTypeDesc& t = g_procTypes[i];
+		for (auto key : t.treeRoots)
+		{
+			if (!s_treeRoots.emplace(key, (int)i).second)
+				LOG_WARNING(_T("AffinityTypes.txt: type %s: program %s already has a tree rule; ignored"),
+					t.name.c_str(), key);
+		}
+		for (auto sid : t.sessions)
+		{
+			if (!s_sessions.emplace(sid, (int)i).second)
+				LOG_WARNING(_T("AffinityTypes.txt: type %s: session %lu already has a rule; ignored"),
+					t.name.c_str(), sid);
+		}
+	}
+}
+
+bool HaveSessionRules()
+{
+	return s_sessions.size() != 0;
+}
+
+bool IsGroupRoot(const TCHAR *key)
+{
+	return s_treeRoots.find(key) != s_treeRoots.end();
+}
+
+int GroupTypeForProcess(const TCHAR *key, int parentGroup, INT64 parentStart, INT64 startTime, DWORD sessionId)
+{
+	// a tree root program starts its own group
+	auto itroot = s_treeRoots.find(key);
+	if (itroot != s_treeRoots.end())
+		return itroot->second;
+
+	// A process started by a group member joins the group.  The parent
+	// PID is only a hint, since the parent might have exited and had its
+	// PID reused, so make sure the parent we know by that PID started
+	// before this process did.
+	if (parentGroup >= 0 && (startTime == 0 || parentStart == 0 || parentStart <= startTime))
+		return parentGroup;
+
+	// check the session rules
+	auto itsession = s_sessions.find(sessionId);
+	return itsession != s_sessions.end() ? itsession->second : -1;
+}
+
+void NoteGroupExit(DWORD pid, int groupType, INT64 startTime, DWORD lastScan)
+{
+	s_exits[pid] = { groupType, startTime, lastScan };
+}
+
+bool FindGroupExit(DWORD pid, int &groupType, INT64 &startTime)
+{
+	auto it = s_exits.find(pid);
+	if (it == s_exits.end())
+		return false;
+	groupType = it->second.groupType;
+	startTime = it->second.startTime;
+	return true;
+}
+
+bool HaveGroupExits()
+{
+	return s_exits.size() != 0;
+}
+
+void ExpireGroupExits(DWORD scan)
+{
+	// A process last seen in scan N is noted as exited during scan N+1,
+	// and has to stay through the end of scan N+2
+	for (auto it = s_exits.begin(); it != s_exits.end(); )
+	{
+		if (scan - it->second.lastScan >= 2)
+			it = s_exits.erase(it);
+		else
+			++it;
+	}
+}
+
+void ClearGroupExits()
+{
+	s_exits.clear();
+}
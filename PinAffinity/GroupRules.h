@@ -0,0 +1,71 @@
+#pragma once
+
+// Group classification rules.
+//
+// The saved program settings classify processes one program at a time.
+// Group rules classify whole groups of processes instead, so that a
+// type can cover a front end and everything it launches, or everything
+// in a Windows session, without listing each program:
+//
+//   tree=<program>  - the program, and every process it starts,
+//                     directly or indirectly, belong to the type
+//   session=<n>     - every process in Windows session <n> belongs
+//                     to the type (session 0 holds the services)
+//
+// These are type options in AffinityTypes.txt.  A saved setting for a
+// program, or an individual assignment for a process, takes precedence
+// over its group's type; a process tree rule takes precedence over a
+// session rule.
+//
+// Each group is resolved once.  A tree's type is decided when its root
+// program starts, and each process records its group type, so a new
+// process joins its parent's group with a single process table lookup,
+// without looking at the rest of its ancestry; session rules are a
+// lookup table by session ID.  Windows processes can't change parents
+// or sessions, so a process's group never changes once it's decided.
+//
+// A group member's group outlives it briefly.  In a launcher chain
+// (cmd -> launcher -> game), the launcher often exits right after
+// starting the game, and the process list scan that first sees the
+// game can come after the one that found the launcher gone.  So when
+// a group member exits, we keep its group, by PID and start time, for
+// the rest of that scan and all of the next one, and a new process
+// whose parent isn't running any more can still join the group.
+
+// Build the rule tables from the process type list.  Call this after
+// loading the types.
+void GroupRulesInit();
+
+// are there any session rules?
+bool HaveSessionRules();
+
+// Figure the group type for a new process, or -1 if it isn't in any
+// group.  key is the program key (interned in g_strings); parentGroup
+// and parentStart are the parent process's group type and start time,
+// or -1 and 0 if we don't know the parent; startTime is the process's
+// own start time, or 0 if unknown; and sessionId is its session.  The
+// times can be on any clock, as long as both are on the same one; the
+// process list uses FILETIME values, and trace replay uses trace time.
+int GroupTypeForProcess(const TCHAR *key, int parentGroup, INT64 parentStart, INT64 startTime, DWORD sessionId);
+
+// Is the given process a tree rule root?  A root's group comes from its
+// own rule, never from its parent.
+bool IsGroupRoot(const TCHAR *key);
+
+// Note the exit of a group member.  lastScan is the number of the last
+// process list scan that found it running; the group stays available
+// through the scan after the one that notes the exit.
+void NoteGroupExit(DWORD pid, int groupType, INT64 startTime, DWORD lastScan);
+
+// Look up the group of a recently exited group member by PID.  Fills in
+// its group type and start time and returns true if there is one.
+bool FindGroupExit(DWORD pid, int &groupType, INT64 &startTime);
+
+// are any group member exits being kept?
+bool HaveGroupExits();
+
+// Drop the exits that are no longer needed, at the end of the given scan
+void ExpireGroupExits(DWORD scan);
+
+// forget all of the exits
+void ClearGroupExits();
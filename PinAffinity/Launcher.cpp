@@ -0,0 +1,115 @@
+#include "stdafx.h"
+#include "PinAffinity.h"
+#include "Launcher.h"
+#include "Numa.h"
+#include "Log.h"
+
+int RunLauncher(const TCHAR *typeName, const TCHAR *cmdLine)
+{
+	// look up the type
+	int iType = FindProcType(typeName);
+	if (iType < 0)
+	{
+		ErrorBox(IDS_ERR_RUN_TYPE);
+		return -1;
+	}
+
+	// skip leading spaces in the command line; there has to be something left
+	while (_istspace(*cmdLine))
+		++cmdLine;
+	if (*cmdLine == 0)
+	{
+		ErrorBox(IDS_ERR_USAGE);
+		return -1;
+	}
+
+	// CreateProcess can modify the command line buffer, so make a copy
+	TSTRING cmd = cmdLine;
+
+	// If the type has a NUMA policy, set the process's preferred node,
+	// so that its memory is allocated there from the start.  That takes
+	// an attribute list in the extended startup info.
+	const ProcTypeDesc& type = g_procTypes[iType];
+	STARTUPINFOEX si;
+	ZeroMemory(&si, sizeof(si));
+	si.StartupInfo.cb = sizeof(si.StartupInfo);
+	DWORD flags = CREATE_SUSPENDED;
+	std::vector<BYTE> attrBuf;
+	USHORT preferredNode = 0;
+	if (type.numaPolicy != ProcTypeDesc::NumaNone)
+	{
+		SIZE_T attrSize = 0;
+		InitializeProcThreadAttributeList(NULL, 1, 0, &attrSize);
+		attrBuf.resize(attrSize);
+		si.lpAttributeList = (LPPROC_THREAD_ATTRIBUTE_LIST)attrBuf.data();
+		preferredNode = (USHORT)LowestNumaNode(type.numaNodes);
+		if (InitializeProcThreadAttributeList(si.lpAttributeList, 1, 0, &attrSize)
+			&& UpdateProcThreadAttribute(si.lpAttributeList, 0, PROC_THREAD_ATTRIBUTE_PREFERRED_NODE,
+				&preferredNode, sizeof(preferredNode), NULL, NULL))
+		{
+			si.StartupInfo.cb = sizeof(si);
+			flags |= EXTENDED_STARTUPINFO_PRESENT;
+		}
+		else
+		{
+			LOG_WARNING(_T("/Run: unable to set the preferred NUMA node, Windows error %lu"), GetLastError());
+			si.lpAttributeList = NULL;
+		}
+	}
+
+	// Create the process suspended, so that we can set its affinity
+	// before its first thread runs a single instruction.
+	PROCESS_INFORMATION pi;
+	BOOL created = CreateProcess(NULL, &cmd[0], NULL, NULL, FALSE, flags, NULL, NULL, &si.StartupInfo, &pi);
+	if (si.lpAttributeList != NULL)
+		DeleteProcThreadAttributeList(si.lpAttributeList);
+	if (!created)
+	{
+		LOG_ERROR(_T("/Run: unable to launch %s, Windows error %lu"), cmdLine, GetLastError());
+		ErrorBox(IDS_ERR_RUN_LAUNCH);
+		return -1;
+	}
+
+	// apply the type's affinity mask, limited to the CPUs that exist
+	DWORD_PTR origAffinity = 0, sysAffinity = 0;
+	if (GetProcessAffinityMask(pi.hProcess, &origAffinity, &sysAffinity))
+	{
+		DWORD_PTR mask = type.affinityMask & sysAffinity;
+		if (mask == 0 || !SetProcessAffinityMask(pi.hProcess, mask))
+		{
+			LOG_WARNING(_T("/Run: unable to set affinity for PID %lu, Windows error %lu"), pi.dwProcessId, GetLastError());
+			origAffinity = 0;
+		}
+	}
+
+	// If the main instance is running, tell it about the new process so
+	// that it's tracked under this type and restored at exit.  Use a
+	// timeout so that a hung instance can't hold up the launch.
+	HWND hWndMain = FindWindowEx(0, 0, g_szWindowClass, 0);
+	if (hWndMain != NULL)
+	{
+		ClassifyMsg msg;
+		ZeroMemory(&msg, sizeof(msg));
+		msg.pid = pi.dwProcessId;
+		msg.origAffinity = origAffinity;
+		wcsncpy_s(msg.typeName, type.name.c_str(), _TRUNCATE);
+
+		COPYDATASTRUCT cds;
+		cds.dwData = COPYDATA_CLASSIFY;
+		cds.cbData = sizeof(msg);
+		cds.lpData = &msg;
+		DWORD_PTR result;
+		SendMessageTimeout(hWndMain, WM_COPYDATA, 0, (LPARAM)&cds, SMTO_ABORTIFHUNG, 2000, &result);
+	}
+
+	// let it run
+	ResumeThread(pi.hThread);
+	CloseHandle(pi.hThread);
+
+	// wait for it to exit, and pass back its exit code
+	DWORD exitCode = 0;
+	WaitForSingleObject(pi.hProcess, INFINITE);
+	GetExitCodeProcess(pi.hProcess, &exitCode);
+	CloseHandle(pi.hProcess);
+	return (int)exitCode;
+}
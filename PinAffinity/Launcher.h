@@ -0,0 +1,34 @@
+#pragma once
+
+// Launcher mode.  "PinAffinity /Run:<type> -- <command line>" starts
+// the given program with the CPU affinity for the named type already
+// in place, so that every thread the program ever creates starts out
+// on the right cores, rather than waiting for the background process
+// monitor to notice the new process.  If the main PinAffinity instance
+// is running, we tell it about the new process, so that it tracks it
+// (and restores its original affinity at exit) like any other.  The
+// launcher waits for the program to exit and returns its exit code,
+// so a front end that waits on the launched process sees the same
+// behavior as if it had launched the program directly.
+int RunLauncher(const TCHAR *typeName, const TCHAR *cmdLine);
+
+// WM_COPYDATA ID for a process classification notification
+const ULONG_PTR COPYDATA_CLASSIFY = 0x50410001;
+
+// WM_COPYDATA payload for COPYDATA_CLASSIFY.  This uses fixed-size
+// fields so that 32- and 64-bit builds can talk to each other.
+struct ClassifyMsg
+{
+	// process ID
+	DWORD pid;
+
+	// reserved for alignment; set to zero
+	DWORD reserved;
+
+	// the process's affinity mask before the launcher changed it,
+	// for restoring at exit
+	UINT64 origAffinity;
+
+	// affinity type name, as listed in AffinityTypes.txt
+	WCHAR typeName[64];
+};
@@ -0,0 +1,615 @@
+#include "stdafx.h"
+#include "Log.h"
+
+// Ring buffer size, in records, for each thread.  This only has to
+// absorb a burst between writer thread passes; anything beyond that
+// is dropped and counted rather than blocking the caller.
+static const UINT LOG_RING_SIZE = 128;
+
+// Maximum number of threads that can log at once.  Each thread claims
+// a ring on its first log call and releases it when it exits, so this
+// only has to cover the threads alive at the same time, not every
+// short-lived worker (such as the tuner's probe threads) over the life
+// of the process.
+static const LONG LOG_MAX_THREADS = 16;
+
+// Rate limiter parameters: each call site can log at most this many
+// messages per window; the rest are counted and reported with the
+// next message that gets through.
+static const ULONGLONG LOG_RATE_WINDOW = 10000;		// milliseconds
+static const LONG LOG_RATE_LIMIT = 20;
+
+// Log file rotation: when the file would exceed the size limit, we
+// rename it to .1 (shifting older files up) and start a new one.
+static const DWORD LOG_FILE_MAX_SIZE = 1024 * 1024;
+static const int LOG_FILE_KEEP = 3;
+
+// writer thread polling interval, in milliseconds
+static const DWORD LOG_POLL_INTERVAL = 250;
+
+// Ring ownership states.  A thread claims a free ring by moving it to
+// Owned.  When the thread exits, the ring moves to Released, and the
+// writer thread returns it to Free once it has drained the last of the
+// thread's records.
+static const LONG LOG_RING_FREE = 0;
+static const LONG LOG_RING_OWNED = 1;
+static const LONG LOG_RING_RELEASED = 2;
+
+// Per-thread ring.  This is a single-producer, single-consumer queue:
+// the owning thread advances 'head' after filling a record, and the
+// writer thread advances 'tail' after consuming one.  The counters
+// carry over when the ring passes to a new thread; it's empty then,
+// so only their difference matters.
+struct LogRing
+{
+	volatile LONG head;
+	volatile LONG tail;
+
+	// ownership state (LOG_RING_xxx)
+	volatile LONG state;
+
+	// messages dropped because the ring was full
+	volatile LONG dropped;
+
+	// owning thread ID
+	DWORD tid;
+
+	LogRecord recs[LOG_RING_SIZE];
+};
+
+static LogRing s_rings[LOG_MAX_THREADS];
+
+// messages dropped because there were no rings left for a new thread
+static volatile LONG s_noRingDropped = 0;
+
+// this thread's ring, claimed on first use
+static thread_local LogRing *t_ring = NULL;
+
+// Fiber-local storage index for the ring.  We store each thread's ring
+// here as well, purely so that the system calls ReleaseLogRing() with
+// it when the thread exits.
+static DWORD s_flsRing = FLS_OUT_OF_INDEXES;
+
+// writer thread state
+LogSeverity g_logMinSeverity = LogSeverity::Warning;
+static HANDLE s_hWriterThread = NULL;
+static HANDLE s_hWakeEvent = NULL;
+static volatile LONG s_quit = 0;
+
+// log file sink
+static TCHAR s_logFile[MAX_PATH];
+static HANDLE s_hLogFile = INVALID_HANDLE_VALUE;
+static DWORD s_logFileSize = 0;
+
+// console sink, if we have a standard error handle
+static HANDLE s_hStdErr = NULL;
+static bool s_stdErrIsConsole = false;
+
+// Formatting buffers.  These are only used on the writer thread (or on
+// the main thread during shutdown, after the writer has exited).
+static const size_t LOG_LINE_MAX = 1024;
+static TCHAR s_line[LOG_LINE_MAX];
+static char s_utf8[LOG_LINE_MAX * 3];
+
+static const TCHAR *SeverityName(LogSeverity severity)
+{
+	switch (severity)
+	{
+	case LogSeverity::Debug: return _T("DEBUG");
+	case LogSeverity::Info: return _T("INFO");
+	case LogSeverity::Warning: return _T("WARNING");
+	default: return _T("ERROR");
+	}
+}
+
+bool ParseLogSeverity(const TCHAR *name, LogSeverity &severity)
+{
+	static const struct { const TCHAR *name; LogSeverity severity; } names[] = {
+		{ _T("debug"), LogSeverity::Debug },
+		{ _T("info"), LogSeverity::Info },
+		{ _T("warning"), LogSeverity::Warning },
+		{ _T("error"), LogSeverity::Error }
+	};
+	for (auto const &n : names)
+	{
+		if (_tcsicmp(name, n.name) == 0)
+		{
+			severity = n.severity;
+			return true;
+		}
+	}
+	return false;
+}
+
+void LogRecord::AddStr(const void *s, LogArg::Type type, size_t charSize)
+{
+	if (nArgs >= MaxArgs)
+		return;
+
+	// align the string on a character boundary
+	UINT ofs = (UINT)((strUsed + charSize - 1) & ~(charSize - 1));
+	size_t avail = ofs < sizeof(strBuf) ? (sizeof(strBuf) - ofs) / charSize : 0;
+
+	LogArg &arg = args[nArgs++];
+	arg.type = type;
+	if (s == NULL || avail == 0)
+	{
+		// no room (or a null pointer) - store an empty string
+		arg.strOfs = ~0U;
+		return;
+	}
+
+	// copy as much as fits, leaving room for the null terminator
+	size_t n = 0;
+	if (charSize == sizeof(wchar_t))
+	{
+		const wchar_t *src = (const wchar_t *)s;
+		wchar_t *dst = (wchar_t *)(strBuf + ofs);
+		for (; n + 1 < avail && src[n] != 0; ++n)
+			dst[n] = src[n];
+		dst[n] = 0;
+	}
+	else
+	{
+		const char *src = (const char *)s;
+		char *dst = (char *)(strBuf + ofs);
+		for (; n + 1 < avail && src[n] != 0; ++n)
+			dst[n] = src[n];
+		dst[n] = 0;
+	}
+
+	arg.strOfs = ofs;
+	strUsed = ofs + (UINT)((n + 1) * charSize);
+}
+
+LogRecord *LogBegin(LogSite &site, LogSeverity severity, const TCHAR *fmt)
+{
+	// Apply the call site's rate limit.  The window reset isn't
+	// atomic with respect to the counters, but the worst a race can
+	// do is let a message or two extra through, which is harmless.
+	ULONGLONG now = GetTickCount64();
+	if (now - site.windowStart > LOG_RATE_WINDOW)
+	{
+		site.windowStart = now;
+		site.windowCount = 0;
+	}
+	if (InterlockedIncrement(&site.windowCount) > LOG_RATE_LIMIT)
+	{
+		InterlockedIncrement(&site.suppressed);
+		return NULL;
+	}
+
+	// claim a ring for this thread if we haven't already
+	LogRing *ring = t_ring;
+	if (ring == NULL)
+	{
+		for (LONG r = 0; r < LOG_MAX_THREADS && ring == NULL; ++r)
+		{
+			if (InterlockedCompareExchange(&s_rings[r].state, LOG_RING_OWNED, LOG_RING_FREE) == LOG_RING_FREE)
+				ring = &s_rings[r];
+		}
+		if (ring == NULL)
+		{
+			InterlockedIncrement(&s_noRingDropped);
+			return NULL;
+		}
+		t_ring = ring;
+		ring->tid = GetCurrentThreadId();
+
+		// arrange to release it when the thread exits
+		if (s_flsRing != FLS_OUT_OF_INDEXES)
+			FlsSetValue(s_flsRing, ring);
+	}
+
+	// if the ring is full, drop the message
+	LONG head = ring->head;
+	if ((ULONG)(head - ring->tail) >= LOG_RING_SIZE)
+	{
+		InterlockedIncrement(&ring->dropped);
+		return NULL;
+	}
+
+	// set up the record
+	LogRecord *rec = &ring->recs[(ULONG)head % LOG_RING_SIZE];
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	rec->time = ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+	rec->fmt = fmt;
+	rec->tid = ring->tid;
+	rec->severity = severity;
+	rec->suppressed = InterlockedExchange(&site.suppressed, 0);
+	rec->nArgs = 0;
+	rec->strUsed = 0;
+	return rec;
+}
+
+void LogCommit(LogRecord *rec)
+{
+	// publish the record; the interlocked write is a full barrier, so
+	// the writer thread sees the record contents before the new head
+	LogRing *ring = t_ring;
+	InterlockedExchange(&ring->head, ring->head + 1);
+
+	// Wake the writer right away for warnings and errors.  Lower
+	// severities just wait for the next polling pass, which saves the
+	// caller a kernel call.
+	if (rec->severity >= LogSeverity::Warning && s_hWakeEvent != NULL)
+		SetEvent(s_hWakeEvent);
+}
+
+// Thread exit callback for the ring FLS slot.  This hands the exiting
+// thread's ring back to the writer thread, which frees it for reuse
+// after draining it.
+static VOID WINAPI ReleaseLogRing(PVOID p)
+{
+	if (p != NULL)
+		InterlockedExchange(&((LogRing *)p)->state, LOG_RING_RELEASED);
+}
+
+// Format one conversion from a captured argument
+static TCHAR *FormatArg(TCHAR *dst, TCHAR *end, TCHAR *spec, size_t specLen, TCHAR conv, const LogRecord &rec, const LogArg *arg)
+{
+	// figure the argument value in each of the forms we might need
+	INT64 i = 0;
+	UINT64 u = 0;
+	double d = 0;
+	const void *str = NULL;
+	if (arg != NULL)
+	{
+		switch (arg->type)
+		{
+		case LogArg::Int: i = arg->i; u = (UINT64)arg->i; d = (double)arg->i; break;
+		case LogArg::UInt: i = (INT64)arg->u; u = arg->u; d = (double)arg->u; break;
+		case LogArg::Float: i = (INT64)arg->d; u = (UINT64)arg->d; d = arg->d; break;
+		case LogArg::Str:
+		case LogArg::NStr:
+			str = arg->strOfs == ~0U ? (const void *)"\0\0" : (const void *)(rec.strBuf + arg->strOfs);
+			break;
+		}
+	}
+	else
+	{
+		// missing argument
+		conv = 's';
+		str = L"<?>";
+	}
+
+	// Build the final conversion spec.  We discard the caller's length
+	// modifiers and substitute our own to match the captured type.
+	auto Spec = [spec, specLen](const TCHAR *suffix) -> const TCHAR *
+	{
+		_tcscpy_s(spec + specLen, 32 - specLen, suffix);
+		return spec;
+	};
+
+	size_t room = end - dst + 1;
+	switch (conv)
+	{
+	case 'd':
+	case 'i':
+		_sntprintf_s(dst, room, _TRUNCATE, Spec(_T("I64d")), i);
+		break;
+
+	case 'u':
+		_sntprintf_s(dst, room, _TRUNCATE, Spec(_T("I64u")), u);
+		break;
+
+	case 'x':
+		_sntprintf_s(dst, room, _TRUNCATE, Spec(_T("I64x")), u);
+		break;
+
+	case 'X':
+		_sntprintf_s(dst, room, _TRUNCATE, Spec(_T("I64X")), u);
+		break;
+
+	case 'o':
+		_sntprintf_s(dst, room, _TRUNCATE, Spec(_T("I64o")), u);
+		break;
+
+	case 'c':
+		_sntprintf_s(dst, room, _TRUNCATE, Spec(_T("c")), (int)i);
+		break;
+
+	case 'e': case 'E': case 'f': case 'g': case 'G': case 'a': case 'A':
+		{
+			TCHAR suffix[2] = { conv, 0 };
+			_sntprintf_s(dst, room, _TRUNCATE, Spec(suffix), d);
+		}
+		break;
+
+	case 'p':
+		_sntprintf_s(dst, room, _TRUNCATE, Spec(_T("p")), (void *)(UINT_PTR)u);
+		break;
+
+	case 's':
+	case 'S':
+		if (str == NULL)
+			_sntprintf_s(dst, room, _TRUNCATE, Spec(_T("I64d")), i);
+		else if (arg != NULL && arg->type == LogArg::NStr)
+			_sntprintf_s(dst, room, _TRUNCATE, Spec(_T("hs")), (const char *)str);
+		else
+			_sntprintf_s(dst, room, _TRUNCATE, Spec(_T("ls")), (const wchar_t *)str);
+		break;
+
+	default:
+		// unknown conversion - copy it literally
+		if (dst < end)
+			*dst++ = conv;
+		*dst = 0;
+		break;
+	}
+
+	// advance past the formatted text
+	return dst + _tcslen(dst);
+}
+
+// Format a record's message text into a buffer
+static TCHAR *FormatLogText(const LogRecord &rec, TCHAR *dst, TCHAR *end)
+{
+	int argi = 0;
+	for (const TCHAR *p = rec.fmt; *p != 0 && dst < end; )
+	{
+		// copy ordinary characters
+		if (*p != '%')
+		{
+			*dst++ = *p++;
+			continue;
+		}
+
+		// '%%' is a literal '%'
+		if (p[1] == '%')
+		{
+			*dst++ = '%';
+			p += 2;
+			continue;
+		}
+
+		// copy the flags, width and precision
+		TCHAR spec[32];
+		size_t specLen = 0;
+		spec[specLen++] = *p++;
+		while (*p != 0 && _tcschr(_T("-+ #0123456789."), *p) != 0 && specLen < 16)
+			spec[specLen++] = *p++;
+
+		// skip the length modifiers
+		for (;;)
+		{
+			if (*p != 0 && _tcschr(_T("hlLjztwq"), *p) != 0)
+				++p;
+			else if (*p == 'I')
+			{
+				++p;
+				if ((p[0] == '6' && p[1] == '4') || (p[0] == '3' && p[1] == '2'))
+					p += 2;
+			}
+			else
+				break;
+		}
+
+		// get the conversion character
+		TCHAR conv = *p;
+		if (conv == 0)
+			break;
+		++p;
+
+		// format the argument
+		const LogArg *arg = argi < rec.nArgs ? &rec.args[argi++] : NULL;
+		dst = FormatArg(dst, end, spec, specLen, conv, rec, arg);
+	}
+
+	*dst = 0;
+	return dst;
+}
+
+// Open the log file, rotating it first if it's too big to take the
+// next line
+static void RotateLogFile()
+{
+	if (s_hLogFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(s_hLogFile);
+		s_hLogFile = INVALID_HANDLE_VALUE;
+	}
+
+	// shift name.N-1 -> name.N, ..., name -> name.1
+	TCHAR from[MAX_PATH + 8], to[MAX_PATH + 8];
+	for (int i = LOG_FILE_KEEP; i > 0; --i)
+	{
+		_stprintf_s(to, _T("%s.%d"), s_logFile, i);
+		if (i > 1)
+			_stprintf_s(from, _T("%s.%d"), s_logFile, i - 1);
+		else
+			_tcscpy_s(from, s_logFile);
+		MoveFileEx(from, to, MOVEFILE_REPLACE_EXISTING);
+	}
+}
+
+static bool OpenLogFile()
+{
+	s_hLogFile = CreateFile(s_logFile, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (s_hLogFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	s_logFileSize = GetFileSize(s_hLogFile, NULL);
+	return true;
+}
+
+// Write a formatted line to the sinks
+static void WriteLine(TCHAR *line, TCHAR *lineEnd)
+{
+	// debugger
+	OutputDebugString(line);
+	OutputDebugString(_T("\n"));
+
+	// convert to UTF-8 with a CR-LF line ending for the file and console
+	*lineEnd++ = '\r';
+	*lineEnd++ = '\n';
+	int n = WideCharToMultiByte(CP_UTF8, 0, line, (int)(lineEnd - line), s_utf8, (int)sizeof(s_utf8), NULL, NULL);
+	if (n <= 0)
+		return;
+
+	// console
+	DWORD actual;
+	if (s_hStdErr != NULL)
+	{
+		if (s_stdErrIsConsole)
+			WriteConsole(s_hStdErr, line, (DWORD)(lineEnd - line), &actual, NULL);
+		else
+			WriteFile(s_hStdErr, s_utf8, (DWORD)n, &actual, NULL);
+	}
+
+	// log file
+	if (s_logFile[0] != 0)
+	{
+		if (s_hLogFile != INVALID_HANDLE_VALUE && s_logFileSize + (DWORD)n > LOG_FILE_MAX_SIZE)
+			RotateLogFile();
+		if (s_hLogFile != INVALID_HANDLE_VALUE || OpenLogFile())
+		{
+			if (WriteFile(s_hLogFile, s_utf8, (DWORD)n, &actual, NULL))
+				s_logFileSize += actual;
+		}
+	}
+}
+
+// Write a record
+static void WriteRecord(const LogRecord &rec)
+{
+	// format the prefix: local time, severity, thread
+	FILETIME ft, lt;
+	SYSTEMTIME st;
+	ft.dwLowDateTime = (DWORD)rec.time;
+	ft.dwHighDateTime = (DWORD)(rec.time >> 32);
+	FileTimeToLocalFileTime(&ft, &lt);
+	FileTimeToSystemTime(&lt, &st);
+
+	// leave room at the end for the line terminator
+	TCHAR *end = s_line + LOG_LINE_MAX - 3;
+	TCHAR *p = s_line;
+	_sntprintf_s(p, end - p + 1, _TRUNCATE, _T("%04d-%02d-%02d %02d:%02d:%02d.%03d [%s] (%lu) "),
+		st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, st.wMilliseconds,
+		SeverityName(rec.severity), (unsigned long)rec.tid);
+	p += _tcslen(p);
+
+	// format the message
+	p = FormatLogText(rec, p, end);
+
+	// note any rate-limited messages from the same call site
+	if (rec.suppressed != 0)
+	{
+		_sntprintf_s(p, end - p + 1, _TRUNCATE, _T(" [%ld similar messages suppressed]"), (long)rec.suppressed);
+		p += _tcslen(p);
+	}
+
+	WriteLine(s_line, p);
+}
+
+// Write a note about dropped messages
+static void WriteDropNote(LONG n)
+{
+	TCHAR *end = s_line + LOG_LINE_MAX - 3;
+	_sntprintf_s(s_line, end - s_line + 1, _TRUNCATE, _T("[WARNING] %ld log messages dropped (log buffer full)"), (long)n);
+	WriteLine(s_line, s_line + _tcslen(s_line));
+}
+
+// Drain all of the rings
+static void DrainRings()
+{
+	for (LONG r = 0; r < LOG_MAX_THREADS; ++r)
+	{
+		// Note the state before draining.  A thread releases its ring
+		// only after committing its last record, so if we see it
+		// released here, the drain below gets everything.
+		LogRing &ring = s_rings[r];
+		LONG state = ring.state;
+		if (state == LOG_RING_FREE)
+			continue;
+
+		for (LONG tail = ring.tail; tail != ring.head; ++tail)
+		{
+			WriteRecord(ring.recs[(ULONG)tail % LOG_RING_SIZE]);
+
+			// release the slot back to the producer
+			InterlockedExchange(&ring.tail, tail + 1);
+		}
+
+		if (LONG dropped = InterlockedExchange(&ring.dropped, 0))
+			WriteDropNote(dropped);
+
+		// if the owner has exited, the ring is free for another thread
+		if (state == LOG_RING_RELEASED)
+			InterlockedExchange(&ring.state, LOG_RING_FREE);
+	}
+
+	if (LONG dropped = InterlockedExchange(&s_noRingDropped, 0))
+		WriteDropNote(dropped);
+}
+
+static DWORD WINAPI LogWriterThread(LPVOID)
+{
+	// Run in background mode, so that log writing never competes with
+	// anything that matters (this also lowers our I/O priority)
+	SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+	while (!s_quit)
+	{
+		WaitForSingleObject(s_hWakeEvent, LOG_POLL_INTERVAL);
+		DrainRings();
+	}
+
+	return 0;
+}
+
+void LogInit(const TCHAR *logFile, LogSeverity minSeverity)
+{
+	g_logMinSeverity = minSeverity;
+
+	// note the log file; it's opened on the first write, so that we
+	// don't leave empty log files around when there's nothing to say
+	if (logFile != NULL)
+		_tcscpy_s(s_logFile, logFile);
+
+	// set up the console sink if we have a standard error handle
+	HANDLE h = GetStdHandle(STD_ERROR_HANDLE);
+	if (h != NULL && h != INVALID_HANDLE_VALUE)
+	{
+		DWORD mode;
+		s_hStdErr = h;
+		s_stdErrIsConsole = GetConsoleMode(h, &mode) != 0;
+	}
+
+	// set up ring release on thread exit
+	s_flsRing = FlsAlloc(ReleaseLogRing);
+
+	// start the writer thread
+	s_hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	DWORD tid;
+	s_hWriterThread = CreateThread(NULL, 0, LogWriterThread, NULL, 0, &tid);
+}
+
+void LogShutdown()
+{
+	// stop the writer thread
+	if (s_hWriterThread != NULL)
+	{
+		InterlockedExchange(&s_quit, 1);
+		SetEvent(s_hWakeEvent);
+		WaitForSingleObject(s_hWriterThread, INFINITE);
+		CloseHandle(s_hWriterThread);
+		s_hWriterThread = NULL;
+	}
+
+	// write anything still pending
+	DrainRings();
+
+	if (s_hLogFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(s_hLogFile);
+		s_hLogFile = INVALID_HANDLE_VALUE;
+	}
+	if (s_hWakeEvent != NULL)
+	{
+		CloseHandle(s_hWakeEvent);
+		s_hWakeEvent = NULL;
+	}
+}
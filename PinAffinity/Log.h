@@ -0,0 +1,171 @@
+#pragma once
+#include "Util.h"
+
+// Logging subsystem.
+//
+// Log calls are designed to be cheap enough to use from the affinity
+// apply path.  A Log() call never allocates memory and never blocks:
+// it just copies the format string pointer and the raw argument values
+// into a fixed-size record in a preallocated per-thread ring buffer.
+// A background thread drains the rings, does the actual printf-style
+// formatting, and writes the results to the sinks (the debugger, the
+// console if we have one, and a rotating log file in the program
+// folder).  If a ring is full, the message is dropped and counted
+// rather than making the caller wait; the drop count is reported in
+// the log when space frees up.
+//
+// Each call site also has its own rate limiter, so that a burst of
+// identical errors (e.g., a failed restore for every process on the
+// system at exit) collapses into a handful of messages plus a count
+// of the suppressed ones.
+//
+// Format strings must be string literals (or otherwise have static
+// lifetime), since formatting is deferred.  String arguments are
+// copied into the record at the time of the call, truncated if
+// necessary, so they can be temporaries.
+
+// message severity levels
+enum class LogSeverity : BYTE
+{
+	Debug,
+	Info,
+	Warning,
+	Error
+};
+
+// Per-callsite state.  The LOG_xxx macros create one of these as a
+// static object at each call site; it carries the rate limiter state.
+struct LogSite
+{
+	// start of the current rate-limit window, in GetTickCount64() ticks
+	volatile ULONGLONG windowStart;
+
+	// number of messages logged from this site in the current window
+	volatile LONG windowCount;
+
+	// number of messages suppressed since the last one we let through
+	volatile LONG suppressed;
+};
+
+// A captured printf argument.  We store each argument as a 64-bit
+// integer, a double, or an offset into the record's string buffer,
+// which is enough to reproduce any printf conversion later.
+struct LogArg
+{
+	enum Type : BYTE { Int, UInt, Float, Str, NStr };
+	Type type;
+	union
+	{
+		INT64 i;
+		UINT64 u;
+		double d;
+		UINT strOfs;
+	};
+};
+
+// Captured log record.  These are fixed-size, so that the per-thread
+// rings can be allocated once up front.
+struct LogRecord
+{
+	static const int MaxArgs = 8;
+	static const int StrBufLen = 160;
+
+	// format string - must have static lifetime
+	const TCHAR *fmt;
+
+	// time of the call, as a system FILETIME value
+	ULONGLONG time;
+
+	// calling thread ID
+	DWORD tid;
+
+	// number of earlier messages from the same call site that the rate
+	// limiter suppressed, to be reported along with this message
+	LONG suppressed;
+
+	// severity
+	LogSeverity severity;
+
+	// captured arguments
+	BYTE nArgs;
+	LogArg args[MaxArgs];
+
+	// string argument storage
+	UINT strUsed;
+	BYTE strBuf[StrBufLen * sizeof(TCHAR)];
+
+	void Add(INT64 v) { if (nArgs < MaxArgs) { args[nArgs].type = LogArg::Int; args[nArgs++].i = v; } }
+	void Add(UINT64 v) { if (nArgs < MaxArgs) { args[nArgs].type = LogArg::UInt; args[nArgs++].u = v; } }
+	void Add(double v) { if (nArgs < MaxArgs) { args[nArgs].type = LogArg::Float; args[nArgs++].d = v; } }
+	void Add(const wchar_t *s) { AddStr(s, LogArg::Str, sizeof(wchar_t)); }
+	void Add(const char *s) { AddStr(s, LogArg::NStr, sizeof(char)); }
+	void Add(const TSTRING &s) { Add(s.c_str()); }
+	void Add(const void *p) { Add((UINT64)(UINT_PTR)p); }
+	void Add(bool v) { Add((INT64)v); }
+	void Add(char v) { Add((INT64)v); }
+	void Add(wchar_t v) { Add((INT64)v); }
+	void Add(int v) { Add((INT64)v); }
+	void Add(long v) { Add((INT64)v); }
+	void Add(unsigned int v) { Add((UINT64)v); }
+	void Add(unsigned long v) { Add((UINT64)v); }
+	void Add(float v) { Add((double)v); }
+
+	// copy a string argument into the string buffer, truncating it
+	// if it doesn't fit
+	void AddStr(const void *s, LogArg::Type type, size_t charSize);
+};
+
+// Initialize logging.  This sets the minimum severity and starts the
+// background writer thread.  logFile is the full path of the log file
+// to write, or null to disable the file sink.  Messages logged before
+// this is called are simply held in the ring buffers until the writer
+// thread starts.
+void LogInit(const TCHAR *logFile, LogSeverity minSeverity);
+
+// Flush all pending messages and shut down the writer thread.
+void LogShutdown();
+
+// parse a severity name ("debug", "info", "warning", "error");
+// returns false if the name isn't recognized
+bool ParseLogSeverity(const TCHAR *name, LogSeverity &severity);
+
+// Current minimum severity.  Messages below this level are discarded
+// at the call site, before capturing any arguments.
+extern LogSeverity g_logMinSeverity;
+
+// Internal entrypoints for the Log() template.  LogBegin() applies
+// the rate limiter and claims a record in the calling thread's ring,
+// returning null if the message should be discarded.  LogCommit()
+// publishes the filled-in record to the writer thread.
+LogRecord *LogBegin(LogSite &site, LogSeverity severity, const TCHAR *fmt);
+void LogCommit(LogRecord *rec);
+
+inline void LogCapture(LogRecord *) { }
+template<typename T, typename... Rest>
+inline void LogCapture(LogRecord *rec, const T &arg, const Rest&... rest)
+{
+	rec->Add(arg);
+	LogCapture(rec, rest...);
+}
+
+// Log a message
+template<typename... Args>
+inline void Log(LogSite &site, LogSeverity severity, const TCHAR *fmt, const Args&... args)
+{
+	if (severity < g_logMinSeverity)
+		return;
+
+	if (LogRecord *rec = LogBegin(site, severity, fmt))
+	{
+		LogCapture(rec, args...);
+		LogCommit(rec);
+	}
+}
+
+// Call-site macros.  Each expansion gets its own static LogSite for
+// the rate limiter.
+#define LOG_AT(severity, ...) do { static LogSite logSite_; Log(logSite_, severity, __VA_ARGS__); } while (0)
+#define LOG_DEBUG(...)    LOG_AT(LogSeverity::Debug, __VA_ARGS__)
+#define LOG_INFO(...)     LOG_AT(LogSeverity::Info, __VA_ARGS__)
+#define LOG_WARNING(...)  LOG_AT(LogSeverity::Warning, __VA_ARGS__)
+#define LOG_ERROR(...)    LOG_AT(LogSeverity::Error, __VA_ARGS__)
@@ -1,3 +0,0 @@
-#pragma once
-
-void LogError(const TCHAR *msg, ...);
@@ -0,0 +1,95 @@
+#include "stdafx.h"
+#include "Util.h"
+#include "MemoryRelief.h"
+
+bool ApplyMemoryRelief(DWORD pid, DWORD wsCapMB, bool trim, int priority, MemoryReliefState &state)
+{
+	state.applied = true;
+
+	HandleHolder hProc = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_SET_QUOTA | PROCESS_SET_INFORMATION, FALSE, pid);
+	if (hProc == NULL)
+		return false;
+
+	bool ok = true;
+	if (wsCapMB != 0)
+	{
+		// Save the original limits, then set the hard maximum.  The
+		// minimum has to stay below the maximum, so lower it too if
+		// necessary.
+		SIZE_T wsMin, wsMax;
+		DWORD flags;
+		if (GetProcessWorkingSetSizeEx(hProc, &wsMin, &wsMax, &flags))
+		{
+			SIZE_T cap = (SIZE_T)wsCapMB * 1024 * 1024;
+			if (SetProcessWorkingSetSizeEx(hProc, min(wsMin, cap / 2), cap,
+				QUOTA_LIMITS_HARDWS_MIN_DISABLE | QUOTA_LIMITS_HARDWS_MAX_ENABLE))
+			{
+				state.wsCapped = true;
+				state.origMin = wsMin;
+				state.origMax = wsMax;
+				state.origFlags = flags;
+			}
+			else
+				ok = false;
+		}
+		else
+			ok = false;
+	}
+
+	if (trim && !EmptyWorkingSet(hProc))
+		ok = false;
+
+	if (priority >= 0)
+	{
+		MEMORY_PRIORITY_INFORMATION mpi;
+		if (GetProcessInformation(hProc, ProcessMemoryPriority, &mpi, sizeof(mpi)))
+		{
+			ULONG orig = mpi.MemoryPriority;
+			mpi.MemoryPriority = (ULONG)priority;
+			if (SetProcessInformation(hProc, ProcessMemoryPriority, &mpi, sizeof(mpi)))
+			{
+				state.priChanged = true;
+				state.origPriority = orig;
+			}
+			else
+				ok = false;
+		}
+		else
+			ok = false;
+	}
+
+	return ok;
+}
+
+void UndoMemoryRelief(DWORD pid, MemoryReliefState &state)
+{
+	if (state.wsCapped || state.priChanged)
+	{
+		HandleHolder hProc = OpenProcess(PROCESS_SET_QUOTA | PROCESS_SET_INFORMATION, FALSE, pid);
+		if (hProc != NULL)
+		{
+			// Restore the working set limits.  The flags only report which
+			// limits were enabled, so explicitly disable the ones that
+			// weren't.
+			if (state.wsCapped)
+			{
+				DWORD flags = state.origFlags;
+				if ((flags & QUOTA_LIMITS_HARDWS_MIN_ENABLE) == 0)
+					flags |= QUOTA_LIMITS_HARDWS_MIN_DISABLE;
+				if ((flags & QUOTA_LIMITS_HARDWS_MAX_ENABLE) == 0)
+					flags |= QUOTA_LIMITS_HARDWS_MAX_DISABLE;
+				SetProcessWorkingSetSizeEx(hProc, state.origMin, state.origMax, flags);
+			}
+
+			// restore the memory priority
+			if (state.priChanged)
+			{
+				MEMORY_PRIORITY_INFORMATION mpi;
+				mpi.MemoryPriority = state.origPriority;
+				SetProcessInformation(hProc, ProcessMemoryPriority, &mpi, sizeof(mpi));
+			}
+		}
+	}
+
+	state = MemoryReliefState();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+// Background memory pressure relief.
+//
+// Reserving cores keeps background programs from taking the game's CPU
+// time, but not its memory.  A browser or an updater that's busy in the
+// background can push the system into trimming working sets, and if the
+// game's pages get trimmed, it stalls on page faults in the middle of
+// play.  So while a game session is running (any program of a type
+// other than the default type, and other than the types being relieved
+// themselves), the programs of a type with memory relief options are
+// reined in:
+//
+//  - A hard working set cap ("memcap=<MB>") limits how much physical
+//    memory each of the type's programs can hold.  Past the cap, the
+//    program's own pages are recycled, rather than anyone else's.
+//
+//  - A trim ("memtrim=on") empties each program's working set when the
+//    session starts (or when the program starts during a session).
+//    The pages go to the standby list, where they're still available
+//    if the program touches them again soon, but are free for the game
+//    to use in the meantime.
+//
+//  - A lower memory priority ("mempri=low" or "mempri=verylow") marks
+//    the program's pages as the first to be repurposed when memory is
+//    needed, so that the game's standby pages outlast them.
+//
+// When the session ends, the working set limits and memory priority go
+// back to what they were.  (There's nothing to undo for a trim; the
+// program simply faults its pages back in as it uses them.)
+
+// Saved per-process state, for undoing the changes
+struct MemoryReliefState
+{
+	MemoryReliefState() : applied(false), wsCapped(false), origMin(0), origMax(0),
+		origFlags(0), priChanged(false), origPriority(0) { }
+
+	// are the type's relief settings currently applied to the process?
+	bool applied;
+
+	// Did we set a working set cap?  If so, these are the original
+	// working set limits and flags to restore.
+	bool wsCapped;
+	SIZE_T origMin;
+	SIZE_T origMax;
+	DWORD origFlags;
+
+	// did we change the memory priority, and if so, what was it?
+	bool priChanged;
+	ULONG origPriority;
+};
+
+// Apply memory relief to a process.  wsCapMB is the working set cap in
+// megabytes, or 0 for none; trim empties the working set; priority is
+// the new memory priority (MEMORY_PRIORITY_xxx), or -1 to leave it
+// alone.  Records what was changed in the state.  Returns false if the
+// process can't be opened, or if any of the changes failed.
+bool ApplyMemoryRelief(DWORD pid, DWORD wsCapMB, bool trim, int priority, MemoryReliefState &state);
+
+// Undo the changes recorded in the state
+void UndoMemoryRelief(DWORD pid, MemoryReliefState &state);
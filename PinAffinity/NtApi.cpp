@@ -0,0 +1,15 @@
+#include "stdafx.h"
+#include "NtApi.h"
+
+NtQuerySystemInformation_t GetNtQuerySystemInformation()
+{
+	static NtQuerySystemInformation_t proc = NULL;
+	static bool inited = false;
+	if (!inited)
+	{
+		if (HMODULE hNtdll = GetModuleHandle(_T("ntdll.dll")))
+			proc = (NtQuerySystemInformation_t)GetProcAddress(hNtdll, "NtQuerySystemInformation");
+		inited = true;
+	}
+	return proc;
+}
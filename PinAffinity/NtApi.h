@@ -0,0 +1,129 @@
+#pragma once
+
+// Native API declarations.  Some of the system statistics we collect
+// are only available through NtQuerySystemInformation(), which has no
+// import library in the standard SDK, so we look it up in ntdll.dll at
+// run time.  The structures are declared here with their documented
+// layouts, since the SDK's winternl.h leaves most of their fields as
+// "reserved".
+
+// information classes
+const ULONG NtSystemProcessInformation = 5;
+const ULONG NtSystemProcessorPerformanceInformation = 8;
+const ULONG NtSystemInterruptInformation = 23;
+
+// STATUS_INFO_LENGTH_MISMATCH: the buffer is too small
+const LONG NtStatusInfoLengthMismatch = (LONG)0xC0000004;
+
+// SystemProcessorPerformanceInformation entry, one per logical processor.
+// Times are cumulative, in 100ns units.  Kernel time includes idle time,
+// and both DPC and interrupt time are included in kernel time.
+struct NtProcessorPerformanceInfo
+{
+	LARGE_INTEGER IdleTime;
+	LARGE_INTEGER KernelTime;
+	LARGE_INTEGER UserTime;
+	LARGE_INTEGER DpcTime;
+	LARGE_INTEGER InterruptTime;
+	ULONG InterruptCount;
+};
+
+// SystemInterruptInformation entry, one per logical processor.  The
+// counts are cumulative.
+struct NtInterruptInfo
+{
+	ULONG ContextSwitches;
+	ULONG DpcCount;
+	ULONG DpcRate;
+	ULONG TimeIncrement;
+	ULONG DpcBypassCount;
+	ULONG ApcBypassCount;
+};
+
+// counted Unicode string
+struct NtUnicodeString
+{
+	USHORT Length;			// in bytes, not including any null terminator
+	USHORT MaximumLength;
+	PWSTR Buffer;
+};
+
+// thread scheduling states (KTHREAD_STATE)
+enum NtThreadState
+{
+	NtThreadInitialized = 0,
+	NtThreadReady = 1,
+	NtThreadRunning = 2,
+	NtThreadStandby = 3,
+	NtThreadTerminated = 4,
+	NtThreadWaiting = 5,
+	NtThreadTransition = 6,
+	NtThreadDeferredReady = 7,
+};
+
+// SystemProcessInformation thread entry
+struct NtSystemThreadInfo
+{
+	LARGE_INTEGER KernelTime;
+	LARGE_INTEGER UserTime;
+	LARGE_INTEGER CreateTime;
+	ULONG WaitTime;
+	PVOID StartAddress;
+	HANDLE UniqueProcess;
+	HANDLE UniqueThread;
+	LONG Priority;
+	LONG BasePriority;
+	ULONG ContextSwitches;
+	ULONG ThreadState;
+	ULONG WaitReason;
+};
+
+// SystemProcessInformation process entry.  The result is a chain of
+// these, linked by NextEntryOffset (zero in the last entry), each one
+// followed immediately by NumberOfThreads thread entries.
+struct NtSystemProcessInfo
+{
+	ULONG NextEntryOffset;
+	ULONG NumberOfThreads;
+	LARGE_INTEGER WorkingSetPrivateSize;
+	ULONG HardFaultCount;
+	ULONG NumberOfThreadsHighWatermark;
+	ULONGLONG CycleTime;
+	LARGE_INTEGER CreateTime;
+	LARGE_INTEGER UserTime;
+	LARGE_INTEGER KernelTime;
+	NtUnicodeString ImageName;
+	LONG BasePriority;
+	HANDLE UniqueProcessId;
+	HANDLE InheritedFromUniqueProcessId;
+	ULONG HandleCount;
+	ULONG SessionId;
+	ULONG_PTR UniqueProcessKey;
+	SIZE_T PeakVirtualSize;
+	SIZE_T VirtualSize;
+	ULONG PageFaultCount;
+	SIZE_T PeakWorkingSetSize;
+	SIZE_T WorkingSetSize;
+	SIZE_T QuotaPeakPagedPoolUsage;
+	SIZE_T QuotaPagedPoolUsage;
+	SIZE_T QuotaPeakNonPagedPoolUsage;
+	SIZE_T QuotaNonPagedPoolUsage;
+	SIZE_T PagefileUsage;
+	SIZE_T PeakPagefileUsage;
+	SIZE_T PrivatePageCount;
+	LARGE_INTEGER ReadOperationCount;
+	LARGE_INTEGER WriteOperationCount;
+	LARGE_INTEGER OtherOperationCount;
+	LARGE_INTEGER ReadTransferCount;
+	LARGE_INTEGER WriteTransferCount;
+	LARGE_INTEGER OtherTransferCount;
+
+	// get the thread entries following the process entry
+	const NtSystemThreadInfo *Threads() const { return (const NtSystemThreadInfo *)(this + 1); }
+};
+
+typedef LONG (WINAPI *NtQuerySystemInformation_t)(ULONG infoClass, PVOID buf, ULONG len, PULONG retLen);
+
+// Get the NtQuerySystemInformation entrypoint, or NULL if it's not
+// available.  The lookup is done once and cached.
+NtQuerySystemInformation_t GetNtQuerySystemInformation();
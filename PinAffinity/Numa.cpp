@@ -0,0 +1,104 @@
+#include "stdafx.h"
+#include "Util.h"
+#include "Numa.h"
+
+// maximum number of pages to sample per process
+static const DWORD NUMA_MAX_SAMPLES = 4096;
+
+DWORD_PTR GetNumaNodesCpuMask(UINT64 nodes)
+{
+	DWORD_PTR mask = 0;
+	for (USHORT node = 0; node < 64; ++node)
+	{
+		if ((nodes & ((UINT64)1 << node)) != 0)
+		{
+			GROUP_AFFINITY ga;
+			if (GetNumaNodeProcessorMaskEx(node, &ga) && ga.Group == 0)
+				mask |= (DWORD_PTR)ga.Mask;
+		}
+	}
+	return mask;
+}
+
+int LowestNumaNode(UINT64 nodes)
+{
+	for (int node = 0; node < 64; ++node)
+	{
+		if ((nodes & ((UINT64)1 << node)) != 0)
+			return node;
+	}
+	return -1;
+}
+
+// Walk the committed regions of a process's address space, calling the
+// callback for each one.  Returns the total committed size.
+template<typename F>
+static SIZE_T ForEachCommittedRegion(HANDLE hProc, F func)
+{
+	SIZE_T total = 0;
+	MEMORY_BASIC_INFORMATION mbi;
+	for (BYTE *addr = 0; VirtualQueryEx(hProc, addr, &mbi, sizeof(mbi)) == sizeof(mbi);
+		addr = (BYTE *)mbi.BaseAddress + mbi.RegionSize)
+	{
+		if (mbi.State == MEM_COMMIT)
+		{
+			func(mbi);
+			total += mbi.RegionSize;
+		}
+	}
+	return total;
+}
+
+bool SampleRemoteMemory(DWORD pid, UINT64 localNodes, double &remotePct, DWORD &nResident)
+{
+	HandleHolder hProc = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, pid);
+	if (hProc == NULL)
+		return false;
+
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	SIZE_T pageSize = si.dwPageSize;
+
+	// First pass: figure the total committed size, so that we can pick
+	// a sampling stride that spreads the samples across all of it.
+	SIZE_T total = ForEachCommittedRegion(hProc, [](const MEMORY_BASIC_INFORMATION &) { });
+	if (total == 0)
+		return false;
+	SIZE_T stride = max(pageSize, (total / NUMA_MAX_SAMPLES + pageSize - 1) / pageSize * pageSize);
+
+	// Second pass: collect the sample addresses.  The sample buffer is
+	// static, since we only ever sample one process at a time on the
+	// main thread.
+	static PSAPI_WORKING_SET_EX_INFORMATION samples[NUMA_MAX_SAMPLES];
+	DWORD n = 0;
+	SIZE_T carry = 0;
+	ForEachCommittedRegion(hProc, [&](const MEMORY_BASIC_INFORMATION &mbi)
+	{
+		// continue the stride across region boundaries
+		SIZE_T ofs = carry;
+		for (; ofs < mbi.RegionSize && n < NUMA_MAX_SAMPLES; ofs += stride)
+			samples[n++].VirtualAddress = (BYTE *)mbi.BaseAddress + ofs;
+		carry = ofs >= mbi.RegionSize ? ofs - mbi.RegionSize : 0;
+	});
+
+	// query the sampled pages
+	if (n == 0 || !QueryWorkingSetEx(hProc, samples, n * sizeof(samples[0])))
+		return false;
+
+	// count resident pages, and the ones on remote nodes
+	DWORD remote = 0;
+	nResident = 0;
+	for (DWORD i = 0; i < n; ++i)
+	{
+		const PSAPI_WORKING_SET_EX_BLOCK &attrs = samples[i].VirtualAttributes;
+		if (attrs.Valid)
+		{
+			++nResident;
+			if ((localNodes & ((UINT64)1 << attrs.Node)) == 0)
+				++remote;
+		}
+	}
+
+	remotePct = nResident != 0 ? 100.0 * remote / nResident : 0.0;
+	return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+// NUMA memory placement helpers.
+//
+// Windows doesn't provide a way to migrate another process's existing
+// pages to a different node, or to change another process's memory
+// policy after it starts.  What it does do is allocate new pages from
+// the node of the processor the allocating thread runs on (or from the
+// process's preferred node, which can be set at process creation).  So
+// we implement a type's memory policy by confining the type's CPUs to
+// the selected nodes, and by setting the preferred node for processes
+// started through the /Run launcher.  To show how well that's working,
+// we sample where each process's resident pages actually live.
+
+// Get the union of the CPU masks (in processor group 0) for the NUMA
+// nodes in the given node set.  Bit N of the node set selects node N.
+DWORD_PTR GetNumaNodesCpuMask(UINT64 nodes);
+
+// get the lowest-numbered node in a node set, or -1 if the set is empty
+int LowestNumaNode(UINT64 nodes);
+
+// Estimate the fraction of a process's resident memory that lives
+// outside the given node set.  This samples a bounded number of pages
+// spread evenly across the process's committed address space, so the
+// cost doesn't grow with the process's size.  Returns false if the
+// process can't be queried.  On success, fills in the remote
+// percentage and the number of resident pages sampled.
+bool SampleRemoteMemory(DWORD pid, UINT64 localNodes, double &remotePct, DWORD &nResident);
@@ -0,0 +1,262 @@
+#pragma once
+#include <vector>
+
+// Order-statistics tree.  This is a balanced binary search tree (a
+// treap: a search tree by key, and a heap by a random priority per
+// node, which keeps the expected depth logarithmic) where each node
+// also counts the nodes in its subtree.  The counts let it find the
+// entry at a given position in order, and the position of a given
+// entry, in O(log n) time, in addition to the usual ordered insert and
+// erase.  The sorted list view uses this to keep its rows in order as
+// entries come, go, and change, without ever re-sorting the list.
+//
+// Keys must be unique under the ordering.  Less is a function object,
+// bool operator()(const Key&, const Key&), and can carry state (such as
+// a sort direction), but it can only be changed while the tree is
+// empty, since the nodes are arranged by the old ordering.
+//
+// Nodes are kept in a vector, linked by index, with a free list, so
+// the tree only allocates when it grows past its largest size so far.
+// There's nothing platform-specific in here.
+template<typename Key, typename Value, typename Less>
+class OrderStatTree
+{
+public:
+	OrderStatTree(const Less &less = Less()) : less(less), root(-1), seed(0x9E3779B9u) { }
+
+	// number of entries
+	int Count() const { return Size(root); }
+
+	// Get/set the ordering.  The ordering can only be set while the
+	// tree is empty.
+	const Less &GetLess() const { return less; }
+	void SetLess(const Less &l) { less = l; }
+
+	// remove all entries, keeping the node memory for reuse
+	void Clear()
+	{
+		nodes.clear();
+		freeList.clear();
+		root = -1;
+	}
+
+	// Insert an entry.  The key must not already be in the tree.
+	// Returns the new entry's position in order.
+	int Insert(const Key &key, const Value &val)
+	{
+		int pos = Rank(key);
+		int n = Alloc(key, val);
+		int l, r;
+		Split(root, key, l, r);
+		root = Merge(Merge(l, n), r);
+		return pos;
+	}
+
+	// Erase an entry by key.  Returns the position it had, or -1 if
+	// it's not in the tree.
+	int Erase(const Key &key)
+	{
+		int pos = Find(key);
+		if (pos >= 0)
+			root = Erase(root, key);
+		return pos;
+	}
+
+	// find an entry by key; returns its position, or -1 if it's not in the tree
+	int Find(const Key &key) const
+	{
+		int pos = 0;
+		for (int t = root; t >= 0; )
+		{
+			const Node &n = nodes[t];
+			if (less(key, n.key))
+				t = n.left;
+			else if (less(n.key, key))
+			{
+				pos += Size(n.left) + 1;
+				t = n.right;
+			}
+			else
+				return pos + Size(n.left);
+		}
+		return -1;
+	}
+
+	// get the value at a position; the position must be in range
+	const Value &At(int pos) const
+	{
+		int t = root;
+		for (;;)
+		{
+			const Node &n = nodes[t];
+			int ls = Size(n.left);
+			if (pos < ls)
+				t = n.left;
+			else if (pos == ls)
+				return n.val;
+			else
+			{
+				pos -= ls + 1;
+				t = n.right;
+			}
+		}
+	}
+
+	// visit the values in order
+	template<typename F> void ForEach(F f) const { ForEach(root, f); }
+
+protected:
+	struct Node
+	{
+		Key key;
+		Value val;
+
+		// child links, as indices into 'nodes', or -1 for none
+		int left;
+		int right;
+
+		// number of nodes in the subtree rooted here
+		int size;
+
+		// heap priority
+		unsigned int prio;
+	};
+
+	int Size(int t) const { return t >= 0 ? nodes[t].size : 0; }
+
+	void Update(int t) { nodes[t].size = Size(nodes[t].left) + Size(nodes[t].right) + 1; }
+
+	// number of entries ordered before the key
+	int Rank(const Key &key) const
+	{
+		int pos = 0;
+		for (int t = root; t >= 0; )
+		{
+			const Node &n = nodes[t];
+			if (less(n.key, key))
+			{
+				pos += Size(n.left) + 1;
+				t = n.right;
+			}
+			else
+				t = n.left;
+		}
+		return pos;
+	}
+
+	// allocate a detached node
+	int Alloc(const Key &key, const Value &val)
+	{
+		int t;
+		if (freeList.size() != 0)
+		{
+			t = freeList.back();
+			freeList.pop_back();
+		}
+		else
+		{
+			t = (int)nodes.size();
+			nodes.emplace_back();
+		}
+
+		// xorshift for the priority
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+
+		Node &n = nodes[t];
+		n.key = key;
+		n.val = val;
+		n.left = n.right = -1;
+		n.size = 1;
+		n.prio = seed;
+		return t;
+	}
+
+	// Split subtree t into l (the keys ordered before 'key') and r (the
+	// rest).  This never allocates, so the node references stay valid.
+	void Split(int t, const Key &key, int &l, int &r)
+	{
+		if (t < 0)
+		{
+			l = r = -1;
+			return;
+		}
+
+		if (less(nodes[t].key, key))
+		{
+			Split(nodes[t].right, key, nodes[t].right, r);
+			l = t;
+		}
+		else
+		{
+			Split(nodes[t].left, key, l, nodes[t].left);
+			r = t;
+		}
+		Update(t);
+	}
+
+	// merge two subtrees, where all of a's keys are ordered before b's
+	int Merge(int a, int b)
+	{
+		if (a < 0)
+			return b;
+		if (b < 0)
+			return a;
+
+		if (nodes[a].prio > nodes[b].prio)
+		{
+			int m = Merge(nodes[a].right, b);
+			nodes[a].right = m;
+			Update(a);
+			return a;
+		}
+		else
+		{
+			int m = Merge(a, nodes[b].left);
+			nodes[b].left = m;
+			Update(b);
+			return b;
+		}
+	}
+
+	// erase a key known to be in subtree t; returns the new subtree root
+	int Erase(int t, const Key &key)
+	{
+		if (less(key, nodes[t].key))
+			nodes[t].left = Erase(nodes[t].left, key);
+		else if (less(nodes[t].key, key))
+			nodes[t].right = Erase(nodes[t].right, key);
+		else
+		{
+			int m = Merge(nodes[t].left, nodes[t].right);
+			freeList.push_back(t);
+			return m;
+		}
+		Update(t);
+		return t;
+	}
+
+	template<typename F> void ForEach(int t, F &f) const
+	{
+		if (t >= 0)
+		{
+			ForEach(nodes[t].left, f);
+			f(nodes[t].val);
+			ForEach(nodes[t].right, f);
+		}
+	}
+
+	// the ordering
+	Less less;
+
+	// node storage, and the free node indices
+	std::vector<Node> nodes;
+	std::vector<int> freeList;
+
+	// root node index, or -1 if the tree is empty
+	int root;
+
+	// priority generator state
+	unsigned int seed;
+};
@@ -0,0 +1,155 @@
+#include "stdafx.h"
+#include "Power.h"
+#include "Log.h"
+#include "Util.h"
+
+// Power setting GUIDs.  These are the same as the GUID_PROCESSOR_xxx
+// constants in winnt.h; we define our own copies so that we don't have
+// to instantiate the whole set of SDK GUIDs.
+static const GUID guidMinProcessorState = { 0x893dee8e, 0x2bef, 0x41e0, { 0x89, 0xc6, 0xb5, 0x5d, 0x09, 0x29, 0x96, 0x4c } };
+static const GUID guidIdleDisable = { 0x5d76a2ca, 0xe8c0, 0x402f, { 0xa1, 0x33, 0x21, 0x58, 0x49, 0x2d, 0x58, 0xad } };
+
+// original power scheme settings, saved on the first change
+static struct
+{
+	// have we saved the original settings?
+	bool saved;
+
+	// the power scheme we changed
+	GUID scheme;
+
+	// original minimum processor state, on AC and DC power
+	DWORD minStateAC, minStateDC;
+
+	// original idle disable setting, on AC and DC power
+	DWORD idleAC, idleDC;
+} s_orig;
+
+// Saved originals file.  This holds a copy of s_orig while our changes
+// are in effect, so that the next run can undo them if we exit without
+// restoring them.
+static TSTRING s_origFile;
+static const DWORD POWER_ORIG_MAGIC = 0x4F504150;	// 'PAPO'
+struct PowerOrigFile
+{
+	// signature
+	DWORD magic;
+
+	// the scheme and original values, as in s_orig
+	GUID scheme;
+	DWORD minStateAC, minStateDC;
+	DWORD idleAC, idleDC;
+};
+
+// write the saved originals file
+static void SaveOrigFile()
+{
+	if (s_origFile.size() == 0)
+		return;
+
+	PowerOrigFile f = { POWER_ORIG_MAGIC, s_orig.scheme, s_orig.minStateAC, s_orig.minStateDC, s_orig.idleAC, s_orig.idleDC };
+	if (!g_powerApi->SaveFile(s_origFile.c_str(), &f, sizeof(f)))
+	{
+		LOG_WARNING(_T("Unable to save the original processor power settings to %s; ")
+			_T("they can't be restored automatically if PinAffinity doesn't exit normally"), s_origFile.c_str());
+	}
+}
+
+void RecoverProcessorPowerSettings(const TCHAR *fname)
+{
+	s_origFile = fname;
+
+	// check for a file left behind by a previous run
+	PowerOrigFile f;
+	int len = g_powerApi->LoadFile(fname, &f, sizeof(f));
+	if (len < 0)
+		return;
+	bool ok = len == (int)sizeof(f) && f.magic == POWER_ORIG_MAGIC;
+
+	// restore the saved values
+	if (ok)
+	{
+		LOG_WARNING(_T("The last PinAffinity session didn't restore the processor power settings; restoring them now"));
+		s_orig.scheme = f.scheme;
+		s_orig.minStateAC = f.minStateAC;
+		s_orig.minStateDC = f.minStateDC;
+		s_orig.idleAC = f.idleAC;
+		s_orig.idleDC = f.idleDC;
+		s_orig.saved = true;
+		RestoreProcessorPowerSettings();
+	}
+	else
+	{
+		LOG_ERROR(_T("The saved processor power settings file %s is invalid; deleting it"), fname);
+		g_powerApi->RemoveFile(fname);
+	}
+}
+
+// write a processor setting for both AC and DC power
+static bool WriteProcessorSetting(const GUID &scheme, const GUID &setting, DWORD ac, DWORD dc)
+{
+	return g_powerApi->WriteSetting(scheme, setting, true, ac)
+		&& g_powerApi->WriteSetting(scheme, setting, false, dc);
+}
+
+bool ApplyProcessorPowerSettings(int minState, bool idleDisable)
+{
+	GUID scheme;
+	if (!g_powerApi->GetActiveScheme(scheme))
+		return false;
+
+	// If the user switched power schemes since we saved the originals,
+	// put the old scheme back the way we found it before taking over
+	// the new one.
+	if (s_orig.saved && s_orig.scheme != scheme)
+		RestoreProcessorPowerSettings();
+
+	// save the original settings if we haven't already
+	if (!s_orig.saved)
+	{
+		const PowerApi *api = g_powerApi;
+		if (!api->ReadSetting(scheme, guidMinProcessorState, true, s_orig.minStateAC)
+			|| !api->ReadSetting(scheme, guidMinProcessorState, false, s_orig.minStateDC)
+			|| !api->ReadSetting(scheme, guidIdleDisable, true, s_orig.idleAC)
+			|| !api->ReadSetting(scheme, guidIdleDisable, false, s_orig.idleDC))
+			return false;
+		s_orig.scheme = scheme;
+		s_orig.saved = true;
+
+		// save them to the file before changing anything
+		SaveOrigFile();
+	}
+
+	// write the new settings, using the originals for anything not overridden
+	bool ok = WriteProcessorSetting(scheme, guidMinProcessorState,
+		minState >= 0 ? (DWORD)minState : s_orig.minStateAC,
+		minState >= 0 ? (DWORD)minState : s_orig.minStateDC)
+		&& WriteProcessorSetting(scheme, guidIdleDisable,
+			idleDisable ? 1 : s_orig.idleAC,
+			idleDisable ? 1 : s_orig.idleDC);
+
+	// changes to the active scheme only take effect when it's re-activated
+	g_powerApi->SetActiveScheme(scheme);
+	return ok;
+}
+
+void RestoreProcessorPowerSettings()
+{
+	if (!s_orig.saved)
+		return;
+
+	// Restore the originals.  If that works, we're done with the saved
+	// originals file; otherwise leave it for the next run to try again.
+	if (!WriteProcessorSetting(s_orig.scheme, guidMinProcessorState, s_orig.minStateAC, s_orig.minStateDC)
+		|| !WriteProcessorSetting(s_orig.scheme, guidIdleDisable, s_orig.idleAC, s_orig.idleDC))
+		LOG_ERROR(_T("Unable to restore the original processor power settings"));
+	else if (s_origFile.size() != 0)
+		g_powerApi->RemoveFile(s_origFile.c_str());
+
+	// re-activate the scheme if it's still the active one
+	GUID scheme;
+	if (g_powerApi->GetActiveScheme(scheme) && scheme == s_orig.scheme)
+		g_powerApi->SetActiveScheme(scheme);
+
+	s_orig.saved = false;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+// Processor power management for affinity types.
+//
+// The wakeup latency we're trying to eliminate by reserving cores is
+// made worse by deep processor idle states and by slow frequency
+// ramp-up on an idle core.  Windows doesn't expose per-core control of
+// either one; the processor power settings live in the active power
+// scheme and apply to all processors.  There's no way to exempt the
+// housekeeping cores, so they get the same settings as the reserved
+// ones while the changes are in effect.  So a type's power settings are
+// applied to the power scheme only while a process of that type is
+// running, and the original scheme values are put back as soon as the
+// last one exits, or when PinAffinity exits.  The scheme settings are
+// persistent, so if PinAffinity doesn't get to exit normally (a crash,
+// the process being killed, a power failure), the changed values would
+// stay in effect indefinitely.  To cover that, the originals are also
+// saved in a small file while the changes are in effect, and the next
+// run puts them back at startup.  Windows does provide a
+// per-process control over execution speed throttling (the "EcoQoS"
+// power throttling that can run a process's threads at reduced clock
+// speeds), so that part is scoped to the type's own processes.
+
+// Set the file for saving the original power scheme values, and if a
+// previous run left one behind (because it didn't exit normally),
+// restore the values it saved and delete it.  Call this at startup,
+// before applying any power settings.
+void RecoverProcessorPowerSettings(const TCHAR *fname);
+
+// Apply processor power settings to the active power scheme.
+// minState is the minimum processor state as a percentage of maximum
+// performance, or -1 to leave it at the scheme's own setting.  If
+// idleDisable is true, processor idle states are disabled.  The first
+// call saves the scheme's original values for restoring later.
+// Returns true on success.
+bool ApplyProcessorPowerSettings(int minState, bool idleDisable);
+
+// restore the power scheme values saved by ApplyProcessorPowerSettings()
+void RestoreProcessorPowerSettings();
+
+// Turn execution speed throttling off for a process, or return it to
+// the system default.  The handle needs PROCESS_SET_INFORMATION access.
+bool SetProcessSpeedThrottling(HANDLE hProc, bool disable);
+
+// System interface for the power settings.  Power.cpp goes through
+// this for everything it does to the power scheme and the saved
+// originals file, so that the tests can run the apply, restore and
+// recovery sequence against a fake system.  PowerSystem.cpp provides
+// the real one.
+struct PowerApi
+{
+	// get the active power scheme
+	bool (*GetActiveScheme)(GUID &scheme);
+
+	// activate a scheme; re-activating the active scheme puts changes
+	// to its settings into effect
+	void (*SetActiveScheme)(const GUID &scheme);
+
+	// read or write a processor power setting in a scheme, for AC or
+	// DC power
+	bool (*ReadSetting)(const GUID &scheme, const GUID &setting, bool ac, DWORD &value);
+	bool (*WriteSetting)(const GUID &scheme, const GUID &setting, bool ac, DWORD value);
+
+	// Write a file, replacing any existing file, and flush it to disk;
+	// read a file, returning the number of bytes read, or -1 if it
+	// doesn't exist; and delete a file
+	bool (*SaveFile)(const TCHAR *fname, const void *data, DWORD len);
+	int (*LoadFile)(const TCHAR *fname, void *data, DWORD len);
+	void (*RemoveFile)(const TCHAR *fname);
+};
+
+// the active power system interface
+extern const PowerApi *g_powerApi;
@@ -0,0 +1,95 @@
+#include "stdafx.h"
+#include "Power.h"
+#include "Util.h"
+
+// System side of the processor power settings: the real PowerApi, on
+// the Windows power management functions, and per-process throttling.
+
+// Processor power settings subgroup GUID (GUID_PROCESSOR_SETTINGS_SUBGROUP)
+static const GUID guidProcessorSubgroup = { 0x54533251, 0x82be, 0x4824, { 0x96, 0xc1, 0x47, 0xb6, 0x0b, 0x74, 0x0d, 0x00 } };
+
+static bool SysGetActiveScheme(GUID &scheme)
+{
+	GUID *pScheme;
+	if (PowerGetActiveScheme(NULL, &pScheme) != ERROR_SUCCESS)
+		return false;
+	scheme = *pScheme;
+	LocalFree(pScheme);
+	return true;
+}
+
+static void SysSetActiveScheme(const GUID &scheme)
+{
+	PowerSetActiveScheme(NULL, &scheme);
+}
+
+static bool SysReadSetting(const GUID &scheme, const GUID &setting, bool ac, DWORD &value)
+{
+	const GUID &sub = guidProcessorSubgroup;
+	DWORD err = ac ? PowerReadACValueIndex(NULL, &scheme, &sub, &setting, &value)
+		: PowerReadDCValueIndex(NULL, &scheme, &sub, &setting, &value);
+	return err == ERROR_SUCCESS;
+}
+
+static bool SysWriteSetting(const GUID &scheme, const GUID &setting, bool ac, DWORD value)
+{
+	const GUID &sub = guidProcessorSubgroup;
+	DWORD err = ac ? PowerWriteACValueIndex(NULL, &scheme, &sub, &setting, value)
+		: PowerWriteDCValueIndex(NULL, &scheme, &sub, &setting, value);
+	return err == ERROR_SUCCESS;
+}
+
+static bool SysSaveFile(const TCHAR *fname, const void *data, DWORD len)
+{
+	HandleHolder hFile = CreateFile(fname, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		hFile.h = NULL;
+		return false;
+	}
+	DWORD actual;
+	return WriteFile(hFile, data, len, &actual, NULL) && actual == len && FlushFileBuffers(hFile);
+}
+
+static int SysLoadFile(const TCHAR *fname, void *data, DWORD len)
+{
+	HandleHolder hFile = CreateFile(fname, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		hFile.h = NULL;
+		return -1;
+	}
+	DWORD actual;
+	return ReadFile(hFile, data, len, &actual, NULL) ? (int)actual : 0;
+}
+
+static void SysRemoveFile(const TCHAR *fname)
+{
+	DeleteFile(fname);
+}
+
+static const PowerApi s_systemPowerApi = {
+	SysGetActiveScheme,
+	SysSetActiveScheme,
+	SysReadSetting,
+	SysWriteSetting,
+	SysSaveFile,
+	SysLoadFile,
+	SysRemoveFile
+};
+
+// the active power system interface
+const PowerApi *g_powerApi = &s_systemPowerApi;
+
+bool SetProcessSpeedThrottling(HANDLE hProc, bool disable)
+{
+	// Setting the execution speed bit in the control mask with the state
+	// bit clear turns throttling off; clearing the control mask hands
+	// the decision back to the system.
+	PROCESS_POWER_THROTTLING_STATE state;
+	ZeroMemory(&state, sizeof(state));
+	state.Version = PROCESS_POWER_THROTTLING_CURRENT_VERSION;
+	state.ControlMask = disable ? PROCESS_POWER_THROTTLING_EXECUTION_SPEED : 0;
+	state.StateMask = 0;
+	return SetProcessInformation(hProc, ProcessPowerThrottling, &state, sizeof(state)) != 0;
+}
@@ -0,0 +1,652 @@
+#include "stdafx.h"
+#include "PinAffinity.h"
+#include "PreemptTrace.h"
+#include "CoreMonitor.h"
+#include "Log.h"
+
+// kernel trace session: {9e814aad-3204-11d2-9a82-006008a86939}
+static const GUID s_systemTraceControlGuid = { 0x9e814aad, 0x3204, 0x11d2, { 0x9a, 0x82, 0x00, 0x60, 0x08, 0xa8, 0x69, 0x39 } };
+
+// kernel thread event provider: {3d6fa8d1-fe05-11d0-9dda-00c04fd7ba7c}
+static const GUID s_threadGuid = { 0x3d6fa8d1, 0xfe05, 0x11d0, { 0x9d, 0xda, 0x00, 0xc0, 0x4f, 0xd7, 0xba, 0x7c } };
+
+// thread event opcodes
+static const UCHAR OPCODE_THREAD_START = 1;
+static const UCHAR OPCODE_THREAD_END = 2;
+static const UCHAR OPCODE_THREAD_DCSTART = 3;
+static const UCHAR OPCODE_CSWITCH = 36;
+static const UCHAR OPCODE_READYTHREAD = 50;
+
+// thread state for a thread switched out while still runnable
+static const CHAR THREAD_STATE_READY = 1;
+
+// CSwitch event payload
+struct CSwitchPayload
+{
+	ULONG NewThreadId;
+	ULONG OldThreadId;
+	CHAR NewThreadPriority;
+	CHAR OldThreadPriority;
+	UCHAR PreviousCState;
+	CHAR SpareByte;
+	CHAR OldThreadWaitReason;
+	CHAR OldThreadWaitMode;
+	CHAR OldThreadState;
+	CHAR OldThreadWaitIdealProcessor;
+	ULONG NewThreadWaitTime;
+	ULONG Reserved;
+};
+
+// ReadyThread event payload (the leading field)
+struct ReadyThreadPayload
+{
+	ULONG TThreadId;
+};
+
+// thread start/end event payload (the leading fields)
+struct ThreadPayload
+{
+	ULONG ProcessId;
+	ULONG TThreadId;
+};
+
+// Reorder buffer record.  This is the part of each event we keep.
+struct TraceEvent
+{
+	// event timestamp (QueryPerformanceCounter units)
+	LONGLONG ts;
+
+	// event type: OPCODE_CSWITCH, OPCODE_READYTHREAD, or OPCODE_THREAD_END
+	UCHAR type;
+
+	// old thread state, for a context switch
+	CHAR oldState;
+
+	// processor number, for a context switch
+	USHORT cpu;
+
+	// For a context switch, the incoming and outgoing threads.  For a
+	// ready or thread end event, tid1 is the thread.
+	DWORD tid1;
+	DWORD tid2;
+};
+
+// reorder buffer capacity, in events
+static const int REORDER_CAPACITY = 256 * 1024;
+
+// How far behind the newest event we hold events for reordering, in
+// milliseconds.  Real-time buffers are flushed every second, so events
+// can arrive up to about that much out of order.
+static const DWORD REORDER_WINDOW = 2000;
+
+// Per-thread information
+struct ThreadInfo
+{
+	// owning process
+	DWORD pid;
+
+	// for game threads, is the thread ready to run but not running?
+	bool ready;
+};
+
+// Per-CPU state
+struct CpuState
+{
+	// thread currently running, and the ready-time integral when it
+	// switched in
+	DWORD tid;
+	LONGLONG readyAtSwitchIn;
+	bool valid;
+};
+
+// Offender totals
+struct Offender
+{
+	// process ID, and thread ID for kernel threads (else zero)
+	DWORD pid;
+	DWORD tid;
+
+	// program name
+	TSTRING name;
+
+	// total time charged, in QPC units, and the number of intervals
+	LONGLONG time;
+	DWORD count;
+};
+
+// Tracer state.  Apart from the published game process list, this
+// belongs to the consumer thread while the trace is running.
+struct PreemptTraceState
+{
+	// control thread and stop event
+	HANDLE hControlThread;
+	HANDLE hStopEvent;
+
+	// window and message for the "trace finished" notification
+	HWND hWnd;
+	UINT doneMsg;
+
+	// trace session and consumer handles
+	TRACEHANDLE hSession;
+	TRACEHANDLE hConsumer;
+
+	// time limit in milliseconds, or INFINITE
+	DWORD timeLimit;
+
+	// report file
+	TCHAR reportFile[MAX_PATH];
+
+	// reserved CPU mask
+	DWORD_PTR reservedMask;
+
+	// game processes, as published by the main thread
+	CRITICAL_SECTION lock;
+	std::vector<DWORD> pubPids;
+	LONG pubGen;
+
+	// game processes, as seen by the consumer thread
+	std::vector<DWORD> gamePids;
+	LONG gameGen;
+
+	// thread information, by thread ID
+	std::unordered_map<DWORD, ThreadInfo> threads;
+
+	// reorder buffer
+	std::vector<TraceEvent> events;
+	LONGLONG newestTs;
+	LONGLONG reorderTicks;
+	LONGLONG lastFlushTs;
+
+	// Time integral of "some game thread is ready", in QPC units, and
+	// the number of game threads currently ready
+	LONGLONG readyIntegral;
+	LONGLONG lastTs;
+	int nReady;
+
+	// per-CPU state
+	CpuState cpus[64];
+
+	// offenders, by process ID (with the thread ID in the high part
+	// for kernel threads)
+	std::unordered_map<ULONGLONG, Offender> offenders;
+
+	// trace start time and QPC frequency
+	LONGLONG startTs;
+	LONGLONG qpcFreq;
+
+	// number of events dropped for lack of reorder buffer space
+	DWORD dropped;
+};
+static PreemptTraceState s_trace;
+
+// is a thread a game thread?
+static bool IsGameThread(DWORD tid, ThreadInfo **pinfo = NULL)
+{
+	auto it = s_trace.threads.find(tid);
+	if (it == s_trace.threads.end())
+		return false;
+	if (pinfo != NULL)
+		*pinfo = &it->second;
+	return std::find(s_trace.gamePids.begin(), s_trace.gamePids.end(), it->second.pid) != s_trace.gamePids.end();
+}
+
+// Get a thread's process ID, looking it up if we haven't seen a thread
+// event for it yet
+static DWORD GetThreadPid(DWORD tid)
+{
+	auto it = s_trace.threads.find(tid);
+	if (it != s_trace.threads.end())
+		return it->second.pid;
+
+	DWORD pid = 0;
+	if (HANDLE hThread = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, tid))
+	{
+		pid = GetProcessIdOfThread(hThread);
+		CloseHandle(hThread);
+	}
+	s_trace.threads[tid] = { pid, false };
+	return pid;
+}
+
+// charge an interval to the thread that ran
+static void Charge(DWORD tid, LONGLONG time)
+{
+	// Idle thread (thread 0 in process 0) isn't a task, so it doesn't
+	// count.  Kernel threads are in the System process (4); we count
+	// those individually.
+	DWORD pid = GetThreadPid(tid);
+	if (tid == 0 || pid == 0)
+		return;
+
+	ULONGLONG key = pid == 4 ? ((ULONGLONG)tid << 32) | pid : pid;
+	Offender &o = s_trace.offenders[key];
+	if (o.count == 0)
+	{
+		o.pid = pid;
+		o.tid = pid == 4 ? tid : 0;
+		if (pid == 4)
+			o.name = _T("System");
+		else if (HANDLE hProc = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid))
+		{
+			TCHAR path[MAX_PATH];
+			DWORD len = countof(path);
+			if (QueryFullProcessImageName(hProc, 0, path, &len))
+				o.name = PathFindFileName(path);
+			CloseHandle(hProc);
+		}
+		if (o.name.length() == 0)
+			o.name = _T("(exited)");
+	}
+	o.time += time;
+	o.count += 1;
+}
+
+// mark a game thread ready or not ready
+static void SetReady(ThreadInfo *info, bool ready)
+{
+	if (info->ready != ready)
+	{
+		info->ready = ready;
+		s_trace.nReady += ready ? 1 : -1;
+	}
+}
+
+// Process one event, in time order
+static void ProcessEvent(const TraceEvent &e)
+{
+	// advance the ready-time integral
+	if (s_trace.lastTs != 0 && s_trace.nReady > 0 && e.ts > s_trace.lastTs)
+		s_trace.readyIntegral += e.ts - s_trace.lastTs;
+	s_trace.lastTs = e.ts;
+
+	ThreadInfo *info;
+	switch (e.type)
+	{
+	case OPCODE_READYTHREAD:
+		if (IsGameThread(e.tid1, &info))
+			SetReady(info, true);
+		break;
+
+	case OPCODE_THREAD_END:
+		if (IsGameThread(e.tid1, &info))
+			SetReady(info, false);
+		s_trace.threads.erase(e.tid1);
+		break;
+
+	case OPCODE_CSWITCH:
+		{
+			// tid1 = new thread, tid2 = old thread
+			CpuState &cpu = s_trace.cpus[e.cpu];
+
+			// Close out the outgoing thread's interval.  If it wasn't a
+			// game thread, charge it with the time a game thread spent
+			// waiting while it ran.
+			bool oldGame = IsGameThread(e.tid2, &info);
+			if (cpu.valid && cpu.tid == e.tid2 && !oldGame)
+			{
+				LONGLONG waited = s_trace.readyIntegral - cpu.readyAtSwitchIn;
+				if (waited > 0)
+					Charge(e.tid2, waited);
+			}
+
+			// a game thread switched out while still runnable is now waiting
+			if (oldGame && e.oldState == THREAD_STATE_READY)
+				SetReady(info, true);
+
+			// a game thread switched in isn't waiting anymore
+			if (IsGameThread(e.tid1, &info))
+				SetReady(info, false);
+
+			cpu.tid = e.tid1;
+			cpu.readyAtSwitchIn = s_trace.readyIntegral;
+			cpu.valid = true;
+		}
+		break;
+	}
+}
+
+// Process buffered events older than the reorder window.  If 'all' is
+// true, process everything.
+static void FlushEvents(bool all)
+{
+	// pick up the latest game process list
+	EnterCriticalSection(&s_trace.lock);
+	bool changed = s_trace.gameGen != s_trace.pubGen;
+	if (changed)
+	{
+		s_trace.gamePids = s_trace.pubPids;
+		s_trace.gameGen = s_trace.pubGen;
+	}
+	LeaveCriticalSection(&s_trace.lock);
+
+	// threads of processes that are no longer game processes can't be
+	// waiting as game threads anymore
+	if (changed)
+	{
+		for (auto &t : s_trace.threads)
+		{
+			if (t.second.ready && !IsGameThread(t.first))
+				SetReady(&t.second, false);
+		}
+	}
+
+	// sort into time order, and process the events that are old enough
+	auto &ev = s_trace.events;
+	std::stable_sort(ev.begin(), ev.end(), [](const TraceEvent &a, const TraceEvent &b) { return a.ts < b.ts; });
+	LONGLONG cutoff = all ? MAXLONGLONG : s_trace.newestTs - s_trace.reorderTicks;
+	size_t n = 0;
+	for (; n < ev.size() && ev[n].ts <= cutoff; ++n)
+		ProcessEvent(ev[n]);
+
+	// keep the rest
+	ev.erase(ev.begin(), ev.begin() + n);
+}
+
+// add an event to the reorder buffer
+static void AddEvent(const TraceEvent &e)
+{
+	if (s_trace.events.size() >= REORDER_CAPACITY)
+	{
+		// make room by processing what we can
+		FlushEvents(false);
+		if (s_trace.events.size() >= REORDER_CAPACITY)
+		{
+			++s_trace.dropped;
+			return;
+		}
+	}
+	s_trace.events.push_back(e);
+}
+
+// ETW event callback
+static void WINAPI OnEvent(PEVENT_RECORD rec)
+{
+	if (rec->EventHeader.ProviderId != s_threadGuid)
+		return;
+
+	TraceEvent e;
+	e.ts = rec->EventHeader.TimeStamp.QuadPart;
+	e.type = rec->EventHeader.EventDescriptor.Opcode;
+	e.oldState = 0;
+	e.cpu = rec->BufferContext.ProcessorNumber;
+	if (s_trace.startTs == 0)
+		s_trace.startTs = s_trace.lastFlushTs = e.ts;
+	if (e.ts > s_trace.newestTs)
+		s_trace.newestTs = e.ts;
+
+	switch (e.type)
+	{
+	case OPCODE_CSWITCH:
+		// keep context switches on the reserved CPUs only
+		if (e.cpu < 64 && (s_trace.reservedMask & ((DWORD_PTR)1 << e.cpu)) != 0
+			&& rec->UserDataLength >= sizeof(CSwitchPayload))
+		{
+			const CSwitchPayload *p = (const CSwitchPayload *)rec->UserData;
+			e.tid1 = p->NewThreadId;
+			e.tid2 = p->OldThreadId;
+			e.oldState = p->OldThreadState;
+			AddEvent(e);
+		}
+		break;
+
+	case OPCODE_READYTHREAD:
+		// keep ready events for game threads only
+		if (rec->UserDataLength >= sizeof(ReadyThreadPayload))
+		{
+			e.tid1 = ((const ReadyThreadPayload *)rec->UserData)->TThreadId;
+			e.tid2 = 0;
+			if (IsGameThread(e.tid1))
+				AddEvent(e);
+		}
+		break;
+
+	case OPCODE_THREAD_START:
+	case OPCODE_THREAD_DCSTART:
+		// Note new threads right away, so that we can filter their ready
+		// events as they arrive.
+		if (rec->UserDataLength >= sizeof(ThreadPayload))
+		{
+			const ThreadPayload *p = (const ThreadPayload *)rec->UserData;
+			s_trace.threads[p->TThreadId] = { p->ProcessId, false };
+		}
+		break;
+
+	case OPCODE_THREAD_END:
+		// thread exits have to be processed in order with the rest
+		if (rec->UserDataLength >= sizeof(ThreadPayload))
+		{
+			e.tid1 = ((const ThreadPayload *)rec->UserData)->TThreadId;
+			e.tid2 = 0;
+			AddEvent(e);
+		}
+		break;
+	}
+
+	// process what's ready to go about once a second
+	if (e.ts - s_trace.lastFlushTs >= s_trace.qpcFreq)
+	{
+		s_trace.lastFlushTs = e.ts;
+		FlushEvents(false);
+	}
+}
+
+// Write the report
+static void WriteReport()
+{
+	FILE *fp;
+	if (_tfopen_s(&fp, s_trace.reportFile, _T("w")) != 0)
+	{
+		LOG_ERROR(_T("Unable to write the preemption report %s"), s_trace.reportFile);
+		return;
+	}
+
+	// sort the offenders, worst first
+	std::vector<const Offender*> list;
+	for (auto &o : s_trace.offenders)
+		list.push_back(&o.second);
+	std::sort(list.begin(), list.end(), [](const Offender *a, const Offender *b) { return a->time > b->time; });
+
+	double secs = s_trace.newestTs > s_trace.startTs ? (double)(s_trace.newestTs - s_trace.startTs) / s_trace.qpcFreq : 0.0;
+	_ftprintf(fp, _T("PinAffinity preemption report\n\n")
+		_T("Time that other threads ran on the reserved cores while a game\n")
+		_T("thread was waiting to run, over %.1lf seconds of tracing.\n\n"), secs);
+	if (s_trace.dropped != 0)
+		_ftprintf(fp, _T("Note: %lu events were dropped because the trace fell behind.\n\n"), s_trace.dropped);
+	_ftprintf(fp, _T("%-32s %8s %8s %12s %10s\n"), _T("Program"), _T("PID"), _T("TID"), _T("Time (ms)"), _T("Intervals"));
+
+	std::vector<const Offender*> suggest;
+	for (auto o : list)
+	{
+		TCHAR tid[16] = _T("");
+		if (o->tid != 0)
+			_stprintf_s(tid, _T("%lu"), o->tid);
+		_ftprintf(fp, _T("%-32s %8lu %8s %12.2lf %10lu\n"), o->name.c_str(), o->pid, tid,
+			o->time * 1000.0 / s_trace.qpcFreq, o->count);
+
+		// Programs other than System that took a millisecond or more are
+		// candidates for moving off the reserved cores
+		if (o->pid != 4 && o->time * 1000 >= s_trace.qpcFreq && o->name != _T("(exited)"))
+			suggest.push_back(o);
+	}
+	if (list.size() == 0)
+		_ftprintf(fp, _T("(none)\n"));
+
+	if (suggest.size() != 0)
+	{
+		_ftprintf(fp, _T("\nSuggestions:\n"));
+		for (auto o : suggest)
+		{
+			// If we already manage the program under a type that includes
+			// the reserved cores, the type is the problem; otherwise it's
+			// a program PinAffinity isn't managing.
+			TSTRING key = o->name;
+			std::transform(key.begin(), key.end(), key.begin(), ::_totlower);
+			auto it = g_savedProcs.find(key);
+			if (it != g_savedProcs.end() && (g_procTypes[it->second.iType].affinityMask & s_trace.reservedMask) != 0)
+				_ftprintf(fp, _T("  %s is set to %s, which includes the reserved cores; consider a different type\n"),
+					o->name.c_str(), g_procTypes[it->second.iType].name.c_str());
+			else if (it == g_savedProcs.end())
+				_ftprintf(fp, _T("  %s isn't managed by PinAffinity; consider setting it to %s\n"),
+					o->name.c_str(), g_procTypes[0].name.c_str());
+			else
+				_ftprintf(fp, _T("  %s is set to %s, but still ran on the reserved cores; it may be resetting its own affinity (try /Enforce)\n"),
+					o->name.c_str(), g_procTypes[it->second.iType].name.c_str());
+		}
+	}
+
+	fclose(fp);
+	LOG_INFO(_T("Preemption report written to %s"), s_trace.reportFile);
+}
+
+static DWORD WINAPI ConsumerThread(LPVOID)
+{
+	// ProcessTrace delivers events until the session stops
+	ProcessTrace(&s_trace.hConsumer, 1, NULL, NULL);
+	return 0;
+}
+
+// stop the kernel trace session
+static void StopSession()
+{
+	size_t propSize = sizeof(EVENT_TRACE_PROPERTIES) + sizeof(KERNEL_LOGGER_NAME);
+	std::vector<BYTE> buf(propSize);
+	EVENT_TRACE_PROPERTIES *props = (EVENT_TRACE_PROPERTIES*)buf.data();
+	props->Wnode.BufferSize = (ULONG)propSize;
+	props->LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
+	ControlTrace(s_trace.hSession, KERNEL_LOGGER_NAME, props, EVENT_TRACE_CONTROL_STOP);
+}
+
+static DWORD WINAPI ControlThread(LPVOID)
+{
+	// stay off the reserved cores
+	if (DWORD_PTR mask = GetHousekeepingMask())
+		SetThreadAffinityMask(GetCurrentThread(), mask);
+
+	// run the consumer until the time limit or a stop request
+	HANDLE hConsumerThread = CreateThread(NULL, 0, ConsumerThread, NULL, 0, NULL);
+	WaitForSingleObject(s_trace.hStopEvent, s_trace.timeLimit);
+
+	// stop the session, and wait for the consumer to finish the events
+	StopSession();
+	if (hConsumerThread != NULL)
+	{
+		WaitForSingleObject(hConsumerThread, INFINITE);
+		CloseHandle(hConsumerThread);
+	}
+	CloseTrace(s_trace.hConsumer);
+
+	// Process the remaining events, and let the main thread know that
+	// we're done.  The main thread writes the report, since the report
+	// refers to the saved program settings.
+	FlushEvents(true);
+	PostMessage(s_trace.hWnd, s_trace.doneMsg, 0, 0);
+	return 0;
+}
+
+bool StartPreemptTrace(DWORD seconds, const TCHAR *reportFile, HWND hWnd, UINT doneMsg)
+{
+	// figure the reserved CPUs
+	for (int cpu = 0; cpu < 64; ++cpu)
+	{
+		if (GetCoreOwner(cpu) > 0)
+			s_trace.reservedMask |= (DWORD_PTR)1 << cpu;
+	}
+	if (s_trace.reservedMask == 0)
+	{
+		LOG_WARNING(_T("Core tracing: no reserved cores to trace"));
+		return false;
+	}
+
+	// set up the state
+	InitializeCriticalSection(&s_trace.lock);
+	_tcscpy_s(s_trace.reportFile, reportFile);
+	s_trace.hWnd = hWnd;
+	s_trace.doneMsg = doneMsg;
+	s_trace.timeLimit = seconds != 0 ? seconds * 1000 : INFINITE;
+	s_trace.events.reserve(REORDER_CAPACITY);
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	s_trace.qpcFreq = freq.QuadPart;
+	s_trace.reorderTicks = freq.QuadPart * REORDER_WINDOW / 1000;
+
+	// Start the kernel trace session, with context switch, dispatcher
+	// (ready thread), and thread start/end events, in real-time mode,
+	// with QPC timestamps.
+	size_t propSize = sizeof(EVENT_TRACE_PROPERTIES) + sizeof(KERNEL_LOGGER_NAME);
+	std::vector<BYTE> buf(propSize);
+	EVENT_TRACE_PROPERTIES *props = (EVENT_TRACE_PROPERTIES*)buf.data();
+	props->Wnode.BufferSize = (ULONG)propSize;
+	props->Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+	props->Wnode.ClientContext = 1;
+	props->Wnode.Guid = s_systemTraceControlGuid;
+	props->EnableFlags = EVENT_TRACE_FLAG_CSWITCH | EVENT_TRACE_FLAG_DISPATCHER | EVENT_TRACE_FLAG_THREAD;
+	props->LogFileMode = EVENT_TRACE_REAL_TIME_MODE;
+	props->FlushTimer = 1;
+	props->LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
+	ULONG err = StartTrace(&s_trace.hSession, KERNEL_LOGGER_NAME, props);
+	if (err != ERROR_SUCCESS)
+	{
+		LOG_ERROR(_T("Core tracing: unable to start the kernel trace session, Windows error %lu%s"), err,
+			err == ERROR_ALREADY_EXISTS ? _T(" (another program is using the kernel trace)") :
+			err == ERROR_ACCESS_DENIED ? _T(" (administrator rights are required)") : _T(""));
+		return false;
+	}
+
+	// open the real-time consumer
+	EVENT_TRACE_LOGFILE logFile;
+	ZeroMemory(&logFile, sizeof(logFile));
+	logFile.LoggerName = (LPTSTR)KERNEL_LOGGER_NAME;
+	logFile.ProcessTraceMode = PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+	logFile.EventRecordCallback = OnEvent;
+	s_trace.hConsumer = OpenTrace(&logFile);
+	if (s_trace.hConsumer == INVALID_PROCESSTRACE_HANDLE)
+	{
+		LOG_ERROR(_T("Core tracing: unable to open the trace consumer, Windows error %lu"), GetLastError());
+		StopSession();
+		return false;
+	}
+
+	// start the control thread
+	s_trace.hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	s_trace.hControlThread = CreateThread(NULL, 0, ControlThread, NULL, 0, NULL);
+	if (s_trace.hControlThread == NULL)
+	{
+		LOG_ERROR(_T("Core tracing: unable to start the trace thread, Windows error %lu"), GetLastError());
+		CloseTrace(s_trace.hConsumer);
+		StopSession();
+		return false;
+	}
+
+	LOG_INFO(_T("Core tracing started on CPUs %llx"), (UINT64)s_trace.reservedMask);
+	return true;
+}
+
+void StopPreemptTrace()
+{
+	if (s_trace.hControlThread == NULL)
+		return;
+
+	// stop the trace, if it's not already finished
+	SetEvent(s_trace.hStopEvent);
+	WaitForSingleObject(s_trace.hControlThread, INFINITE);
+	CloseHandle(s_trace.hControlThread);
+	CloseHandle(s_trace.hStopEvent);
+	s_trace.hControlThread = NULL;
+
+	// write the report
+	WriteReport();
+}
+
+void PreemptTraceSetProcesses(const DWORD *pids, int n)
+{
+	if (s_trace.hControlThread == NULL)
+		return;
+
+	EnterCriticalSection(&s_trace.lock);
+	if (s_trace.pubPids.size() != (size_t)n || !std::equal(pids, pids + n, s_trace.pubPids.begin()))
+	{
+		s_trace.pubPids.assign(pids, pids + n);
+		++s_trace.pubGen;
+	}
+	LeaveCriticalSection(&s_trace.lock);
+}
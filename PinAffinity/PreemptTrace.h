@@ -0,0 +1,42 @@
+#pragma once
+
+// Preemption attribution tracer.
+//
+// The scheduling statistics can tell us that a game thread was kept
+// waiting for a CPU, but not who had the CPU at the time.  This tracer
+// answers that.  It runs a real-time ETW kernel trace of context
+// switches and thread ready events, and on the reserved cores (the
+// cores owned by types other than the default type), it charges every
+// interval where some other thread ran while a game thread was ready
+// to run to the thread that ran.  The charges are totaled by process,
+// and for the System process (whose threads are kernel threads), by
+// individual kernel thread.  When tracing stops, the offenders are
+// written to a report, along with a suggestion for each program that
+// PinAffinity could move off the reserved cores.
+//
+// The kernel can't limit context switch tracing to particular CPUs,
+// so the overhead is bounded on our side: events from the other CPUs
+// are dropped as soon as they arrive, ready events are only kept for
+// game threads, and the rest are held in a fixed-size reorder buffer
+// (real-time ETW delivers each CPU's events in separate buffers, so
+// they have to be merged back into time order before we can tell what
+// overlapped what).  The trace needs administrator rights, and it
+// can't run while another program is using the kernel trace session.
+//
+// This is enabled with "/TraceCores[:<seconds>]" on the command line;
+// without a time limit, it runs until PinAffinity exits.
+
+// Start tracing.  Call this after starting the core monitor, which
+// decides which cores are reserved.  seconds is the time limit, or 0
+// to run until StopPreemptTrace().  When the time limit expires, the
+// tracer posts doneMsg to hWnd, and the window should then call
+// StopPreemptTrace() to write the report.
+bool StartPreemptTrace(DWORD seconds, const TCHAR *reportFile, HWND hWnd, UINT doneMsg);
+
+// Stop tracing, if it's still running, and write the report to the
+// file given at the start.  This does nothing if tracing isn't active.
+void StopPreemptTrace();
+
+// Update the list of game processes.  The main thread calls this after
+// each process list update, with the reserved-type processes.
+void PreemptTraceSetProcesses(const DWORD *pids, int n);
@@ -1,8 +1,24 @@
 #include "stdafx.h"
 #include <TlHelp32.h>
 #include "ProcessList.h"
+#include "StringTable.h"
+#include "NtApi.h"
 
-bool GetProcessList(std::list<ProcessDesc>& lst)
+// Snapshot buffer.  This starts out big enough for a typical desktop
+// system, and grows as needed (with some headroom) if the process list
+// outgrows it.
+static std::vector<BYTE> s_snapBuf(256 * 1024);
+
+// scan statistics
+static ProcessListStats s_stats;
+
+const ProcessListStats &GetProcessListStats()
+{
+	return s_stats;
+}
+
+// get the process list from a toolhelp snapshot
+static bool GetToolhelpProcessList(std::vector<ProcessDesc> &lst)
 {
 	// create a toolhelp process snapshot
 	HandleHolder h = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
@@ -12,9 +28,58 @@ bool GetProcessList(std::list<ProcessDesc>& lst)
 	// enumerate the processes
 	PROCESSENTRY32 pe = { sizeof(pe) };
 	for (BOOL ok = Process32First(h, &pe); ok; ok = Process32Next(h, &pe))
-		lst.emplace_back(pe.th32ProcessID, pe.szExeFile);
+		lst.emplace_back(pe.th32ProcessID, pe.th32ParentProcessID, pe.cntThreads, g_strings.Intern(pe.szExeFile));
 
 	// success
 	return true;
 }
 
+// get the process list from a native process snapshot
+static bool GetNativeProcessList(NtQuerySystemInformation_t NtQSI, std::vector<ProcessDesc> &lst)
+{
+	// take the snapshot, growing the buffer until it fits
+	for (;;)
+	{
+		ULONG len = 0;
+		LONG status = NtQSI(NtSystemProcessInformation, s_snapBuf.data(), (ULONG)s_snapBuf.size(), &len);
+		if (status >= 0)
+			break;
+		if (status != NtStatusInfoLengthMismatch)
+			return false;
+
+		// grow the buffer, with some headroom for new processes
+		s_snapBuf.resize(max((size_t)len, s_snapBuf.size()) + 65536);
+		s_stats.reallocs++;
+	}
+
+	// read the entries
+	static const DWORD selfPid = GetCurrentProcessId();
+	ReadProcessSnapshot(s_snapBuf.data(), selfPid, lst, s_stats);
+
+	// success
+	return true;
+}
+
+bool GetProcessList(std::vector<ProcessDesc>& lst)
+{
+	lst.clear();
+
+	LARGE_INTEGER freq, t0, t1;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+
+	// use the native snapshot if possible, otherwise toolhelp
+	bool ok;
+	if (NtQuerySystemInformation_t NtQSI = GetNtQuerySystemInformation())
+		ok = GetNativeProcessList(NtQSI, lst);
+	else
+		ok = GetToolhelpProcessList(lst);
+
+	// update the statistics
+	QueryPerformanceCounter(&t1);
+	s_stats.scans++;
+	s_stats.processes += lst.size();
+	s_stats.micros += (ULONGLONG)(t1.QuadPart - t0.QuadPart) * 1000000 / freq.QuadPart;
+
+	return ok;
+}
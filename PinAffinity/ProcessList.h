@@ -3,21 +3,80 @@
 
 struct ProcessDesc
 {
-	ProcessDesc(DWORD pid, const TCHAR *name)
-		: pid(pid), name(name)
+	ProcessDesc(DWORD pid, DWORD parentPid, DWORD nThreads, const TCHAR *name)
+		: pid(pid), parentPid(parentPid), nThreads(nThreads), name(name),
+		sessionId((DWORD)-1), cpuTime(0), haveTimes(false)
 	{
-		key = name;
-		std::transform(key.begin(), key.end(), key.begin(), ::_totlower);
+		startTime.dwLowDateTime = startTime.dwHighDateTime = 0;
 	}
 
 	// system process ID
 	DWORD pid;
 
-	// process name (usually the executable name)
-	TSTRING name;
+	// parent process ID
+	DWORD parentPid;
 
-	// saved process key (lowercase exe name)
-	TSTRING key;
+	// number of threads
+	DWORD nThreads;
+
+	// process name (usually the executable name), interned in g_strings
+	const TCHAR *name;
+
+	// Windows session ID, or -1 if it's not known.  The system process
+	// snapshot provides this; the toolhelp fallback doesn't, so the
+	// caller has to ask for it with ProcessIdToSessionId() if it needs it.
+	DWORD sessionId;
+
+	// Process start time and total CPU time (kernel plus user, in 100ns
+	// units).  These are only filled in when haveTimes is true, which is
+	// the case when the list comes from the system process snapshot.
+	// The toolhelp fallback doesn't provide them, so the caller has to
+	// open the process to get them.
+	FILETIME startTime;
+	ULONGLONG cpuTime;
+	bool haveTimes;
+};
+
+// Get the running process list.  This clears the vector and refills
+// it, so a caller can reuse the same vector from one scan to the next
+// without reallocating it.
+//
+// The list comes from a single SystemProcessInformation snapshot, which
+// gets the whole process table, including start and CPU times, from
+// the kernel in one call.  The snapshot buffer is kept across calls, and
+// program names are interned directly from the snapshot, so a scan only
+// allocates memory when the buffer has to grow or a new program name
+// appears.  If the native API isn't available, this falls back on a
+// toolhelp snapshot.
+bool GetProcessList(std::vector<ProcessDesc> &lst);
+
+// Process scan statistics, for measuring the scanner's overhead
+struct ProcessListStats
+{
+	// number of scans
+	DWORD scans;
+
+	// total processes returned, over all scans
+	ULONGLONG processes;
+
+	// total time spent scanning, in microseconds
+	ULONGLONG micros;
+
+	// number of times the snapshot buffer had to grow
+	DWORD reallocs;
+
+	// Total context switches of our own process's threads, as of the
+	// latest native snapshot.  Each one is a wakeup of one of our
+	// threads, so this measures how often we disturb the system.
+	ULONGLONG selfSwitches;
 };
 
-bool GetProcessList(std::list<ProcessDesc> &lst);
+// get the cumulative scan statistics
+const ProcessListStats &GetProcessListStats();
+
+// Read the entries of a native process snapshot (a SystemProcessInformation
+// result) into the list, interning the names in g_strings, and update the
+// self context switch count in the statistics.  GetProcessList() uses this
+// for the native snapshot; it's separate from the system call so that the
+// tests can drive it with a synthetic snapshot.  (ProcessSnapshot.cpp)
+void ReadProcessSnapshot(const BYTE *buf, DWORD selfPid, std::vector<ProcessDesc> &lst, ProcessListStats &stats);
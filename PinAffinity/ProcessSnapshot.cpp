@@ -0,0 +1,52 @@
+#include "stdafx.h"
+#include "ProcessList.h"
+#include "StringTable.h"
+#include "NtApi.h"
+
+// Native process snapshot reader.  This only walks the snapshot memory,
+// with no system calls, so it builds in the tests as well as here.
+
+void ReadProcessSnapshot(const BYTE *buf, DWORD selfPid, std::vector<ProcessDesc> &lst, ProcessListStats &stats)
+{
+	// The idle process has no image name in the native snapshot; toolhelp
+	// calls it "[System Process]", so use the same name for consistency.
+	static const TCHAR *idleName = g_strings.Intern(_T("[System Process]"));
+
+	// walk the entry chain
+	for (const BYTE *p = buf; ; )
+	{
+		const NtSystemProcessInfo *pi = (const NtSystemProcessInfo *)p;
+
+		// Intern the name directly from the snapshot.  The name isn't null-
+		// terminated, but Intern() takes the length, and only copies the
+		// string the first time it sees it.  (The snapshot strings are
+		// always UTF-16; the program is built for Unicode, so TCHAR is
+		// the same type.)
+		const TCHAR *name = pi->ImageName.Length == 0 ? idleName :
+			g_strings.Intern(pi->ImageName.Buffer, pi->ImageName.Length / sizeof(WCHAR));
+
+		lst.emplace_back((DWORD)(ULONG_PTR)pi->UniqueProcessId, (DWORD)(ULONG_PTR)pi->InheritedFromUniqueProcessId,
+			pi->NumberOfThreads, name);
+
+		ProcessDesc &d = lst.back();
+		d.startTime.dwLowDateTime = (DWORD)pi->CreateTime.QuadPart;
+		d.startTime.dwHighDateTime = (DWORD)(pi->CreateTime.QuadPart >> 32);
+		d.cpuTime = (ULONGLONG)pi->KernelTime.QuadPart + (ULONGLONG)pi->UserTime.QuadPart;
+		d.haveTimes = true;
+		d.sessionId = pi->SessionId;
+
+		// count our own threads' context switches
+		if (d.pid == selfPid)
+		{
+			ULONGLONG switches = 0;
+			const NtSystemThreadInfo *ti = pi->Threads();
+			for (ULONG i = 0; i < pi->NumberOfThreads; ++i)
+				switches += ti[i].ContextSwitches;
+			stats.selfSwitches = switches;
+		}
+
+		if (pi->NextEntryOffset == 0)
+			break;
+		p += pi->NextEntryOffset;
+	}
+}
@@ -0,0 +1,168 @@
+#include "stdafx.h"
+#include "ProcessTable.h"
+
+// the current active process table
+ProcessTable g_procTable;
+
+ProcessTable::ProcessTable()
+{
+	Rehash(8);
+}
+
+int ProcessTable::FindIndexPos(DWORD pid) const
+{
+	size_t mask = index.size() - 1;
+	for (size_t i = Home(pid); index[i] >= 0; i = (i + 1) & mask)
+	{
+		if (this->pid[index[i]] == pid)
+			return (int)i;
+	}
+	return -1;
+}
+
+int ProcessTable::Find(DWORD pid) const
+{
+	int i = FindIndexPos(pid);
+	return i >= 0 ? index[i] : -1;
+}
+
+void ProcessTable::FindByKey(const TCHAR *key, std::vector<int> &slots) const
+{
+	auto range = keyIndex.equal_range(key);
+	for (auto it = range.first; it != range.second; ++it)
+		slots.push_back(Find(it->second));
+}
+
+int ProcessTable::Add(DWORD pid, const TCHAR *name, DWORD gen, int type, DWORD_PTR mask, const ProcListItem &item)
+{
+	// keep the index load factor under 1/2
+	if ((Count() + 1) * 2 > (int)index.size())
+		Rehash(indexBits + 1);
+
+	// add the entry at the end of the arrays
+	int slot = Count();
+	this->pid.push_back(pid);
+	this->gen.push_back(gen);
+	this->name.push_back(name);
+	this->type.push_back(type);
+	this->mask.push_back(mask);
+	this->item.push_back(item);
+
+	// index it
+	size_t imask = index.size() - 1;
+	size_t i = Home(pid);
+	for (; index[i] >= 0; i = (i + 1) & imask);
+	index[i] = slot;
+	keyIndex.emplace(item.key, pid);
+
+	return slot;
+}
+
+void ProcessTable::RemoveAt(int slot)
+{
+	// Remove the PID from the index.  With linear probing, we can't
+	// just empty the position, since that would cut off the probe
+	// sequences of any later entries that collided with it.  Instead,
+	// shift later entries in the same run back into the gap.
+	size_t imask = index.size() - 1;
+	size_t hole = FindIndexPos(pid[slot]);
+	for (size_t j = (hole + 1) & imask; index[j] >= 0; j = (j + 1) & imask)
+	{
+		// An entry can move back into the hole only if its home
+		// position isn't cyclically within (hole, j].
+		size_t home = Home(pid[index[j]]);
+		if (((j - home) & imask) >= ((j - hole) & imask))
+		{
+			index[hole] = index[j];
+			hole = j;
+		}
+	}
+	index[hole] = -1;
+
+	// remove it from the key index
+	auto range = keyIndex.equal_range(item[slot].key);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second == pid[slot])
+		{
+			keyIndex.erase(it);
+			break;
+		}
+	}
+
+	// move the last entry into the vacated slot, and update its index position
+	int last = Count() - 1;
+	if (slot != last)
+	{
+		pid[slot] = pid[last];
+		gen[slot] = gen[last];
+		name[slot] = name[last];
+		type[slot] = type[last];
+		mask[slot] = mask[last];
+		item[slot] = item[last];
+		index[FindIndexPos(pid[slot])] = slot;
+	}
+
+	// drop the last entry
+	pid.pop_back();
+	gen.pop_back();
+	name.pop_back();
+	type.pop_back();
+	mask.pop_back();
+	item.pop_back();
+}
+
+void ProcessTable::Rehash(int bits)
+{
+	indexBits = bits;
+	index.assign((size_t)1 << bits, -1);
+	size_t imask = index.size() - 1;
+	for (int slot = 0; slot < Count(); ++slot)
+	{
+		size_t i = Home(pid[slot]);
+		for (; index[i] >= 0; i = (i + 1) & imask);
+		index[i] = slot;
+	}
+}
+
+// ListViewData allocation pool.  We allocate one of these records for
+// each list view row, and rows come and go with processes, so rather
+// than going to the heap for each one, we carve the records out of
+// larger blocks and recycle freed records through a free list.  The
+// list view is only touched from the main UI thread, so the pool needs
+// no locking.
+static const size_t LVD_POOL_BLOCK = 256;
+static void *s_lvdFree = NULL;
+
+void *ListViewData::operator new(size_t size)
+{
+	UNREFERENCED_PARAMETER(size);
+
+	// if the free list is empty, allocate a new block and add its
+	// records to the free list
+	if (s_lvdFree == NULL)
+	{
+		typedef std::aligned_storage<sizeof(ListViewData), alignof(ListViewData)>::type Slot;
+		Slot *block = new Slot[LVD_POOL_BLOCK];
+		for (size_t i = 0; i < LVD_POOL_BLOCK; ++i)
+		{
+			*(void**)&block[i] = s_lvdFree;
+			s_lvdFree = &block[i];
+		}
+	}
+
+	// take the first free record
+	void *p = s_lvdFree;
+	s_lvdFree = *(void**)p;
+	return p;
+}
+
+void ListViewData::operator delete(void *p)
+{
+	// return the record to the free list
+	if (p != NULL)
+	{
+		*(void**)p = s_lvdFree;
+		s_lvdFree = p;
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "PinAffinity.h"
+
+// Process table.  This is our internal list of running processes.
+//
+// Each update pass runs over every process in the table, to find the
+// processes that have exited and to check for affinity drift.  Those
+// passes only need a few fields per process, so the table keeps the
+// hot fields in parallel arrays (a "structure of arrays"), where a
+// pass over one field walks contiguous memory, and keeps the rest of
+// the per-process information in a parallel array of ProcListItem
+// records.  Entries are addressed by slot number; all of the arrays
+// use the same slot numbers.  The table stays dense: removing an entry
+// moves the last entry into the vacated slot, so slot numbers are only
+// stable until the next removal.
+//
+// Lookups by PID go through an open-addressing hash index, which maps
+// a PID to its slot without any per-entry heap nodes.  There's also a
+// key index, which maps a program key to the PIDs of its running
+// instances, so that a change to a saved program's settings can find
+// the affected processes without scanning the whole table.
+class ProcessTable
+{
+public:
+	ProcessTable();
+
+	// number of processes in the table
+	int Count() const { return (int)pid.size(); }
+
+	// find a process by PID; returns its slot, or -1 if it's not in the table
+	int Find(DWORD pid) const;
+
+	// Find the running instances of a program by its key (interned in
+	// g_strings).  Appends their slots to 'slots'.
+	void FindByKey(const TCHAR *key, std::vector<int> &slots) const;
+
+	// Add a process.  The PID must not already be in the table.
+	// Returns the new entry's slot.
+	int Add(DWORD pid, const TCHAR *name, DWORD gen, int type, DWORD_PTR mask, const ProcListItem &item);
+
+	// Remove the process in the given slot.  This moves the last entry
+	// into the slot, so a caller iterating over the table shouldn't
+	// advance past the slot after removing it.
+	void RemoveAt(int slot);
+
+	// Hot fields, indexed by slot
+
+	// process ID
+	std::vector<DWORD> pid;
+
+	// update generation: the iteration counter of the last process
+	// list scan that found the process running
+	std::vector<DWORD> gen;
+
+	// process name, interned in g_strings
+	std::vector<const TCHAR*> name;
+
+	// Effective type: the process's individual type assignment if it
+	// has one, otherwise the saved settings for its program, otherwise
+	// the default type 0.  We keep this up to date as the assignments
+	// change, so that the update passes don't have to look it up.
+	std::vector<int> type;
+
+	// affinity mask we set, or zero if we haven't changed its affinity
+	std::vector<DWORD_PTR> mask;
+
+	// Other per-process information, indexed by slot
+	std::vector<ProcListItem> item;
+
+protected:
+	// home position of a PID in the hash index
+	size_t Home(DWORD pid) const { return (size_t)((UINT32)(pid * 2654435761u) >> (32 - indexBits)); }
+
+	// find the index position holding a PID, or -1 if it's not there
+	int FindIndexPos(DWORD pid) const;
+
+	// rebuild the hash index at a new size
+	void Rehash(int bits);
+
+	// Hash index: each position holds a slot number, or -1 if empty.
+	// This uses linear probing, and the size is 2^indexBits.
+	std::vector<int> index;
+	int indexBits;
+
+	// Key index.  The keys are interned, so the pointer identifies the
+	// key.  The values are PIDs rather than slots, since slots move
+	// when entries are removed.
+	std::unordered_multimap<const TCHAR*, DWORD> keyIndex;
+};
+
+// the current active process table
+extern ProcessTable g_procTable;
@@ -0,0 +1,174 @@
+#include "stdafx.h"
+#include "ProfileStore.h"
+#include "StringTable.h"
+#include "Log.h"
+
+// File header
+struct ProfileFileHeader
+{
+	// signature and format version
+	DWORD magic;
+	DWORD version;
+
+	// number of records in use
+	DWORD count;
+	DWORD reserved;
+};
+
+static const DWORD PROFILE_MAGIC = 0x46504150;		// 'PAPF'
+static const DWORD PROFILE_VERSION = 2;
+
+// file size
+static const DWORD PROFILE_FILE_SIZE = sizeof(ProfileFileHeader) + PROFILE_MAX_ENTRIES * sizeof(ExeProfile);
+
+// file and mapping handles, and the mapped view
+static HANDLE s_hFile = INVALID_HANDLE_VALUE;
+static HANDLE s_hMap = NULL;
+static ProfileFileHeader *s_header = NULL;
+static ExeProfile *s_records = NULL;
+
+// index of the records by key, interned in g_strings
+static std::unordered_map<const TCHAR*, ExeProfile*> s_index;
+
+bool ProfileStoreOpen(const TCHAR *fname)
+{
+	// open the file, and map it at its full size (mapping a new or
+	// short file extends it with zeroes)
+	s_hFile = CreateFile(fname, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+		OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (s_hFile == INVALID_HANDLE_VALUE)
+	{
+		LOG_WARNING(_T("Unable to open the program profile file %s, Windows error %lu"), fname, GetLastError());
+		return false;
+	}
+	s_hMap = CreateFileMapping(s_hFile, NULL, PAGE_READWRITE, 0, PROFILE_FILE_SIZE, NULL);
+	if (s_hMap != NULL)
+		s_header = (ProfileFileHeader *)MapViewOfFile(s_hMap, FILE_MAP_WRITE, 0, 0, PROFILE_FILE_SIZE);
+	if (s_header == NULL)
+	{
+		LOG_WARNING(_T("Unable to map the program profile file %s, Windows error %lu"), fname, GetLastError());
+		ProfileStoreClose();
+		return false;
+	}
+	s_records = (ExeProfile *)(s_header + 1);
+
+	// start over if it's new, or if it's from a different format version
+	if (s_header->magic != PROFILE_MAGIC || s_header->version != PROFILE_VERSION
+		|| s_header->count > (DWORD)PROFILE_MAX_ENTRIES)
+	{
+		if (s_header->magic != 0)
+			LOG_INFO(_T("The program profile file %s has an unknown format; starting over"), fname);
+		ZeroMemory(s_header, PROFILE_FILE_SIZE);
+		s_header->magic = PROFILE_MAGIC;
+		s_header->version = PROFILE_VERSION;
+	}
+
+	// index the records
+	for (DWORD i = 0; i < s_header->count; ++i)
+	{
+		ExeProfile &r = s_records[i];
+		r.key[countof(r.key) - 1] = 0;
+		s_index.emplace(g_strings.Intern(r.key), &r);
+	}
+
+	LOG_DEBUG(_T("Loaded %lu program profiles"), s_header->count);
+	return true;
+}
+
+void ProfileStoreClose()
+{
+	if (s_header != NULL)
+	{
+		FlushViewOfFile(s_header, PROFILE_FILE_SIZE);
+		UnmapViewOfFile(s_header);
+		s_header = NULL;
+		s_records = NULL;
+	}
+	if (s_hMap != NULL)
+	{
+		CloseHandle(s_hMap);
+		s_hMap = NULL;
+	}
+	if (s_hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(s_hFile);
+		s_hFile = INVALID_HANDLE_VALUE;
+	}
+	s_index.clear();
+}
+
+ExeProfile *FindProfile(const TCHAR *key)
+{
+	auto it = s_index.find(key);
+	return it != s_index.end() ? it->second : NULL;
+}
+
+ExeProfile *GetProfile(const TCHAR *key)
+{
+	ExeProfile *prof = FindProfile(key);
+	if (prof != NULL || s_header == NULL)
+		return prof;
+
+	// add a record, if there's room and the key fits
+	if (s_header->count >= (DWORD)PROFILE_MAX_ENTRIES || _tcslen(key) >= countof(prof->key))
+		return NULL;
+	prof = &s_records[s_header->count++];
+	ZeroMemory(prof, sizeof(*prof));
+	_tcscpy_s(prof->key, key);
+	s_index.emplace(key, prof);
+	return prof;
+}
+
+int ProfileWeight(const ExeProfile *prof)
+{
+	// use the best measured size if we have one
+	if (prof->bestCores != 0)
+	{
+		// on most runs, just use it
+		int best = prof->bestCores;
+		if (prof->runs % PROFILE_EXPLORE_RUNS != PROFILE_EXPLORE_RUNS - 1)
+			return best;
+
+		// Otherwise try a neighbour: one we haven't measured yet if
+		// there is one, otherwise alternate between the two sides.
+		auto Measured = [prof](int n) { return (prof->sizeMeasured & (1ULL << (n - 1))) != 0; };
+		bool hasBelow = best > 1, hasAbove = best < PROFILE_MAX_CORES;
+		if (hasAbove && !Measured(best + 1))
+			return best + 1;
+		if (hasBelow && !Measured(best - 1))
+			return best - 1;
+		bool above = ((prof->runs / PROFILE_EXPLORE_RUNS) & 1) == 0;
+		return (above && hasAbove) || !hasBelow ? best + 1 : best - 1;
+	}
+
+	// otherwise, a core for each hot thread, or enough cores to cover
+	// the peak CPU usage, whichever is more
+	int n = max((int)prof->hotThreads, (prof->peakCpu + 999) / 1000);
+	return min(n, 64);
+}
+
+void ProfileEndRun(ExeProfile *prof, int weight, int avgDelay)
+{
+	prof->runs++;
+
+	if (weight <= 0 || weight > PROFILE_MAX_CORES || avgDelay < 0)
+		return;
+
+	// fold the run into the size's figure, weighting the latest run at 1/2
+	UINT64 bit = 1ULL << (weight - 1);
+	UINT16 &delay = prof->sizeDelay[weight - 1];
+	delay = (prof->sizeMeasured & bit) != 0 ? (UINT16)((delay + avgDelay + 1) / 2) : (UINT16)min(avgDelay, 0xFFFF);
+	prof->sizeMeasured |= bit;
+
+	// pick the size with the lowest delay, taking the smaller size on a tie
+	prof->bestCores = 0;
+	for (int n = 1; n <= PROFILE_MAX_CORES; ++n)
+	{
+		if ((prof->sizeMeasured & (1ULL << (n - 1))) != 0
+			&& (prof->bestCores == 0 || prof->sizeDelay[n - 1] < prof->bestDelay))
+		{
+			prof->bestCores = (UINT16)n;
+			prof->bestDelay = prof->sizeDelay[n - 1];
+		}
+	}
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+// Learned per-program profiles.
+//
+// Each time a game runs, we learn something about it: how many threads
+// it runs, how many of them are busy, how much CPU it uses at its peak,
+// and, for types with exclusive allotment (see Allotment.h), how much
+// scheduling delay its threads saw with a given number of cores.  The
+// profile store keeps that from one run to the next, so that the next
+// time the program starts, its allotment can be sized from what we've
+// already seen, starting with the first update pass that finds it,
+// rather than from a fixed default.
+//
+// The store is a small fixed-size file in the program folder, which we
+// map into memory at startup.  The records are updated in place, in the
+// mapped view, as the samples come in; Windows writes the changed pages
+// back to the file on its own schedule, and we flush the view at exit.
+// Programs are identified by their key (the lower-case program file
+// name), the same as in the saved settings.  Only the reserved types'
+// programs (the types other than the default type) are profiled.
+
+// maximum number of programs in the store
+const int PROFILE_MAX_ENTRIES = 256;
+
+// largest allotment size (physical cores) we keep a delay figure for
+const int PROFILE_MAX_CORES = 64;
+
+// Every this many runs, a program with a measured best allotment size
+// tries a neighbouring size instead (one core more or fewer), so that
+// the profile keeps measuring the sizes around the best one rather than
+// only confirming it.
+const DWORD PROFILE_EXPLORE_RUNS = 4;
+
+// A thread counts as "hot" if it uses at least this much CPU over a
+// scheduling statistics window, in tenths of a percent
+const UINT16 PROFILE_HOT_THREAD_CPU = 250;
+
+// Program profile record.  This is the on-disk format, so the fields
+// have fixed sizes.
+struct ExeProfile
+{
+	// program key (lower-case file name), null-terminated; programs with
+	// longer names aren't profiled
+	WCHAR key[64];
+
+	// number of completed runs observed
+	DWORD runs;
+
+	// peak thread count
+	UINT16 peakThreads;
+
+	// Peak number of hot threads (see PROFILE_HOT_THREAD_CPU), and peak
+	// CPU usage by a single thread, in tenths of a percent.  These come
+	// from the scheduling statistics, so they're only collected with
+	// /SchedStats; they're zero until then.
+	UINT16 hotThreads;
+	UINT16 peakThreadCpu;
+
+	// peak CPU usage of the whole process, in tenths of a percent of one CPU
+	UINT16 peakCpu;
+
+	// The allotment size (physical cores) with the lowest measured
+	// scheduling delay in sizeDelay[], and that delay.  bestCores is
+	// zero if we haven't measured any size.
+	UINT16 bestCores;
+	UINT16 bestDelay;
+
+	// Measured scheduling delay for each allotment size, in tenths of a
+	// percent: sizeDelay[n-1] is for n cores.  Each figure is a running
+	// average over the runs at that size, weighted toward the latest
+	// run, so that a size that has gotten better or worse (after a game
+	// update, say) moves in the ranking.  Bit n-1 of sizeMeasured is set
+	// once size n has a figure.
+	UINT64 sizeMeasured;
+	UINT16 sizeDelay[PROFILE_MAX_CORES];
+};
+
+// Open the store, creating it if it doesn't exist.  Returns false if
+// the file can't be opened or mapped, in which case the program runs
+// without profiles.
+bool ProfileStoreOpen(const TCHAR *fname);
+
+// flush and close the store
+void ProfileStoreClose();
+
+// find a program's profile by key (interned in g_strings); returns NULL
+// if there isn't one
+ExeProfile *FindProfile(const TCHAR *key);
+
+// find a program's profile, creating it if it doesn't exist yet;
+// returns NULL if the store isn't open or is full
+ExeProfile *GetProfile(const TCHAR *key);
+
+// Figure the allotment weight (physical cores) to give a program from
+// its profile: the best measured size if there is one, otherwise enough
+// cores for its hot threads or its peak CPU usage.  Every
+// PROFILE_EXPLORE_RUNS runs, this returns a size next to the best one
+// instead, preferring one that hasn't been measured yet.  Returns zero
+// if the profile doesn't say.
+int ProfileWeight(const ExeProfile *prof);
+
+// Record the end of a run.  weight is the allotment size the process
+// ran with, or zero if it didn't have an allotment, and avgDelay is its
+// average scheduling delay over the run, or -1 if it wasn't measured.
+void ProfileEndRun(ExeProfile *prof, int weight, int avgDelay);
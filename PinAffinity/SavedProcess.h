@@ -1,11 +1,13 @@
 #pragma once
 #include "Util.h"
 
+struct ListViewData;
+
 // Saved process list item
 struct SavedProc
 {
 	SavedProc(const TCHAR *name, int iType) 
-		: name(name), iType(iType), numInstances(0), inListView(false) 
+		: name(name), iType(iType), weight(0), numInstances(0), placeholder(NULL), queued(false) 
 	{
 		key = name;
 		std::transform(key.begin(), key.end(), key.begin(), ::_totlower);
@@ -24,8 +26,17 @@ struct SavedProc
 	// special program type code
 	int iType;
 
-	// do I have a ListView placeholder entry?
-	bool inListView;
+	// Allotment weight: the number of cores each instance gets from the
+	// type's pool, for types with exclusive allotment, or zero to size
+	// the allotment from the program's profile.  This is saved as an
+	// optional third field in SavedProcesses.txt.
+	int weight;
+
+	// my ListView placeholder entry, if I have one
+	ListViewData *placeholder;
+
+	// am I listed in the UI change set?
+	bool queued;
 
 	// does the UI element need to be updated for a change?
 	bool dirty;
@@ -0,0 +1,470 @@
+#include "stdafx.h"
+#include "PinAffinity.h"
+#include "SchedStats.h"
+#include "CoreMonitor.h"
+#include "NtApi.h"
+#include "Log.h"
+
+// maximum number of watched processes
+static const int SCHED_MAX_PROCS = 128;
+
+// size of the thread index; a power of two, at least twice the
+// maximum number of threads
+static const int SCHED_INDEX_SIZE = 2048;
+
+// Thread record
+struct SchedThread
+{
+	// identification
+	DWORD pid;
+	DWORD tid;
+	int type;
+	WCHAR name[32];
+
+	// last sample generation that saw the thread
+	DWORD gen;
+
+	// state, context switch count, and CPU time (100ns units) at the
+	// last snapshot
+	ULONG lastState;
+	ULONG lastSwitches;
+	ULONGLONG lastCpu;
+
+	// current window accumulators
+	DWORD samples;
+	DWORD readySamples;
+	DWORD preempts;
+	ULONG switches;
+	ULONGLONG cpu;
+
+	// latest complete window, if any
+	SchedWindow last;
+	bool haveLast;
+};
+
+// Sampler state.  The thread table and the snapshot buffer are set up
+// front; the snapshot buffer only grows if the system process list
+// outgrows it.
+struct SchedStatsState
+{
+	// sampler thread
+	HANDLE hThread;
+	HANDLE hStopEvent;
+
+	// watched processes, as published by the main thread
+	DWORD pubPid[SCHED_MAX_PROCS];
+	int pubType[SCHED_MAX_PROCS];
+	int nPub;
+
+	// Thread table, and an open-addressing index over it by thread ID.
+	// The index holds table positions, or -1 for empty slots.
+	SchedThread threads[SCHED_MAX_THREADS];
+	int nThreads;
+	int index[SCHED_INDEX_SIZE];
+
+	// snapshot generation
+	DWORD gen;
+
+	// start time of the current window
+	ULONGLONG windowStart;
+
+	// worst offender windows
+	SchedThreadStats worst[SCHED_WORST_WINDOWS];
+	int nWorst;
+
+	// Lock protecting the published process list, the thread table's
+	// completed windows, and the worst offender list
+	CRITICAL_SECTION lock;
+};
+static SchedStatsState *s_sched = NULL;
+
+// snapshot buffer, owned by the sampler thread
+static std::vector<BYTE> s_snapBuf;
+
+// hash index home position for a thread ID
+static int IndexHome(DWORD tid)
+{
+	return (int)((UINT32)(tid * 2654435761u) >> 21) & (SCHED_INDEX_SIZE - 1);
+}
+
+// find a thread's table position, or -1 if it's not in the table
+static int FindThread(DWORD tid)
+{
+	for (int pos = IndexHome(tid); s_sched->index[pos] >= 0; pos = (pos + 1) & (SCHED_INDEX_SIZE - 1))
+	{
+		if (s_sched->threads[s_sched->index[pos]].tid == tid)
+			return s_sched->index[pos];
+	}
+	return -1;
+}
+
+// rebuild the thread index
+static void RebuildIndex()
+{
+	for (int i = 0; i < SCHED_INDEX_SIZE; ++i)
+		s_sched->index[i] = -1;
+
+	for (int i = 0; i < s_sched->nThreads; ++i)
+	{
+		int pos = IndexHome(s_sched->threads[i].tid);
+		while (s_sched->index[pos] >= 0)
+			pos = (pos + 1) & (SCHED_INDEX_SIZE - 1);
+		s_sched->index[pos] = i;
+	}
+}
+
+// Take a snapshot of the system process list.  Returns the first
+// process entry, or NULL on failure.
+static const NtSystemProcessInfo *TakeSnapshot(NtQuerySystemInformation_t NtQSI)
+{
+	for (;;)
+	{
+		ULONG len = 0;
+		LONG status = NtQSI(NtSystemProcessInformation, s_snapBuf.data(), (ULONG)s_snapBuf.size(), &len);
+		if (status >= 0)
+			return (const NtSystemProcessInfo *)s_snapBuf.data();
+		if (status != NtStatusInfoLengthMismatch)
+			return NULL;
+
+		// grow the buffer, with some headroom for new processes
+		s_snapBuf.resize(max((size_t)len, s_snapBuf.size()) + 65536);
+	}
+}
+
+// Close out the current window.  Each thread's accumulators become its
+// latest window, and any window that's among the worst so far goes on
+// the worst offender list.
+static void CloseWindow(ULONGLONG now)
+{
+	DWORD ms = (DWORD)(now - s_sched->windowStart);
+	s_sched->windowStart = now;
+	if (ms == 0)
+		return;
+
+	EnterCriticalSection(&s_sched->lock);
+	for (int i = 0; i < s_sched->nThreads; ++i)
+	{
+		SchedThread &t = s_sched->threads[i];
+		if (t.samples == 0)
+			continue;
+
+		SchedWindow &w = t.last;
+		w.time = now;
+		w.runDelay = (UINT16)(t.readySamples * 1000 / t.samples);
+		w.cpu = (UINT16)min(t.cpu / 10 / ms, (ULONGLONG)1000);
+		w.switchRate = (DWORD)((ULONGLONG)t.switches * 1000 / ms);
+		w.preemptRate = (DWORD)((ULONGLONG)t.preempts * 1000 / ms);
+		t.haveLast = true;
+		t.samples = t.readySamples = t.preempts = t.switches = 0;
+		t.cpu = 0;
+
+		// Check it against the worst offender list.  If the list is full,
+		// replace the entry with the lowest run delay, if it's lower than
+		// this one.
+		if (w.runDelay == 0)
+			continue;
+		int slot = s_sched->nWorst;
+		if (slot == SCHED_WORST_WINDOWS)
+		{
+			slot = 0;
+			for (int j = 1; j < SCHED_WORST_WINDOWS; ++j)
+			{
+				if (s_sched->worst[j].last.runDelay < s_sched->worst[slot].last.runDelay)
+					slot = j;
+			}
+			if (s_sched->worst[slot].last.runDelay >= w.runDelay)
+				continue;
+		}
+		else
+			++s_sched->nWorst;
+
+		SchedThreadStats &ws = s_sched->worst[slot];
+		ws.pid = t.pid;
+		ws.tid = t.tid;
+		ws.type = t.type;
+		memcpy(ws.name, t.name, sizeof(ws.name));
+		ws.last = w;
+	}
+	LeaveCriticalSection(&s_sched->lock);
+}
+
+// Sample the watched processes' threads
+static void TakeSample(NtQuerySystemInformation_t NtQSI)
+{
+	// get the watched process list
+	static DWORD pids[SCHED_MAX_PROCS];
+	static int types[SCHED_MAX_PROCS];
+	EnterCriticalSection(&s_sched->lock);
+	int nProcs = s_sched->nPub;
+	memcpy(pids, s_sched->pubPid, nProcs * sizeof(DWORD));
+	memcpy(types, s_sched->pubType, nProcs * sizeof(int));
+	LeaveCriticalSection(&s_sched->lock);
+
+	// if there's nothing to watch, there's nothing to do
+	if (nProcs == 0 && s_sched->nThreads == 0)
+		return;
+
+	// take a snapshot
+	const NtSystemProcessInfo *proc = TakeSnapshot(NtQSI);
+	if (proc == NULL)
+		return;
+
+	// Visit the threads of the watched processes.  Hold the lock while
+	// updating the thread table, since callers read the identification
+	// fields; this only covers our own pass over the snapshot.
+	DWORD gen = ++s_sched->gen;
+	bool added = false;
+	EnterCriticalSection(&s_sched->lock);
+	for (;;)
+	{
+		DWORD pid = (DWORD)(ULONG_PTR)proc->UniqueProcessId;
+		int iProc = 0;
+		for (; iProc < nProcs && pids[iProc] != pid; ++iProc);
+		if (iProc < nProcs)
+		{
+			const NtSystemThreadInfo *th = proc->Threads();
+			for (ULONG i = 0; i < proc->NumberOfThreads; ++i, ++th)
+			{
+				DWORD tid = (DWORD)(ULONG_PTR)th->UniqueThread;
+				ULONGLONG cpu = th->KernelTime.QuadPart + th->UserTime.QuadPart;
+				bool ready = th->ThreadState == NtThreadReady || th->ThreadState == NtThreadDeferredReady
+					|| th->ThreadState == NtThreadStandby;
+
+				// find or add the thread record
+				int idx = FindThread(tid);
+				if (idx >= 0 && s_sched->threads[idx].pid != pid)
+				{
+					// the thread ID was reused by another process; start over
+					s_sched->threads[idx].pid = pid;
+					s_sched->threads[idx].gen = 0;
+				}
+				if (idx < 0)
+				{
+					if (s_sched->nThreads == SCHED_MAX_THREADS)
+						continue;
+					idx = s_sched->nThreads++;
+					s_sched->threads[idx].tid = tid;
+					s_sched->threads[idx].pid = pid;
+					s_sched->threads[idx].gen = 0;
+					added = true;
+				}
+
+				SchedThread &t = s_sched->threads[idx];
+				if (t.gen == 0)
+				{
+					// new record - take the baselines
+					t.type = types[iProc];
+					int nameLen = proc->ImageName.Buffer == NULL ? 0 :
+						min((int)(proc->ImageName.Length / sizeof(WCHAR)), (int)countof(t.name) - 1);
+					memcpy(t.name, proc->ImageName.Buffer, nameLen * sizeof(WCHAR));
+					t.name[nameLen] = 0;
+					t.samples = t.readySamples = t.preempts = t.switches = 0;
+					t.cpu = 0;
+					t.haveLast = false;
+				}
+				else
+				{
+					// accumulate the window statistics
+					++t.samples;
+					if (ready)
+						++t.readySamples;
+					ULONG switches = th->ContextSwitches - t.lastSwitches;
+					if (ready && (t.lastState == NtThreadRunning || (t.lastState == NtThreadReady && switches != 0)))
+						++t.preempts;
+					t.switches += switches;
+					t.cpu += cpu > t.lastCpu ? cpu - t.lastCpu : 0;
+				}
+
+				t.gen = gen;
+				t.lastState = th->ThreadState;
+				t.lastSwitches = th->ContextSwitches;
+				t.lastCpu = cpu;
+			}
+		}
+
+		if (proc->NextEntryOffset == 0)
+			break;
+		proc = (const NtSystemProcessInfo *)((const BYTE *)proc + proc->NextEntryOffset);
+	}
+
+	// drop threads we didn't see in this snapshot
+	bool removed = false;
+	for (int i = 0; i < s_sched->nThreads; )
+	{
+		if (s_sched->threads[i].gen != gen)
+		{
+			s_sched->threads[i] = s_sched->threads[--s_sched->nThreads];
+			removed = true;
+		}
+		else
+			++i;
+	}
+	LeaveCriticalSection(&s_sched->lock);
+
+	// rebuild the index if the table changed
+	if (added || removed)
+		RebuildIndex();
+
+	// close the window if it's time
+	ULONGLONG now = GetTickCount64();
+	if (now - s_sched->windowStart >= SCHED_WINDOW)
+		CloseWindow(now);
+}
+
+static DWORD WINAPI SchedStatsThread(LPVOID)
+{
+	// stay off the reserved cores, and run in background mode
+	if (DWORD_PTR mask = GetHousekeepingMask())
+		SetThreadAffinityMask(GetCurrentThread(), mask);
+	SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+	NtQuerySystemInformation_t NtQSI = GetNtQuerySystemInformation();
+	s_sched->windowStart = GetTickCount64();
+	while (WaitForSingleObject(s_sched->hStopEvent, SCHED_SAMPLE_INTERVAL) == WAIT_TIMEOUT)
+		TakeSample(NtQSI);
+
+	return 0;
+}
+
+bool StartSchedStats()
+{
+	if (GetNtQuerySystemInformation() == NULL)
+	{
+		LOG_WARNING(_T("Scheduling statistics: NtQuerySystemInformation isn't available"));
+		return false;
+	}
+
+	// set up the sampler state
+	s_sched = new SchedStatsState;
+	ZeroMemory(s_sched, sizeof(*s_sched));
+	InitializeCriticalSection(&s_sched->lock);
+	RebuildIndex();
+	s_snapBuf.resize(512 * 1024);
+
+	// start the thread
+	s_sched->hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	s_sched->hThread = CreateThread(NULL, 0, SchedStatsThread, NULL, 0, NULL);
+	if (s_sched->hThread == NULL)
+	{
+		LOG_ERROR(_T("Unable to start the scheduling statistics thread, Windows error %lu"), GetLastError());
+		return false;
+	}
+	return true;
+}
+
+void StopSchedStats()
+{
+	if (s_sched == NULL || s_sched->hThread == NULL)
+		return;
+
+	SetEvent(s_sched->hStopEvent);
+	WaitForSingleObject(s_sched->hThread, INFINITE);
+	CloseHandle(s_sched->hThread);
+	CloseHandle(s_sched->hStopEvent);
+	s_sched->hThread = NULL;
+}
+
+bool IsSchedStatsEnabled()
+{
+	return s_sched != NULL && s_sched->hThread != NULL;
+}
+
+void SchedStatsSetProcesses(const DWORD *pids, const int *types, int n)
+{
+	if (s_sched == NULL)
+		return;
+
+	n = min(n, SCHED_MAX_PROCS);
+	EnterCriticalSection(&s_sched->lock);
+	memcpy(s_sched->pubPid, pids, n * sizeof(DWORD));
+	memcpy(s_sched->pubType, types, n * sizeof(int));
+	s_sched->nPub = n;
+	LeaveCriticalSection(&s_sched->lock);
+}
+
+bool GetProcessSchedSummary(DWORD pid, UINT16 &runDelay, DWORD &preemptRate)
+{
+	if (s_sched == NULL)
+		return false;
+
+	bool found = false;
+	runDelay = 0;
+	preemptRate = 0;
+	EnterCriticalSection(&s_sched->lock);
+	for (int i = 0; i < s_sched->nThreads; ++i)
+	{
+		const SchedThread &t = s_sched->threads[i];
+		if (t.pid == pid && t.haveLast)
+		{
+			found = true;
+			runDelay = max(runDelay, t.last.runDelay);
+			preemptRate += t.last.preemptRate;
+		}
+	}
+	LeaveCriticalSection(&s_sched->lock);
+	return found;
+}
+
+int GetProcessSchedThreads(DWORD pid, SchedThreadStats *buf, int maxThreads)
+{
+	if (s_sched == NULL)
+		return 0;
+
+	int n = 0;
+	EnterCriticalSection(&s_sched->lock);
+	for (int i = 0; i < s_sched->nThreads && n < maxThreads; ++i)
+	{
+		const SchedThread &t = s_sched->threads[i];
+		if (t.pid == pid && t.haveLast)
+		{
+			SchedThreadStats &s = buf[n++];
+			s.pid = t.pid;
+			s.tid = t.tid;
+			s.type = t.type;
+			memcpy(s.name, t.name, sizeof(s.name));
+			s.last = t.last;
+		}
+	}
+	LeaveCriticalSection(&s_sched->lock);
+	return n;
+}
+
+bool WriteSchedReport(const TCHAR *fname)
+{
+	if (s_sched == NULL)
+		return false;
+
+	// copy out the worst offender list, and sort it by run delay,
+	// worst first
+	EnterCriticalSection(&s_sched->lock);
+	std::vector<SchedThreadStats> worst(s_sched->worst, s_sched->worst + s_sched->nWorst);
+	LeaveCriticalSection(&s_sched->lock);
+	std::sort(worst.begin(), worst.end(), [](const SchedThreadStats &a, const SchedThreadStats &b) {
+		return a.last.runDelay > b.last.runDelay; });
+
+	FILE *fp;
+	if (_tfopen_s(&fp, fname, _T("w")) != 0)
+		return false;
+
+	// note the current time, to show how long ago each window was
+	ULONGLONG now = GetTickCount64();
+	_ftprintf(fp, _T("PinAffinity scheduling delay report\n\n")
+		_T("Worst %d windows of %lu ms, by estimated run delay (time spent ready\n")
+		_T("to run but waiting for a CPU).  Preemptions are estimated from\n")
+		_T("Running -> Ready transitions between %lu ms snapshots.\n\n"),
+		SCHED_WORST_WINDOWS, SCHED_WINDOW, SCHED_SAMPLE_INTERVAL);
+	_ftprintf(fp, _T("%-32s %8s %8s %-16s %9s %7s %9s %9s %10s\n"),
+		_T("Process"), _T("PID"), _T("TID"), _T("Type"), _T("RunDelay"), _T("CPU"), _T("Switch/s"), _T("Preempt/s"), _T("Age (s)"));
+	for (auto &w : worst)
+	{
+		const TCHAR *typeName = w.type >= 0 && w.type < (int)g_procTypes.size() ? g_procTypes[w.type].name.c_str() : _T("?");
+		_ftprintf(fp, _T("%-32s %8lu %8lu %-16s %8.1lf%% %6.1lf%% %9lu %9lu %10llu\n"),
+			w.name, w.pid, w.tid, typeName, w.last.runDelay / 10.0, w.last.cpu / 10.0,
+			w.last.switchRate, w.last.preemptRate, (now - w.last.time) / 1000);
+	}
+	if (worst.size() == 0)
+		_ftprintf(fp, _T("(no run delay observed)\n"));
+
+	fclose(fp);
+	return true;
+}
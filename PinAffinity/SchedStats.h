@@ -0,0 +1,102 @@
+#pragma once
+
+// Per-thread scheduling delay statistics.
+//
+// Scheduling latency - how long a game thread that's ready to run has
+// to wait for a CPU - is the thing the reserved cores are supposed to
+// minimize.  Windows doesn't keep a per-thread count of time spent
+// waiting in the ready queue (short of an ETW kernel trace), but it
+// does report each thread's current scheduling state and its context
+// switch count.  So we estimate: a background thread snapshots the
+// threads of the reserved-type processes several times a second, and
+// the fraction of snapshots that catch a thread in the Ready state
+// (runnable, but not running) estimates the fraction of time it spent
+// waiting for a CPU.  A thread that was Running at one snapshot and
+// Ready at the next was preempted in between, which gives an estimate
+// of the involuntary context switch rate, alongside the total switch
+// rate.
+//
+// The statistics are summarized over fixed windows of a few seconds.
+// Each thread's latest window feeds the UI; the worst windows seen
+// during the session (the "worst offender windows") are kept for the
+// report written at exit.
+//
+// Sampling scans the system process list, which isn't free, so it's
+// only enabled with the /SchedStats command line option, and it only
+// runs while there are reserved-type processes to watch.
+
+// snapshot interval, in milliseconds
+const DWORD SCHED_SAMPLE_INTERVAL = 100;
+
+// summary window length, in milliseconds
+const DWORD SCHED_WINDOW = 5000;
+
+// maximum number of threads tracked
+const int SCHED_MAX_THREADS = 1024;
+
+// number of worst offender windows kept for the report
+const int SCHED_WORST_WINDOWS = 32;
+
+// Statistics for one thread over one summary window
+struct SchedWindow
+{
+	// GetTickCount64() time at the end of the window
+	ULONGLONG time;
+
+	// estimated time spent waiting for a CPU, in tenths of a percent
+	// of the window
+	UINT16 runDelay;
+
+	// CPU time used, in tenths of a percent of the window
+	UINT16 cpu;
+
+	// context switches per second
+	DWORD switchRate;
+
+	// estimated involuntary context switches (preemptions) per second
+	DWORD preemptRate;
+};
+
+// Thread statistics, as reported to callers
+struct SchedThreadStats
+{
+	// process and thread IDs
+	DWORD pid;
+	DWORD tid;
+
+	// process type
+	int type;
+
+	// process name
+	WCHAR name[32];
+
+	// the thread's most recent window
+	SchedWindow last;
+};
+
+// Start the sampler.  Call this after starting the core monitor, so
+// that the sampler can stay on the housekeeping cores.
+bool StartSchedStats();
+
+// stop the sampler
+void StopSchedStats();
+
+// is the sampler running?
+bool IsSchedStatsEnabled();
+
+// Update the list of processes to watch.  The main thread calls this
+// after each process list update, with the reserved-type processes.
+void SchedStatsSetProcesses(const DWORD *pids, const int *types, int n);
+
+// Get the summary for a process from its threads' latest windows: the
+// worst thread's run delay, and the total preemption rate.  Returns
+// false if we don't have a window for any of the process's threads.
+bool GetProcessSchedSummary(DWORD pid, UINT16 &runDelay, DWORD &preemptRate);
+
+// Get the latest statistics for a process's threads.  Returns the
+// number of threads copied, up to maxThreads.
+int GetProcessSchedThreads(DWORD pid, SchedThreadStats *buf, int maxThreads);
+
+// Write the worst offender window report.  Returns false if the file
+// can't be written.
+bool WriteSchedReport(const TCHAR *fname);
@@ -0,0 +1,179 @@
+#include "stdafx.h"
+#include "SortedView.h"
+
+SortedView g_sortedView;
+
+bool ViewSortLess::operator()(const ViewSortKey &a, const ViewSortKey &b) const
+{
+	// Compare by the sort field, then by name, then by PID.  The keys
+	// are 64-bit, and compared directly rather than by subtraction, so
+	// nothing can overflow.  The last resort is the row object's
+	// address, which makes every key unique, even for the brief overlap
+	// when a PID is reused by a new instance of the same program.
+	int c = 0;
+	if (a.primary != b.primary)
+		c = a.primary < b.primary ? -1 : 1;
+	else if (a.name != b.name)
+		c = _tcscmp(a.name, b.name);
+	if (c == 0 && a.pid != b.pid)
+		c = a.pid < b.pid ? -1 : 1;
+	if (c == 0 && a.row != b.row)
+		c = (UINT_PTR)a.row < (UINT_PTR)b.row ? -1 : 1;
+
+	// apply the direction
+	return dir > 0 ? c < 0 : c > 0;
+}
+
+SortedView::SortedView() : field(SortFieldName), changeFirst(-1), changeLast(-1)
+{
+}
+
+ViewSortKey SortedView::MakeKey(const ListViewData *data) const
+{
+	ViewSortKey key;
+	key.name = data->key;
+	key.pid = data->IsPlaceholder() ? -1 : (INT64)data->pid;
+	key.row = data;
+
+	switch (field)
+	{
+	case SortFieldPid:
+		key.primary = key.pid;
+		break;
+
+	case SortFieldStatus:
+		// non-running saved items to the top
+		key.primary = data->IsPlaceholder() ? 0 : 1;
+		break;
+
+	case SortFieldType:
+		// pinball items to the top
+		key.primary = data->iType == 0 ? 65535 : data->iType;
+		break;
+
+	case SortFieldStarted:
+		key.primary = ((INT64)data->startTime.dwHighDateTime << 32) | data->startTime.dwLowDateTime;
+		break;
+
+	case SortFieldCpu:
+		key.primary = data->cpu;
+		break;
+
+	default:
+		// sort by name, which the tie-breakers already do
+		key.primary = 0;
+		break;
+	}
+	return key;
+}
+
+void SortedView::SetOrder(ViewSortField newField, int dir)
+{
+	// pull out the rows
+	std::vector<ListViewData*> rows;
+	rows.reserve(tree.Count());
+	tree.ForEach([&rows](ListViewData *data) { rows.push_back(data); });
+
+	// set the new ordering
+	tree.Clear();
+	field = newField;
+	ViewSortLess less;
+	less.dir = dir;
+	tree.SetLess(less);
+
+	// re-key and re-insert the rows
+	for (auto data : rows)
+	{
+		data->sortKey = MakeKey(data);
+		tree.Insert(data->sortKey, data);
+	}
+
+	// everything moved
+	if (rows.size() != 0)
+		Dirty(0, (int)rows.size() - 1);
+}
+
+void SortedView::Clear()
+{
+	int n = tree.Count();
+	tree.ForEach([](ListViewData *data) { data->inView = false; });
+	tree.Clear();
+	if (n != 0)
+		Dirty(0, n - 1);
+}
+
+int SortedView::Find(const ListViewData *data) const
+{
+	return data->inView ? tree.Find(data->sortKey) : -1;
+}
+
+int SortedView::Insert(ListViewData *data)
+{
+	// insert the row; it and everything after it shift down
+	data->sortKey = MakeKey(data);
+	data->inView = true;
+	int pos = tree.Insert(data->sortKey, data);
+	Dirty(pos, tree.Count() - 1);
+	return pos;
+}
+
+int SortedView::Remove(ListViewData *data)
+{
+	if (!data->inView)
+		return -1;
+
+	// remove the row; everything after it shifts up, and the old last
+	// position goes blank
+	int pos = tree.Erase(data->sortKey);
+	data->inView = false;
+	Dirty(pos, tree.Count());
+	return pos;
+}
+
+int SortedView::Reposition(ListViewData *data)
+{
+	if (!data->inView)
+		return -1;
+
+	// if the key didn't change, the row stays put
+	ViewSortKey key = MakeKey(data);
+	const ViewSortLess &less = tree.GetLess();
+	if (!less(key, data->sortKey) && !less(data->sortKey, key))
+	{
+		int pos = tree.Find(key);
+		Dirty(pos, pos);
+		return pos;
+	}
+
+	// move it; the rows between the old and new positions shift by one
+	int from = tree.Erase(data->sortKey);
+	data->sortKey = key;
+	int to = tree.Insert(key, data);
+	Dirty(min(from, to), max(from, to));
+	return to;
+}
+
+void SortedView::Dirty(int first, int last)
+{
+	if (changeFirst < 0)
+	{
+		changeFirst = first;
+		changeLast = last;
+	}
+	else
+	{
+		changeFirst = min(changeFirst, first);
+		changeLast = max(changeLast, last);
+	}
+}
+
+bool SortedView::TakeChanges(int &first, int &last)
+{
+	if (changeFirst < 0)
+		return false;
+
+	first = changeFirst;
+	last = changeLast;
+	changeFirst = changeLast = -1;
+	return true;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "PinAffinity.h"
+#include "OrderStatTree.h"
+
+// Sorted view model.  This holds the list view's rows in display
+// order, and keeps them in order incrementally: when a row is added,
+// removed, or has a sort field change, the model moves just that row,
+// in O(log n) time, rather than re-sorting the whole list.  The list
+// view is a virtual (owner data) list that asks the model for the row
+// at each position as it paints, so a row that moves doesn't have to
+// be deleted and re-created in the control, either.
+//
+// Each row's sort key is computed when the row is inserted or re-keyed,
+// and stored in the row's ListViewData, so comparisons never have to
+// re-derive anything from the row's fields.
+//
+// The model tracks the range of positions affected by the changes since
+// the view last looked, so the view only repaints the rows that moved.
+// There are no window handles in here.
+
+// sort fields
+enum ViewSortField
+{
+	SortFieldName,
+	SortFieldPid,
+	SortFieldStatus,
+	SortFieldType,
+	SortFieldStarted,
+	SortFieldCpu
+};
+
+// sort key ordering
+struct ViewSortLess
+{
+	ViewSortLess() : dir(1) { }
+
+	bool operator()(const ViewSortKey &a, const ViewSortKey &b) const;
+
+	// direction: 1 for ascending, -1 for descending
+	int dir;
+};
+
+class SortedView
+{
+public:
+	SortedView();
+
+	// Set the sort order, and re-sort the rows to match.  dir is 1 for
+	// ascending or -1 for descending.
+	void SetOrder(ViewSortField field, int dir);
+
+	// number of rows
+	int Count() const { return tree.Count(); }
+
+	// get the row at a position; the position must be in range
+	ListViewData *At(int pos) const { return tree.At(pos); }
+
+	// visit the rows in order
+	template<typename F> void ForEach(F f) const { tree.ForEach(f); }
+
+	// Remove all rows.  The caller still owns the row objects.
+	void Clear();
+
+	// find a row's position, or -1 if it's not in the view
+	int Find(const ListViewData *data) const;
+
+	// Insert a row.  Returns its position.
+	int Insert(ListViewData *data);
+
+	// Remove a row.  Returns the position it had, or -1 if it wasn't
+	// in the view.
+	int Remove(ListViewData *data);
+
+	// Re-key a row after a change to its sort fields, moving it if its
+	// position changed.  Returns its (new) position, or -1 if it isn't
+	// in the view.
+	int Reposition(ListViewData *data);
+
+	// Mark a row for repainting, for a change that doesn't affect its
+	// position.
+	void Touch(int pos) { Dirty(pos, pos); }
+
+	// Get the range of positions changed since the last call, and
+	// reset it.  Returns false if nothing changed.  The range can
+	// extend past the current row count, if rows were removed.
+	bool TakeChanges(int &first, int &last);
+
+protected:
+	// compute a row's sort key under the current sort field
+	ViewSortKey MakeKey(const ListViewData *data) const;
+
+	// extend the changed range
+	void Dirty(int first, int last);
+
+	// current sort field
+	ViewSortField field;
+
+	// rows, in order
+	OrderStatTree<ViewSortKey, ListViewData*, ViewSortLess> tree;
+
+	// changed range, or -1 for none
+	int changeFirst;
+	int changeLast;
+};
+
+// the list view's model
+extern SortedView g_sortedView;
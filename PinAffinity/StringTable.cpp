@@ -0,0 +1,111 @@
+#include "stdafx.h"
+#include "Util.h"
+#include "StringTable.h"
+
+// storage block size, in characters
+static const size_t STRING_BLOCK_SIZE = 8192;
+
+// global string table
+StringTable g_strings;
+
+StringTable::StringTable()
+	: count(0), blockPtr(NULL), blockFree(0)
+{
+	index.resize(256, NULL);
+}
+
+StringTable::~StringTable()
+{
+	for (auto b : blocks)
+		delete[] b;
+}
+
+size_t StringTable::Hash(const TCHAR *s, size_t len)
+{
+	// FNV-1a
+	UINT32 h = 2166136261u;
+	for (size_t i = 0; i < len; ++i)
+	{
+		h ^= (UINT32)s[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+const TCHAR *StringTable::Intern(const TCHAR *s, size_t len)
+{
+	// look for an existing copy
+	size_t mask = index.size() - 1;
+	size_t i = Hash(s, len) & mask;
+	for (; index[i] != NULL; i = (i + 1) & mask)
+	{
+		if (_tcsncmp(index[i], s, len) == 0 && index[i][len] == 0)
+			return index[i];
+	}
+
+	// not found - store a new copy in the empty slot we stopped at
+	const TCHAR *p = Store(s, len);
+	index[i] = p;
+
+	// keep the load factor under 1/2, so that probe sequences stay short
+	if (++count * 2 > index.size())
+		Rehash(index.size() * 2);
+
+	return p;
+}
+
+const TCHAR *StringTable::InternLower(const TCHAR *s)
+{
+	// Program names are file names, so they fit in MAX_PATH; go to
+	// the heap only for the rare longer string.
+	size_t len = _tcslen(s);
+	TCHAR buf[MAX_PATH];
+	if (len < countof(buf))
+	{
+		for (size_t i = 0; i <= len; ++i)
+			buf[i] = (TCHAR)_totlower(s[i]);
+		return Intern(buf, len);
+	}
+
+	TSTRING key = s;
+	std::transform(key.begin(), key.end(), key.begin(), ::_totlower);
+	return Intern(key.c_str(), len);
+}
+
+const TCHAR *StringTable::Store(const TCHAR *s, size_t len)
+{
+	// start a new block if the string won't fit in the current one;
+	// a string too big for a standard block gets a block of its own
+	if (len + 1 > blockFree)
+	{
+		size_t size = max(STRING_BLOCK_SIZE, len + 1);
+		blockPtr = new TCHAR[size];
+		blockFree = size;
+		blocks.push_back(blockPtr);
+	}
+
+	// copy the string
+	TCHAR *p = blockPtr;
+	memcpy(p, s, len * sizeof(TCHAR));
+	p[len] = 0;
+	blockPtr += len + 1;
+	blockFree -= len + 1;
+	return p;
+}
+
+void StringTable::Rehash(size_t newSize)
+{
+	std::vector<const TCHAR*> old;
+	old.swap(index);
+	index.resize(newSize, NULL);
+	size_t mask = newSize - 1;
+	for (auto p : old)
+	{
+		if (p != NULL)
+		{
+			size_t i = Hash(p, _tcslen(p)) & mask;
+			for (; index[i] != NULL; i = (i + 1) & mask);
+			index[i] = p;
+		}
+	}
+}
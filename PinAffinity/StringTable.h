@@ -0,0 +1,53 @@
+#pragma once
+
+// String table.  This interns strings, so that each distinct string is
+// stored once, and everything that refers to it shares one pointer.
+// The process table uses this for program names and keys: all of the
+// running instances of a program share a single copy of its name, and
+// since equal strings always intern to the same pointer, comparing two
+// interned strings is just a pointer comparison.  Interned strings are
+// never freed.  The table only grows with the number of distinct
+// program names seen, which is small even on a long-running system.
+class StringTable
+{
+public:
+	StringTable();
+	~StringTable();
+
+	// Intern a string.  Returns the table's copy, which remains valid
+	// for the lifetime of the table.
+	const TCHAR *Intern(const TCHAR *s) { return Intern(s, _tcslen(s)); }
+	const TCHAR *Intern(const TCHAR *s, size_t len);
+
+	// intern the lower-case version of a string
+	const TCHAR *InternLower(const TCHAR *s);
+
+protected:
+	// hash a string
+	static size_t Hash(const TCHAR *s, size_t len);
+
+	// copy a string into the storage blocks
+	const TCHAR *Store(const TCHAR *s, size_t len);
+
+	// rebuild the hash index at a new size
+	void Rehash(size_t newSize);
+
+	// Hash index.  This uses open addressing with linear probing; each
+	// slot points to a stored string, or is NULL if it's empty.  The
+	// size is always a power of two.
+	std::vector<const TCHAR*> index;
+
+	// number of strings stored
+	size_t count;
+
+	// Storage blocks.  Strings are packed into large blocks rather than
+	// allocated individually.
+	std::vector<TCHAR*> blocks;
+
+	// free space remaining in the current block
+	TCHAR *blockPtr;
+	size_t blockFree;
+};
+
+// global string table
+extern StringTable g_strings;
@@ -0,0 +1,198 @@
+#include "stdafx.h"
+#include "Topology.h"
+
+// Power manager processor information entry, from CallNtPowerInformation
+// (ProcessorInformation).  This is documented, but not declared in the
+// SDK headers.
+struct ProcessorPowerInfo
+{
+	ULONG Number;
+	ULONG MaxMhz;
+	ULONG CurrentMhz;
+	ULONG MhzLimit;
+	ULONG MaxIdleState;
+	ULONG CurrentIdleState;
+};
+
+bool GetCpuTopology(CpuTopology &topo)
+{
+	topo.cores.clear();
+	topo.l3Masks.clear();
+	topo.l2Masks.clear();
+	topo.allMask = 0;
+	topo.smt = false;
+
+	// ask for the buffer size, then get the information
+	DWORD len = 0;
+	GetLogicalProcessorInformationEx(RelationAll, NULL, &len);
+	if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+		return false;
+	std::vector<BYTE> buf(len);
+	if (!GetLogicalProcessorInformationEx(RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buf.data(), &len))
+		return false;
+
+	// collect the group 0 cores and L2 and L3 caches
+	for (DWORD ofs = 0; ofs < len; )
+	{
+		auto info = (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)&buf[ofs];
+		if (info->Relationship == RelationProcessorCore && info->Processor.GroupMask[0].Group == 0)
+		{
+			CpuCore core;
+			core.mask = (DWORD_PTR)info->Processor.GroupMask[0].Mask;
+			core.efficiencyClass = info->Processor.EfficiencyClass;
+			core.maxMhz = 0;
+			core.l3 = -1;
+			core.l2 = -1;
+			topo.cores.push_back(core);
+			topo.allMask |= core.mask;
+			if (CountMaskBits(core.mask) > 1)
+				topo.smt = true;
+		}
+		else if (info->Relationship == RelationCache && info->Cache.Level == 3 && info->Cache.GroupMask.Group == 0)
+		{
+			topo.l3Masks.push_back((DWORD_PTR)info->Cache.GroupMask.Mask);
+		}
+		else if (info->Relationship == RelationCache && info->Cache.Level == 2 && info->Cache.GroupMask.Group == 0)
+		{
+			// Only keep one entry per domain.  Some CPUs report a core's
+			// L2 data and instruction caches separately.
+			DWORD_PTR mask = (DWORD_PTR)info->Cache.GroupMask.Mask;
+			if (std::find(topo.l2Masks.begin(), topo.l2Masks.end(), mask) == topo.l2Masks.end())
+				topo.l2Masks.push_back(mask);
+		}
+		ofs += info->Size;
+	}
+
+	if (topo.cores.size() == 0)
+		return false;
+
+	// put the cores in CPU number order
+	std::sort(topo.cores.begin(), topo.cores.end(),
+		[](const CpuCore &a, const CpuCore &b) { return LowestMaskBit(a.mask) < LowestMaskBit(b.mask); });
+
+	// Get the maximum clock speeds.  The power manager reports one entry
+	// per logical processor; a core's speed is the highest among its
+	// logical processors.
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	std::vector<ProcessorPowerInfo> power(si.dwNumberOfProcessors);
+	if (CallNtPowerInformation(ProcessorInformation, NULL, 0, power.data(),
+		(ULONG)(power.size() * sizeof(ProcessorPowerInfo))) == 0)
+	{
+		for (auto const &pp : power)
+		{
+			if (pp.Number >= sizeof(DWORD_PTR) * 8)
+				continue;
+			DWORD_PTR bit = (DWORD_PTR)1 << pp.Number;
+			for (auto &core : topo.cores)
+			{
+				if ((core.mask & bit) != 0)
+					core.maxMhz = max(core.maxMhz, (DWORD)pp.MaxMhz);
+			}
+		}
+	}
+
+	// if there's no L3 information, treat the whole system as one domain
+	if (topo.l3Masks.size() == 0)
+		topo.l3Masks.push_back(topo.allMask);
+
+	// assign each core to its domain
+	for (auto &core : topo.cores)
+	{
+		for (size_t i = 0; i < topo.l3Masks.size(); ++i)
+		{
+			if ((topo.l3Masks[i] & core.mask) != 0)
+			{
+				core.l3 = (int)i;
+				break;
+			}
+		}
+
+		// a core outside every L3 domain gets one of its own
+		if (core.l3 < 0)
+		{
+			core.l3 = (int)topo.l3Masks.size();
+			topo.l3Masks.push_back(core.mask);
+		}
+
+		// find its L2 domain, if any
+		for (size_t i = 0; i < topo.l2Masks.size(); ++i)
+		{
+			if ((topo.l2Masks[i] & core.mask) != 0)
+			{
+				core.l2 = (int)i;
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
+DWORD_PTR GetActiveProcessorMask()
+{
+	// The group information is a single record, with one fixed-size entry
+	// per processor group, so a small fixed buffer holds it on any system
+	union
+	{
+		SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info;
+		BYTE bytes[4096];
+	} buf;
+	DWORD len = sizeof(buf);
+	if (GetLogicalProcessorInformationEx(RelationGroup, &buf.info, &len) && buf.info.Group.ActiveGroupCount != 0)
+		return (DWORD_PTR)buf.info.Group.GroupInfo[0].ActiveProcessorMask;
+
+	// fall back on the system affinity mask
+	DWORD_PTR procMask, sysMask;
+	if (GetProcessAffinityMask(GetCurrentProcess(), &procMask, &sysMask))
+		return sysMask;
+	return 0;
+}
+
+int CountMaskBits(UINT64 mask)
+{
+	int n = 0;
+	for (; mask != 0; mask &= mask - 1)
+		++n;
+	return n;
+}
+
+DWORD_PTR SelectCores(const CpuTopology &topo, bool fast, int count, DWORD_PTR allowed)
+{
+	// collect the allowed cores
+	std::vector<const CpuCore*> cores;
+	BYTE topClass = 0;
+	for (auto const &core : topo.cores)
+	{
+		if ((core.mask & allowed) == core.mask)
+		{
+			cores.push_back(&core);
+			topClass = max(topClass, core.efficiencyClass);
+		}
+	}
+
+	// rank them, fastest or most efficient first
+	std::stable_sort(cores.begin(), cores.end(), [fast](const CpuCore *a, const CpuCore *b)
+	{
+		if (a->efficiencyClass != b->efficiencyClass)
+			return fast ? a->efficiencyClass > b->efficiencyClass : a->efficiencyClass < b->efficiencyClass;
+		if (a->maxMhz != b->maxMhz)
+			return fast ? a->maxMhz > b->maxMhz : a->maxMhz < b->maxMhz;
+		if (fast)
+			return (b->mask & 1) != 0 && (a->mask & 1) == 0;
+		return false;
+	});
+
+	// take the requested number of cores from the top
+	DWORD_PTR mask = 0;
+	int n = 0;
+	for (auto core : cores)
+	{
+		if (count >= 0 ? n >= count : fast && core->efficiencyClass != topClass)
+			break;
+		mask |= core->mask;
+		++n;
+	}
+
+	return mask;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+// CPU topology.  This describes the physical cores in the system, the
+// logical processors (hyperthreads) in each core, and the L2 and L3
+// cache domains that group the cores.  As with the rest of the program, this
+// only covers processor group 0, which holds all of the processors on
+// systems with up to 64 logical CPUs.
+
+// physical core description
+struct CpuCore
+{
+	// logical processors in the core; more than one bit is set if the
+	// core has SMT (hyperthreading)
+	DWORD_PTR mask;
+
+	// Efficiency class.  On hybrid CPUs, higher-numbered classes are
+	// the faster, less power-efficient cores.  All cores are class 0
+	// on other CPUs.
+	BYTE efficiencyClass;
+
+	// Maximum clock speed, in MHz, as reported by the power manager, or
+	// zero if unknown.  On some hybrid CPUs, and on CPUs with favored
+	// cores, this distinguishes cores within an efficiency class.
+	DWORD maxMhz;
+
+	// index of the core's L3 domain in CpuTopology::l3Masks
+	int l3;
+
+	// Index of the core's L2 domain in CpuTopology::l2Masks, or -1 if
+	// the system doesn't report one.  Most cores have a private L2, but
+	// some (such as the efficiency core clusters on hybrid CPUs) share
+	// one among several cores.
+	int l2;
+};
+
+struct CpuTopology
+{
+	// physical cores, in order of their lowest logical processor number
+	std::vector<CpuCore> cores;
+
+	// L3 cache domains: the logical processors sharing each L3 cache
+	std::vector<DWORD_PTR> l3Masks;
+
+	// L2 cache domains
+	std::vector<DWORD_PTR> l2Masks;
+
+	// all logical processors
+	DWORD_PTR allMask;
+
+	// does any core have more than one logical processor?
+	bool smt;
+};
+
+// Get the CPU topology.  Returns false if the information isn't
+// available.  If the system doesn't report any L3 caches, all of the
+// cores are placed in a single domain.
+bool GetCpuTopology(CpuTopology &topo);
+
+// Get the mask of active logical processors in group 0.  This comes from
+// the system's processor group information, so it reflects processors
+// added to or removed from the running system; if that isn't available,
+// it falls back on the system affinity mask.  This is cheap enough to
+// call on every process list update.
+DWORD_PTR GetActiveProcessorMask();
+
+// Select cores by capacity.  This ranks the cores in 'allowed' by
+// efficiency class and maximum clock speed, and returns the mask of
+// the 'count' fastest (fast == true) or most efficient (fast == false)
+// cores, including all of their logical processors.  Among cores of
+// equal capacity, the fast selection takes core 0 last, since Windows
+// directs more interrupt and system work there; otherwise cores are
+// taken in number order.  count == -1 selects all of the cores in the
+// top efficiency class for a fast selection, or all of the allowed
+// cores for an efficient selection.
+DWORD_PTR SelectCores(const CpuTopology &topo, bool fast, int count, DWORD_PTR allowed);
+
+// count the bits set in a mask
+int CountMaskBits(UINT64 mask);
+
+// get the lowest set bit in a mask
+inline DWORD_PTR LowestMaskBit(DWORD_PTR mask) { return mask & (~mask + 1); }
@@ -0,0 +1,615 @@
+#include "stdafx.h"
+#include "PinAffinity.h"
+#include "Trace.h"
+#include "GroupRules.h"
+#include "StringTable.h"
+#include "Log.h"
+
+// Trace file format.  The file starts with a TraceHeader, followed by
+// a sequence of records.  Each record is a TraceRecord, followed by
+// nameLen WCHARs of name text, with no null terminator.  The fields
+// are all fixed-size, so that 32- and 64-bit builds read and write
+// the same format.
+static const DWORD TRACE_MAGIC = 0x52544150;	// "PATR"
+static const DWORD TRACE_VERSION = 3;
+
+struct TraceHeader
+{
+	// TRACE_MAGIC
+	DWORD magic;
+
+	// TRACE_VERSION
+	DWORD version;
+
+	// system time when recording started; record times are relative to this
+	UINT64 startTime;
+};
+
+// trace record types
+enum TraceRecType
+{
+	TR_TYPE = 1,	// affinity type: arg = type index, mask = affinity mask, name = type name
+	TR_SYSMASK,		// system affinity mask: mask = mask
+	TR_SAVED,		// saved program setting: arg = type (type 0 removes it), name = program name
+	TR_START,		// process start: pid, arg = parent PID, count = threads, session, created, name
+	TR_EXIT,		// process exit: pid, arg = number of the last scan that found it running
+	TR_CLASSIFY,	// individual process classification: pid, arg = type
+	TR_APPLIED,		// affinity the recorded run applied to a new process: pid, mask (0 = none)
+	TR_TREE,		// process tree rule: arg = type index, name = root program key
+	TR_SESSION,		// session rule: arg = type index, session = session ID
+	TR_JOIN,		// process joined its parent's group after starting: pid, arg = parent PID
+	TR_SCAN,		// end of a process list scan with group exits pending: arg = scan number
+};
+
+struct TraceRecord
+{
+	// record type (TraceRecType)
+	BYTE type;
+
+	// reserved; set to zero
+	BYTE reserved;
+
+	// length of the name text following the record, in WCHARs
+	WORD nameLen;
+
+	// time of the event, in milliseconds since the start of the recording
+	DWORD time;
+
+	// process ID
+	DWORD pid;
+
+	// type-specific argument
+	DWORD arg;
+
+	// thread count
+	DWORD count;
+
+	// session ID, or -1 if unknown
+	DWORD session;
+
+	// Process creation time, in milliseconds relative to the start of
+	// the recording.  This is negative for processes that were already
+	// running when the recording started.
+	INT32 created;
+
+	// affinity mask
+	UINT64 mask;
+};
+
+// size of the record buffer to accumulate before writing to the file
+static const size_t TRACE_BUF_SIZE = 65536;
+
+// trace file handle, or INVALID_HANDLE_VALUE if we're not recording
+static HANDLE s_hTrace = INVALID_HANDLE_VALUE;
+
+// record buffer
+static std::vector<BYTE> s_traceBuf;
+
+// recording start time, as a FILETIME value
+static UINT64 s_traceStart;
+
+// get the current system time as a 64-bit FILETIME value
+static UINT64 Now64()
+{
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	return ((UINT64)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+// convert a FILETIME to milliseconds relative to the recording start
+static INT64 TraceTime(UINT64 t)
+{
+	return ((INT64)t - (INT64)s_traceStart) / 10000;
+}
+
+// add a record to the buffer
+static void TraceWrite(TraceRecord &rec, const TCHAR *name = NULL)
+{
+	if (s_hTrace == INVALID_HANDLE_VALUE)
+		return;
+
+	size_t nameLen = name != NULL ? min(_tcslen(name), (size_t)0xFFFF) : 0;
+	rec.nameLen = (WORD)nameLen;
+	rec.time = (DWORD)TraceTime(Now64());
+	const BYTE *p = (const BYTE *)&rec;
+	s_traceBuf.insert(s_traceBuf.end(), p, p + sizeof(rec));
+	if (nameLen != 0)
+		s_traceBuf.insert(s_traceBuf.end(), (const BYTE *)name, (const BYTE *)(name + nameLen));
+
+	if (s_traceBuf.size() >= TRACE_BUF_SIZE)
+		TraceFlush();
+}
+
+bool TraceOpen(const TCHAR *fname, DWORD_PTR sysAffinityMask)
+{
+	s_hTrace = CreateFile(fname, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (s_hTrace == INVALID_HANDLE_VALUE)
+	{
+		LOG_ERROR(_T("Unable to create trace file %s, Windows error %lu"), fname, GetLastError());
+		return false;
+	}
+
+	// write the header
+	s_traceStart = Now64();
+	TraceHeader hdr = { TRACE_MAGIC, TRACE_VERSION, s_traceStart };
+	const BYTE *p = (const BYTE *)&hdr;
+	s_traceBuf.assign(p, p + sizeof(hdr));
+
+	// write the type list and system mask
+	for (size_t i = 0; i < g_procTypes.size(); ++i)
+	{
+		TraceRecord rec = { TR_TYPE };
+		rec.arg = (DWORD)i;
+		rec.mask = g_procTypes[i].affinityMask;
+		TraceWrite(rec, g_procTypes[i].name.c_str());
+	}
+	TraceRecord rec = { TR_SYSMASK };
+	rec.mask = sysAffinityMask;
+	TraceWrite(rec);
+
+	// write the group rules
+	for (size_t i = 0; i < g_procTypes.size(); ++i)
+	{
+		for (auto key : g_procTypes[i].treeRoots)
+		{
+			TraceRecord rule = { TR_TREE };
+			rule.arg = (DWORD)i;
+			TraceWrite(rule, key);
+		}
+		for (auto sid : g_procTypes[i].sessions)
+		{
+			TraceRecord rule = { TR_SESSION };
+			rule.arg = (DWORD)i;
+			rule.session = sid;
+			TraceWrite(rule);
+		}
+	}
+
+	// write the saved program settings
+	for (auto const& s : g_savedProcs)
+		TraceSavedType(s.second.name.c_str(), s.second.iType);
+
+	TraceFlush();
+	return true;
+}
+
+bool TraceIsOpen()
+{
+	return s_hTrace != INVALID_HANDLE_VALUE;
+}
+
+void TraceFlush()
+{
+	if (s_hTrace != INVALID_HANDLE_VALUE && s_traceBuf.size() != 0)
+	{
+		DWORD actual;
+		if (!WriteFile(s_hTrace, s_traceBuf.data(), (DWORD)s_traceBuf.size(), &actual, NULL))
+			LOG_ERROR(_T("Error writing trace file, Windows error %lu"), GetLastError());
+		s_traceBuf.clear();
+	}
+}
+
+void TraceClose()
+{
+	if (s_hTrace != INVALID_HANDLE_VALUE)
+	{
+		TraceFlush();
+		CloseHandle(s_hTrace);
+		s_hTrace = INVALID_HANDLE_VALUE;
+	}
+}
+
+void TraceProcessStart(DWORD pid, DWORD parentPid, DWORD nThreads, FILETIME createTime, DWORD sessionId, const TCHAR *name)
+{
+	TraceRecord rec = { TR_START };
+	rec.pid = pid;
+	rec.arg = parentPid;
+	rec.count = nThreads;
+	rec.session = sessionId;
+	UINT64 ct = ((UINT64)createTime.dwHighDateTime << 32) | createTime.dwLowDateTime;
+	rec.created = ct == 0 ? 0 : (INT32)max(TraceTime(ct), (INT64)INT_MIN);
+	TraceWrite(rec, name);
+}
+
+void TraceProcessExit(DWORD pid, DWORD lastScan)
+{
+	TraceRecord rec = { TR_EXIT };
+	rec.pid = pid;
+	rec.arg = lastScan;
+	TraceWrite(rec);
+}
+
+void TraceScanEnd(DWORD scan)
+{
+	TraceRecord rec = { TR_SCAN };
+	rec.arg = scan;
+	TraceWrite(rec);
+}
+
+void TraceProcessJoin(DWORD pid, DWORD parentPid)
+{
+	TraceRecord rec = { TR_JOIN };
+	rec.pid = pid;
+	rec.arg = parentPid;
+	TraceWrite(rec);
+}
+
+void TraceProcessApplied(DWORD pid, DWORD_PTR affinity)
+{
+	TraceRecord rec = { TR_APPLIED };
+	rec.pid = pid;
+	rec.mask = affinity;
+	TraceWrite(rec);
+}
+
+void TraceSavedType(const TCHAR *name, int iType)
+{
+	TraceRecord rec = { TR_SAVED };
+	rec.arg = (DWORD)iType;
+	TraceWrite(rec, name);
+}
+
+void TraceClassify(DWORD pid, int iType)
+{
+	TraceRecord rec = { TR_CLASSIFY };
+	rec.pid = pid;
+	rec.arg = (DWORD)iType;
+	TraceWrite(rec);
+}
+
+// Replay state for one process
+struct ReplayProc
+{
+	// process name and saved settings key
+	TSTRING name;
+	TSTRING key;
+
+	// individual type assignment, or -1 if none
+	int pinnedType;
+
+	// group type, or -1 if it isn't in a group
+	int groupType;
+
+	// our affinity decision for the process, or zero if we leave it alone
+	DWORD_PTR mask;
+
+	// start time, in trace milliseconds
+	DWORD startTime;
+
+	// creation time, as recorded (trace milliseconds, or 0 if unknown)
+	INT32 created;
+};
+
+// get a type name for the report
+static const TCHAR *ReplayTypeName(int iType)
+{
+	return iType < 0 ? _T("(none)") : iType < (int)g_procTypes.size() ? g_procTypes[iType].name.c_str() : _T("(invalid)");
+}
+
+// Get a replayed process's parent's group and creation time, from the
+// replayed processes if the parent is running, otherwise from the recent
+// group exits, the same way the live run does (see GroupTypeFromTable())
+static void ReplayParentGroup(const std::unordered_map<DWORD, ReplayProc> &procs,
+	DWORD parentPid, INT64 created, int &parentGroup, INT64 &parentStart)
+{
+	parentGroup = -1;
+	parentStart = 0;
+	auto itparent = procs.find(parentPid);
+	if (itparent != procs.end())
+	{
+		parentGroup = itparent->second.groupType;
+		parentStart = itparent->second.created;
+	}
+	if (parentPid != 0 && (itparent == procs.end() || (created != 0 && parentStart > created)))
+		FindGroupExit(parentPid, parentGroup, parentStart);
+}
+
+int RunReplay(const TCHAR *traceFile, const TCHAR *reportFile)
+{
+	// read the whole trace file into memory
+	std::vector<BYTE> data;
+	FILE *fp;
+	if (_tfopen_s(&fp, traceFile, _T("rb")) != 0)
+	{
+		LOG_ERROR(_T("Unable to open trace file %s"), traceFile);
+		return -1;
+	}
+	fseek(fp, 0, SEEK_END);
+	data.resize((size_t)ftell(fp));
+	fseek(fp, 0, SEEK_SET);
+	size_t nRead = data.size() != 0 ? fread(&data[0], 1, data.size(), fp) : 0;
+	fclose(fp);
+
+	// check the header
+	const TraceHeader *hdr = (const TraceHeader *)data.data();
+	if (nRead != data.size() || data.size() < sizeof(TraceHeader)
+		|| hdr->magic != TRACE_MAGIC || hdr->version != TRACE_VERSION)
+	{
+		LOG_ERROR(_T("%s is not a valid PinAffinity trace file"), traceFile);
+		return -1;
+	}
+
+	// open the report file
+	TSTRING defReport;
+	if (reportFile == NULL)
+	{
+		defReport = traceFile;
+		defReport += _T(".txt");
+		reportFile = defReport.c_str();
+	}
+	FILE *out;
+	if (_tfopen_s(&out, reportFile, _T("w")) != 0)
+	{
+		LOG_ERROR(_T("Unable to create replay report file %s"), reportFile);
+		return -1;
+	}
+
+	// Replay under the recorded configuration, starting from scratch
+	g_procTypes.clear();
+	g_savedProcs.clear();
+	GroupRulesInit();
+	ClearGroupExits();
+	DWORD_PTR sysMask = ~(DWORD_PTR)0;
+	std::unordered_map<DWORD, ReplayProc> procs;
+	std::unordered_map<DWORD, int> pending;
+
+	// statistics
+	DWORD nRecords = 0, nStarts = 0, nApplied = 0, nMismatches = 0, lastTime = 0;
+	size_t maxProcs = 0;
+	ULONG64 totalCycles = 0;
+
+	// run through the records
+	HANDLE hThread = GetCurrentThread();
+	for (size_t ofs = sizeof(TraceHeader); ofs + sizeof(TraceRecord) <= data.size(); )
+	{
+		// get the record and its name
+		const TraceRecord *rec = (const TraceRecord *)&data[ofs];
+		ofs += sizeof(TraceRecord);
+		if (ofs + rec->nameLen * sizeof(WCHAR) > data.size())
+			break;
+		TSTRING name((const TCHAR *)&data[ofs], rec->nameLen);
+		ofs += rec->nameLen * sizeof(WCHAR);
+		++nRecords;
+		lastTime = rec->time;
+
+		// figure the virtual time for the report
+		double t = rec->time / 1000.0;
+
+		// Process the record.  We only count the cost of the decision
+		// logic itself, not the report formatting.
+		ULONG64 c0, c1;
+		QueryThreadCycleTime(hThread, &c0);
+		switch (rec->type)
+		{
+		case TR_TYPE:
+			g_procTypes.emplace_back(name.c_str(), (DWORD_PTR)rec->mask);
+			QueryThreadCycleTime(hThread, &c1);
+			_ftprintf(out, _T("[%10.3f] type %lu: %s = %016I64X\n"), t, rec->arg, name.c_str(), rec->mask);
+			break;
+
+		case TR_SYSMASK:
+			sysMask = (DWORD_PTR)rec->mask;
+			QueryThreadCycleTime(hThread, &c1);
+			_ftprintf(out, _T("[%10.3f] system affinity mask %016I64X\n"), t, rec->mask);
+			break;
+
+		case TR_TREE:
+		case TR_SESSION:
+			// add the group rule to its type, and rebuild the rule tables
+			if (rec->arg < g_procTypes.size())
+			{
+				if (rec->type == TR_TREE)
+					g_procTypes[rec->arg].treeRoots.push_back(g_strings.InternLower(name.c_str()));
+				else
+					g_procTypes[rec->arg].sessions.push_back(rec->session);
+				GroupRulesInit();
+			}
+			QueryThreadCycleTime(hThread, &c1);
+			if (rec->type == TR_TREE)
+				_ftprintf(out, _T("[%10.3f] group rule: %s tree -> %s\n"), t, name.c_str(), ReplayTypeName((int)rec->arg));
+			else
+				_ftprintf(out, _T("[%10.3f] group rule: session %lu -> %s\n"), t, rec->session, ReplayTypeName((int)rec->arg));
+			break;
+
+		case TR_SAVED:
+			{
+				// update the saved settings
+				int iType = (int)rec->arg;
+				TSTRING key = name;
+				std::transform(key.begin(), key.end(), key.begin(), ::_totlower);
+				if (iType == 0)
+					g_savedProcs.erase(key);
+				else
+				{
+					auto it = g_savedProcs.emplace(
+						std::piecewise_construct,
+						std::forward_as_tuple(key.c_str()),
+						std::forward_as_tuple(name.c_str(), iType));
+					it.first->second.iType = iType;
+				}
+
+				// Re-apply to running instances that follow the saved settings.
+				// When the setting is removed, group members go back to their
+				// groups' types.
+				int n = 0;
+				DWORD_PTR mask = ProposedAffinity(iType, sysMask);
+				for (auto& p : procs)
+				{
+					if (p.second.key == key && p.second.pinnedType < 0)
+					{
+						int procType = iType == 0 && p.second.groupType >= 0 ? p.second.groupType : iType;
+						p.second.mask = ProposedAffinity(procType, sysMask);
+						++n;
+					}
+				}
+				QueryThreadCycleTime(hThread, &c1);
+
+				_ftprintf(out, _T("[%10.3f] saved setting: %s -> %s; %d running instance(s) set to %016I64X\n"),
+					t, name.c_str(), ReplayTypeName(iType), n, (UINT64)mask);
+			}
+			break;
+
+		case TR_START:
+			{
+				// apply any pending individual classification
+				int pinnedType = -1;
+				auto itpending = pending.find(rec->pid);
+				if (itpending != pending.end())
+				{
+					pinnedType = itpending->second;
+					pending.erase(itpending);
+				}
+
+				// Figure its group, taking the parent's group from the
+				// replayed processes, or from the recent group exits, the
+				// same way the live run takes it from the process table
+				const TCHAR *key = g_strings.InternLower(name.c_str());
+				int parentGroup;
+				INT64 parentStart;
+				ReplayParentGroup(procs, rec->arg, rec->created, parentGroup, parentStart);
+				int groupType = GroupTypeForProcess(key, parentGroup, parentStart, rec->created, rec->session);
+
+				// classify the process and figure its affinity
+				int iType = NewProcessType(key, pinnedType, groupType);
+				DWORD_PTR mask = ProposedAffinity(iType, sysMask);
+				procs[rec->pid] = { name, key, pinnedType, groupType, mask, rec->time, rec->created };
+				QueryThreadCycleTime(hThread, &c1);
+
+				++nStarts;
+				maxProcs = max(maxProcs, procs.size());
+				if (iType >= 0)
+					++nApplied;
+
+				// Report it.  For processes started during the recording,
+				// include the delay between creation and our decision,
+				// which is how long the process ran with its original
+				// affinity.
+				_ftprintf(out, _T("[%10.3f] start PID %lu %s (parent %lu, %lu threads)"),
+					t, rec->pid, name.c_str(), rec->arg, rec->count);
+				if (rec->created > 0)
+					_ftprintf(out, _T(", %lu ms after creation"), rec->time - (DWORD)rec->created);
+				if (iType >= 0)
+					_ftprintf(out, _T(" -> %s, apply %016I64X\n"), ReplayTypeName(iType), (UINT64)mask);
+				else
+					_ftprintf(out, _T(" -> not classified, left alone\n"));
+			}
+			break;
+
+		case TR_APPLIED:
+			{
+				// compare the recorded run's result with our decision
+				auto it = procs.find(rec->pid);
+				DWORD_PTR mask = it != procs.end() ? it->second.mask : 0;
+				QueryThreadCycleTime(hThread, &c1);
+				if (mask != (DWORD_PTR)rec->mask)
+				{
+					++nMismatches;
+					_ftprintf(out, _T("[%10.3f] MISMATCH PID %lu: replay decided %016I64X, recorded run applied %016I64X%s\n"),
+						t, rec->pid, (UINT64)mask, rec->mask,
+						rec->mask == 0 ? _T(" (the recorded run couldn't change it)") : _T(""));
+				}
+			}
+			break;
+
+		case TR_JOIN:
+			{
+				// a process found its parent after starting - join the
+				// parent's group, if it's in one
+				auto it = procs.find(rec->pid);
+				int iType = -1;
+				DWORD_PTR mask = 0;
+				if (it != procs.end())
+				{
+					ReplayProc &p = it->second;
+					int parentGroup;
+					INT64 parentStart;
+					ReplayParentGroup(procs, rec->arg, p.created, parentGroup, parentStart);
+					int groupType = GroupTypeForProcess(g_strings.Intern(p.key.c_str()),
+						parentGroup, parentStart, p.created, (DWORD)-1);
+					if (groupType >= 0)
+						p.groupType = groupType;
+					iType = NewProcessType(p.key.c_str(), p.pinnedType, p.groupType);
+					p.mask = mask = ProposedAffinity(iType, sysMask);
+				}
+				QueryThreadCycleTime(hThread, &c1);
+
+				_ftprintf(out, _T("[%10.3f] PID %lu joins the group of parent %lu -> %s, apply %016I64X\n"),
+					t, rec->pid, rec->arg, ReplayTypeName(iType), (UINT64)mask);
+			}
+			break;
+
+		case TR_CLASSIFY:
+			{
+				int iType = (int)rec->arg;
+				auto it = procs.find(rec->pid);
+				DWORD_PTR mask = 0;
+				if (it != procs.end())
+				{
+					// already running - reclassify it now
+					it->second.pinnedType = iType;
+					it->second.mask = mask = ProposedAffinity(iType, sysMask);
+				}
+				else
+				{
+					// not seen yet - apply it when it starts
+					pending[rec->pid] = iType;
+				}
+				QueryThreadCycleTime(hThread, &c1);
+
+				if (it != procs.end())
+					_ftprintf(out, _T("[%10.3f] classify PID %lu -> %s, apply %016I64X\n"),
+						t, rec->pid, ReplayTypeName(iType), (UINT64)mask);
+				else
+					_ftprintf(out, _T("[%10.3f] classify PID %lu -> %s, pending start\n"),
+						t, rec->pid, ReplayTypeName(iType));
+			}
+			break;
+
+		case TR_EXIT:
+			{
+				auto it = procs.find(rec->pid);
+				DWORD startTime = it != procs.end() ? it->second.startTime : 0;
+				bool found = it != procs.end();
+				if (found)
+				{
+					// keep a group member's group for its children, as the
+					// live run does
+					if (it->second.groupType >= 0)
+						NoteGroupExit(rec->pid, it->second.groupType, it->second.created, rec->arg);
+					procs.erase(it);
+				}
+				QueryThreadCycleTime(hThread, &c1);
+
+				if (found)
+					_ftprintf(out, _T("[%10.3f] exit PID %lu after %.3f s\n"),
+						t, rec->pid, (rec->time - startTime) / 1000.0);
+			}
+			break;
+
+		case TR_SCAN:
+			ExpireGroupExits(rec->arg);
+			QueryThreadCycleTime(hThread, &c1);
+			break;
+
+		default:
+			QueryThreadCycleTime(hThread, &c1);
+			_ftprintf(out, _T("[%10.3f] unknown record type %d\n"), t, rec->type);
+			break;
+		}
+		totalCycles += c1 - c0;
+	}
+
+	// write the summary
+	_ftprintf(out, _T("\nSummary\n")
+		_T("  Recorded time:         %.3f s\n")
+		_T("  Records:               %lu\n")
+		_T("  Processes started:     %lu (%lu classified)\n")
+		_T("  Peak process count:    %lu\n")
+		_T("  Mismatched decisions:  %lu\n")
+		_T("  Decision CPU cost:     %I64u cycles (%.0f cycles per record)\n"),
+		lastTime / 1000.0, nRecords, nStarts, nApplied, (DWORD)maxProcs, nMismatches,
+		totalCycles, nRecords != 0 ? (double)totalCycles / nRecords : 0.0);
+	fclose(out);
+
+	return nMismatches != 0 ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+// Process event tracing.
+//
+// "PinAffinity /Record:<file>" runs normally, and also writes a compact
+// binary trace of everything that drives our classification decisions:
+// the type list and its group rules, the saved program settings and any
+// changes to them, process starts (with name, parent, thread count,
+// creation time, and session) and exits, the ends of the process list
+// scans that affect group decisions, individual process
+// classifications, processes joining their parents' groups late (when
+// the parent turns up later in the same process list), and the affinity
+// we actually applied to each new process.
+//
+// "PinAffinity /Replay:<file> [/Report:<file>]" feeds a recorded trace
+// back through the same classification logic, without touching any
+// real processes, and writes a text report of every classification
+// and affinity decision, noting any that differ from what the recorded
+// run applied, along with the processing cost.  The report defaults
+// to the trace file name with ".txt" appended.  A trace captured on a
+// user's machine thus becomes a reproducible test case for problems
+// like a program being pinned late or not at all.
+
+// Start recording to the given file.  Call this after loading the
+// process types and saved settings, so that the trace starts with a
+// snapshot of them.  Returns false if the file can't be created.
+// The system affinity mask is recorded too, since it limits the masks
+// we can apply.
+bool TraceOpen(const TCHAR *fname, DWORD_PTR sysAffinityMask);
+
+// flush and close the trace file
+void TraceClose();
+
+// is a trace being recorded?
+bool TraceIsOpen();
+
+// Flush buffered records to the file.  The main loop calls this after
+// each process list update pass.
+void TraceFlush();
+
+// Record events.  These do nothing if no trace is being recorded.
+void TraceProcessStart(DWORD pid, DWORD parentPid, DWORD nThreads, FILETIME createTime, DWORD sessionId, const TCHAR *name);
+void TraceProcessExit(DWORD pid, DWORD lastScan);
+void TraceScanEnd(DWORD scan);
+void TraceProcessJoin(DWORD pid, DWORD parentPid);
+void TraceProcessApplied(DWORD pid, DWORD_PTR affinity);
+void TraceSavedType(const TCHAR *name, int iType);
+void TraceClassify(DWORD pid, int iType);
+
+// Replay a trace, writing the report to the given file (or NULL for
+// the default).  Returns the process exit code: 0 if the replay matched
+// the recorded decisions, 1 if any differed, -1 on error.
+int RunReplay(const TCHAR *traceFile, const TCHAR *reportFile);
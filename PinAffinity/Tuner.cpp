@@ -0,0 +1,347 @@
+#include "stdafx.h"
+#include <time.h>
+#include "PinAffinity.h"
+#include "ProcessList.h"
+#include "Topology.h"
+#include "Tuner.h"
+#include "Log.h"
+
+// maximum number of cores to reserve in a candidate partition
+static const int TUNE_MAX_RESERVED = 6;
+
+// latency probe timer period, in microseconds
+static const DWORD PROBE_PERIOD_US = 1000;
+
+// candidate partition and its results
+struct TuneTrial
+{
+	// description for the report
+	TSTRING desc;
+
+	// reserved (pinball) CPUs
+	DWORD_PTR reserved;
+
+	// housekeeping CPUs, for all other processes
+	DWORD_PTR housekeeping;
+
+	// wakeup latency percentiles, in microseconds
+	double p50, p90, p99, pMax;
+
+	// number of latency samples collected
+	size_t nSamples;
+};
+
+// Enumerate the candidate partitions.  CPU 0 always stays with the
+// housekeeping set, since Windows handles a lot of its own work there.
+static void EnumTrials(const CpuTopology &topo, std::vector<TuneTrial> &trials)
+{
+	int nCores = (int)topo.cores.size();
+	int maxReserved = min(TUNE_MAX_RESERVED, nCores - 1);
+	for (int d = 0; d < (int)topo.l3Masks.size(); ++d)
+	{
+		for (int k = 1; k <= maxReserved; ++k)
+		{
+			for (int idleSiblings = 0; idleSiblings < (topo.smt ? 2 : 1); ++idleSiblings)
+			{
+				// take the first k cores in the domain, skipping core 0
+				DWORD_PTR reserved = 0, idle = 0;
+				int n = 0;
+				for (int c = 1; c < nCores && n < k; ++c)
+				{
+					if (topo.cores[c].l3 == d)
+					{
+						// with idle siblings, reserve the core's first
+						// logical CPU and leave the rest unused
+						DWORD_PTR m = topo.cores[c].mask;
+						DWORD_PTR r = idleSiblings ? LowestMaskBit(m) : m;
+						reserved |= r;
+						idle |= m & ~r;
+						++n;
+					}
+				}
+
+				// stop if the domain doesn't have enough cores
+				if (n < k)
+					break;
+
+				// skip it if it leaves nothing for housekeeping, or if
+				// we already have the same partition
+				DWORD_PTR housekeeping = topo.allMask & ~reserved & ~idle;
+				if (housekeeping == 0)
+					continue;
+				bool dup = false;
+				for (auto const &t : trials)
+					dup |= (t.reserved == reserved && t.housekeeping == housekeeping);
+				if (dup)
+					continue;
+
+				TCHAR desc[128];
+				_stprintf_s(desc, _T("%d core%s from L3 domain %d%s"), k, k == 1 ? _T("") : _T("s"), d,
+					!topo.smt ? _T("") : idleSiblings ? _T(", SMT siblings idle") : _T(", SMT siblings used"));
+				trials.push_back({ desc, reserved, housekeeping, 0, 0, 0, 0, 0 });
+			}
+		}
+	}
+}
+
+// Move all other processes to the given CPUs.  The first time we see
+// each process, we save its original affinity in the map.
+static void ApplyPartition(DWORD_PTR mask, std::unordered_map<DWORD, DWORD_PTR> &orig)
+{
+	std::vector<ProcessDesc> procs;
+	GetProcessList(procs);
+	DWORD self = GetCurrentProcessId();
+	for (auto const &p : procs)
+	{
+		if (p.pid == 0 || p.pid == self)
+			continue;
+
+		HandleHolder hProc = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_SET_INFORMATION, FALSE, p.pid);
+		DWORD_PTR cur, sys;
+		if (hProc == NULL || !GetProcessAffinityMask(hProc, &cur, &sys))
+			continue;
+
+		orig.emplace(p.pid, cur);
+		if ((mask & sys) != 0)
+			SetProcessAffinityMask(hProc, mask & sys);
+	}
+}
+
+// restore the affinities saved by ApplyPartition()
+static void RestorePartition(const std::unordered_map<DWORD, DWORD_PTR> &orig)
+{
+	for (auto const &p : orig)
+	{
+		HandleHolder hProc = OpenProcess(PROCESS_SET_INFORMATION, FALSE, p.first);
+		if (hProc == NULL || !SetProcessAffinityMask(hProc, p.second))
+			LOG_DEBUG(_T("/Tune: unable to restore affinity for PID %lu, Windows error %lu"), p.first, GetLastError());
+	}
+}
+
+// latency probe thread context
+struct ProbeContext
+{
+	// the CPU to run on
+	DWORD_PTR cpu;
+
+	// how long to run, in milliseconds
+	DWORD durationMs;
+
+	// wakeup latency samples, in microseconds
+	std::vector<double> samples;
+};
+
+// Latency probe thread.  This repeatedly sleeps on a high-resolution
+// timer for one period, and measures how much later than requested
+// it actually wakes up.  That's the same path a game's threads take
+// when they wait for the next frame or the next input event.
+static DWORD WINAPI ProbeThread(LPVOID param)
+{
+	ProbeContext *ctx = (ProbeContext *)param;
+	SetThreadAffinityMask(GetCurrentThread(), ctx->cpu);
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+	// use a high-resolution timer if available (Windows 10 1803 and later)
+	HANDLE hTimer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (hTimer == NULL)
+		hTimer = CreateWaitableTimer(NULL, FALSE, NULL);
+	if (hTimer == NULL)
+		return 0;
+
+	LARGE_INTEGER freq, t0, t1, end;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&end);
+	end.QuadPart += freq.QuadPart * ctx->durationMs / 1000;
+	ctx->samples.reserve(ctx->durationMs * 1000 / PROBE_PERIOD_US);
+	for (;;)
+	{
+		QueryPerformanceCounter(&t0);
+		if (t0.QuadPart >= end.QuadPart)
+			break;
+
+		LARGE_INTEGER due;
+		due.QuadPart = -(LONGLONG)PROBE_PERIOD_US * 10;
+		SetWaitableTimer(hTimer, &due, 0, NULL, NULL, FALSE);
+		WaitForSingleObject(hTimer, INFINITE);
+		QueryPerformanceCounter(&t1);
+
+		double us = (double)(t1.QuadPart - t0.QuadPart) * 1.0e6 / (double)freq.QuadPart - PROBE_PERIOD_US;
+		ctx->samples.push_back(max(us, 0.0));
+	}
+
+	CloseHandle(hTimer);
+	return 0;
+}
+
+// get a percentile from a sorted sample list
+static double Percentile(const std::vector<double> &sorted, double pct)
+{
+	if (sorted.size() == 0)
+		return 0.0;
+	size_t i = (size_t)(pct / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[min(i, sorted.size() - 1)];
+}
+
+// run one trial
+static void RunTrial(TuneTrial &trial, DWORD trialMs, const TCHAR *workloadCmd,
+	std::unordered_map<DWORD, DWORD_PTR> &orig)
+{
+	// move everything else out of the way
+	ApplyPartition(trial.housekeeping, orig);
+
+	// start the workload on the reserved CPUs
+	PROCESS_INFORMATION pi;
+	ZeroMemory(&pi, sizeof(pi));
+	if (workloadCmd != NULL)
+	{
+		TSTRING cmd = workloadCmd;
+		STARTUPINFO si;
+		ZeroMemory(&si, sizeof(si));
+		si.cb = sizeof(si);
+		if (CreateProcess(NULL, &cmd[0], NULL, NULL, FALSE, CREATE_SUSPENDED, NULL, NULL, &si, &pi))
+		{
+			SetProcessAffinityMask(pi.hProcess, trial.reserved);
+			ResumeThread(pi.hThread);
+			CloseHandle(pi.hThread);
+		}
+		else
+			LOG_ERROR(_T("/Tune: unable to launch workload %s, Windows error %lu"), workloadCmd, GetLastError());
+	}
+
+	// run a probe thread on each reserved CPU
+	std::vector<ProbeContext> ctx;
+	for (DWORD_PTR m = trial.reserved; m != 0; m &= m - 1)
+		ctx.push_back({ LowestMaskBit(m), trialMs });
+	std::vector<HANDLE> threads;
+	for (auto &c : ctx)
+	{
+		HANDLE h = CreateThread(NULL, 0, ProbeThread, &c, 0, NULL);
+		if (h != NULL)
+			threads.push_back(h);
+	}
+	if (threads.size() != 0)
+		WaitForMultipleObjects((DWORD)threads.size(), threads.data(), TRUE, INFINITE);
+	for (auto h : threads)
+		CloseHandle(h);
+
+	// stop the workload
+	if (pi.hProcess != NULL)
+	{
+		TerminateProcess(pi.hProcess, 0);
+		CloseHandle(pi.hProcess);
+	}
+
+	// collect the results
+	std::vector<double> samples;
+	for (auto const &c : ctx)
+		samples.insert(samples.end(), c.samples.begin(), c.samples.end());
+	std::sort(samples.begin(), samples.end());
+	trial.nSamples = samples.size();
+	trial.p50 = Percentile(samples, 50);
+	trial.p90 = Percentile(samples, 90);
+	trial.p99 = Percentile(samples, 99);
+	trial.pMax = samples.size() != 0 ? samples.back() : 0.0;
+}
+
+int RunTuner(DWORD trialSeconds, const TCHAR *workloadCmd)
+{
+	// the main instance would fight us over the affinities
+	if (FindWindowEx(0, 0, g_szWindowClass, 0) != NULL)
+	{
+		ErrorBox(IDS_ERR_TUNE_RUNNING);
+		return -1;
+	}
+
+	// get the topology and the candidate partitions
+	CpuTopology topo;
+	std::vector<TuneTrial> trials;
+	if (GetCpuTopology(topo))
+		EnumTrials(topo, trials);
+	if (trials.size() == 0)
+	{
+		ErrorBox(IDS_ERR_TUNE_NO_TRIALS);
+		return -1;
+	}
+
+	// run the trials
+	std::unordered_map<DWORD, DWORD_PTR> orig;
+	for (size_t i = 0; i < trials.size(); ++i)
+	{
+		LOG_INFO(_T("/Tune: trial %lu of %lu: %s"), (DWORD)(i + 1), (DWORD)trials.size(), trials[i].desc.c_str());
+		RunTrial(trials[i], trialSeconds * 1000, workloadCmd, orig);
+	}
+
+	// put everything back the way we found it
+	RestorePartition(orig);
+
+	// Pick the best: lowest 99th percentile latency, since the worst
+	// wakeups are the ones that cause visible stutter, then lowest median.
+	size_t best = 0;
+	for (size_t i = 1; i < trials.size(); ++i)
+	{
+		if (trials[i].p99 < trials[best].p99
+			|| (trials[i].p99 == trials[best].p99 && trials[i].p50 < trials[best].p50))
+			best = i;
+	}
+	const TuneTrial &b = trials[best];
+
+	// pick an unused type name
+	TCHAR typeName[32] = _T("Tuned");
+	for (int n = 2; FindProcType(typeName) >= 0; ++n)
+		_stprintf_s(typeName, _T("Tuned%d"), n);
+
+	// get today's date for the comments
+	time_t now = time(NULL);
+	struct tm tmNow;
+	localtime_s(&tmNow, &now);
+	TCHAR date[32];
+	_tcsftime(date, countof(date), _T("%Y-%m-%d %H:%M"), &tmNow);
+
+	// add the best layout to the type list
+	TCHAR fname[MAX_PATH];
+	GetAppFilePath(fname, _T("AffinityTypes.txt"));
+	FILE *fp;
+	if (_tfopen_s(&fp, fname, _T("a")) == 0)
+	{
+		_ftprintf(fp, _T("\n# Added by PinAffinity /Tune on %s: %s\n")
+			_T("# Wakeup latency: median %.0f us, 99th percentile %.0f us.  For best results,\n")
+			_T("# set the default (first) type to the remaining CPUs, %016I64X.\n")
+			_T("%s:%016I64X\n"),
+			date, b.desc.c_str(), b.p50, b.p99, (UINT64)b.housekeeping, typeName, (UINT64)b.reserved);
+		fclose(fp);
+	}
+	else
+		LOG_ERROR(_T("/Tune: unable to update %s"), fname);
+
+	// write the report
+	TCHAR reportFile[MAX_PATH];
+	GetAppFilePath(reportFile, _T("PinAffinity-Tune.txt"));
+	if (_tfopen_s(&fp, reportFile, _T("w")) == 0)
+	{
+		_ftprintf(fp, _T("PinAffinity partition tuning, %s\n")
+			_T("%lu cores, %d logical CPUs, %lu L3 domain(s), SMT %s\n")
+			_T("Trial period %lu s, workload: %s\n\n"),
+			date, (DWORD)topo.cores.size(), CountMaskBits(topo.allMask), (DWORD)topo.l3Masks.size(),
+			topo.smt ? _T("on") : _T("off"), trialSeconds, workloadCmd != NULL ? workloadCmd : _T("(probe only)"));
+		_ftprintf(fp, _T("   Reserved          Housekeeping      p50 us  p90 us  p99 us  max us  Samples  Layout\n"));
+		for (size_t i = 0; i < trials.size(); ++i)
+		{
+			const TuneTrial &t = trials[i];
+			_ftprintf(fp, _T("%c  %016I64X  %016I64X  %6.0f  %6.0f  %6.0f  %6.0f  %7lu  %s\n"),
+				i == best ? '*' : ' ', (UINT64)t.reserved, (UINT64)t.housekeeping,
+				t.p50, t.p90, t.p99, t.pMax, (DWORD)t.nSamples, t.desc.c_str());
+		}
+		_ftprintf(fp, _T("\n* Best layout, added to AffinityTypes.txt as type %s\n"), typeName);
+		fclose(fp);
+	}
+	else
+		LOG_ERROR(_T("/Tune: unable to write %s"), reportFile);
+
+	// let the user know we're done
+	TCHAR fmt[512], msg[1024], title[128];
+	LoadString(g_hInst, IDS_TUNE_DONE, fmt, countof(fmt));
+	LoadString(g_hInst, IDS_APP_TITLE, title, countof(title));
+	_stprintf_s(msg, fmt, typeName, reportFile);
+	MessageBox(0, msg, title, MB_OK | MB_ICONINFORMATION);
+	return 0;
+}
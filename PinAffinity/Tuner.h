@@ -0,0 +1,19 @@
+#pragma once
+
+// Partition tuner.  "PinAffinity /Tune[:<seconds>] [-- <command line>]"
+// searches for the best way to divide the CPUs between pinball and
+// everything else on this particular system.  It enumerates candidate
+// partitions from the CPU topology (how many cores to reserve, whether
+// to leave the reserved cores' hyperthread siblings idle, and which L3
+// cache domain to take them from), and for each one, it moves all
+// other processes to the remaining CPUs, runs a wakeup latency probe
+// on the reserved CPUs for the trial period (along with the given
+// workload program, if any, pinned to the same CPUs), and collects
+// the latency percentiles.  When it's done, it restores the original
+// affinities, adds the best partition to AffinityTypes.txt as a new
+// type, and writes a report of all of the trials.  Returns the process
+// exit code.
+int RunTuner(DWORD trialSeconds, const TCHAR *workloadCmd);
+
+// default trial period, in seconds
+const DWORD TUNE_DEFAULT_TRIAL_SECONDS = 10;
@@ -0,0 +1,189 @@
+#include "stdafx.h"
+#include "UiChanges.h"
+#include "ProcessTable.h"
+#include "StringTable.h"
+#include "SortedView.h"
+
+UiChangeSet g_uiChanges;
+bool g_uiLive = false;
+
+void MarkProcessChanged(int slot)
+{
+	ProcListItem &proc = g_procTable.item[slot];
+	if (g_uiLive && !proc.dirty)
+	{
+		proc.dirty = true;
+		g_uiChanges.procs.push_back(g_procTable.pid[slot]);
+	}
+}
+
+void MarkRowAdded(ListViewData *lvd)
+{
+	g_uiChanges.added.push_back(lvd);
+}
+
+void MarkRowRemoved(ListViewData *lvd)
+{
+	lvd->processDeleted = true;
+	g_uiChanges.removed.push_back(lvd);
+}
+
+void MarkSavedChanged(SavedProc &saved)
+{
+	if (g_uiLive && !saved.queued)
+	{
+		saved.queued = true;
+		g_uiChanges.saved.push_back(g_strings.Intern(saved.key.c_str()));
+	}
+}
+
+// Add a placeholder row for a saved program with no running instances
+static void AddPlaceholderRow(const UiViewHooks &hooks, SavedProc &sp)
+{
+	ListViewData *data = new ListViewData(0, g_strings.Intern(sp.name.c_str()),
+		g_strings.Intern(sp.key.c_str()), &sp, sp.iType, { 0, 0 });
+	hooks.FillPlaceholderRow(sp, data);
+	g_sortedView.Insert(data);
+	sp.placeholder = data;
+}
+
+// Remove a row from the view and delete it
+static void DeleteRow(const UiViewHooks &hooks, ListViewData *data)
+{
+	g_sortedView.Remove(data);
+	hooks.RowDeleted(data);
+	delete data;
+}
+
+bool ApplyUiChangeSet(const UiViewHooks &hooks)
+{
+	if (g_uiChanges.Empty())
+		return false;
+
+	// Add the rows for new processes.  Skip any that have already
+	// exited; their rows are in the removed list, which we do next.
+	for (auto data : g_uiChanges.added)
+	{
+		if (!data->processDeleted)
+			g_sortedView.Insert(data);
+	}
+
+	// delete the rows of processes that have exited, and of deleted
+	// saved programs
+	for (auto data : g_uiChanges.removed)
+		DeleteRow(hooks, data);
+
+	// update the saved programs' placeholder rows
+	for (auto key : g_uiChanges.saved)
+	{
+		// if the entry has been deleted since, there's nothing to do
+		auto it = g_savedProcs.find(key);
+		if (it == g_savedProcs.end())
+			continue;
+
+		SavedProc &sp = it->second;
+		sp.queued = false;
+		if (sp.numInstances != 0 && sp.placeholder != NULL)
+		{
+			// it has running instances, so it no longer needs a placeholder
+			DeleteRow(hooks, sp.placeholder);
+			sp.placeholder = NULL;
+		}
+		else if (sp.numInstances == 0 && sp.placeholder == NULL)
+		{
+			// nothing's running, so it needs a placeholder
+			AddPlaceholderRow(hooks, sp);
+		}
+		else if (sp.placeholder != NULL && sp.dirty)
+		{
+			// update the type and affinity
+			sp.placeholder->iType = sp.iType;
+			hooks.FillPlaceholderRow(sp, sp.placeholder);
+			g_sortedView.Reposition(sp.placeholder);
+		}
+		sp.dirty = false;
+	}
+
+	// refresh the rows of processes that changed
+	for (auto pid : g_uiChanges.procs)
+	{
+		// Skip processes that have exited since, and duplicates (which
+		// we'll have already cleaned).  A duplicate can only come from
+		// a PID that was reused by a new process since the last update.
+		int slot = g_procTable.Find(pid);
+		if (slot < 0)
+			continue;
+		ProcListItem &proc = g_procTable.item[slot];
+		if (!proc.dirty || proc.lvd == NULL)
+			continue;
+
+		// refresh the row, move it if its sort position changed, and
+		// mark it as clean
+		hooks.FillProcessRow(slot);
+		g_sortedView.Reposition(proc.lvd);
+		proc.dirty = false;
+	}
+
+	g_uiChanges.Clear();
+	return true;
+}
+
+void TearDownViewModel(const UiViewHooks &hooks)
+{
+	// Delete the rows of pending additions that are still running.
+	// The ones that have exited are in the removed list too.
+	for (auto data : g_uiChanges.added)
+	{
+		if (!data->processDeleted)
+			delete data;
+	}
+	for (auto data : g_uiChanges.removed)
+		DeleteRow(hooks, data);
+	g_uiChanges.Clear();
+
+	// delete the rows in the view
+	g_sortedView.ForEach([&hooks](ListViewData *data) { hooks.RowDeleted(data); delete data; });
+	g_sortedView.Clear();
+
+	// detach the processes and saved programs from their rows
+	for (int slot = 0; slot < g_procTable.Count(); ++slot)
+	{
+		ProcListItem &proc = g_procTable.item[slot];
+		proc.lvd = NULL;
+		proc.dirty = false;
+	}
+	for (auto &it : g_savedProcs)
+	{
+		it.second.placeholder = NULL;
+		it.second.queued = false;
+		it.second.dirty = false;
+	}
+
+	// stop recording changes
+	g_uiLive = false;
+}
+
+void BuildViewModel(const UiViewHooks &hooks)
+{
+	g_uiLive = true;
+
+	for (int slot = 0; slot < g_procTable.Count(); ++slot)
+	{
+		// create the row
+		hooks.FetchStartTime(slot);
+		ProcListItem &proc = g_procTable.item[slot];
+		proc.lvd = new ListViewData(g_procTable.pid[slot], g_procTable.name[slot],
+			proc.key, NULL, g_procTable.type[slot], proc.startTime);
+		hooks.FillProcessRow(slot);
+		g_sortedView.Insert(proc.lvd);
+	}
+
+	// Add the placeholders.  They're built from the current settings,
+	// so any changes made while the view was down are already covered.
+	for (auto &it : g_savedProcs)
+	{
+		it.second.dirty = false;
+		if (it.second.numInstances == 0)
+			AddPlaceholderRow(hooks, it.second);
+	}
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "PinAffinity.h"
+
+// UI change sets.
+//
+// The process list engine (the scan, enforcement, accounting, and the
+// settings commands) doesn't touch the list view rows.  Instead, it
+// records each change here, and the view applies the accumulated
+// changes the next time it updates, so the cost of a view update is
+// proportional to the number of changes since the last one, not to
+// the number of rows.  Each set is de-duplicated as it's built, so a
+// process or saved program that changes many times between view
+// updates is only listed once, and the sets can never grow larger than
+// the lists they describe.
+//
+// While the window is hidden, the view doesn't exist at all: g_uiLive is
+// false, the engine creates no rows and records no changes, and the
+// view is rebuilt in one batch from the process table and saved
+// programs when the window is shown again.
+//
+// There are no window handles in here.  The change sets are plain data,
+// and the functions that apply them work on the sorted view model (see
+// SortedView.h), leaving the list view itself to the caller, so the
+// whole path from the engine to the view model can be exercised
+// without a UI.
+struct UiChangeSet
+{
+	// processes whose rows need refreshing, by PID; the process table
+	// entry's dirty flag is set while it's listed here
+	std::vector<DWORD> procs;
+
+	// rows to add, for new processes
+	std::vector<ListViewData*> added;
+
+	// rows to delete, for processes that have exited; the view deletes
+	// the ListViewData objects once the rows are gone
+	std::vector<ListViewData*> removed;
+
+	// Saved programs whose placeholder rows need checking, by key
+	// (interned in g_strings, so that it stays valid even if the saved
+	// entry is deleted).  A placeholder has to be added when the last
+	// running instance of a saved program exits, removed when an
+	// instance starts, and updated when the saved type changes.
+	std::vector<const TCHAR*> saved;
+
+	// is there anything to apply?
+	bool Empty() const { return procs.size() == 0 && added.size() == 0 && removed.size() == 0 && saved.size() == 0; }
+
+	// clear the sets, keeping their memory for reuse
+	void Clear()
+	{
+		procs.clear();
+		added.clear();
+		removed.clear();
+		saved.clear();
+	}
+};
+
+// the pending changes
+extern UiChangeSet g_uiChanges;
+
+// Is the view live?  The change recording functions do nothing while
+// it isn't.
+extern bool g_uiLive;
+
+// Record a change to the process in the given process table slot
+void MarkProcessChanged(int slot);
+
+// record a new process's row
+void MarkRowAdded(ListViewData *lvd);
+
+// Record the exit of a process with a list view row.  The row's data
+// object now belongs to the change set.
+void MarkRowRemoved(ListViewData *lvd);
+
+// record a change to a saved program's placeholder state
+void MarkSavedChanged(SavedProc &saved);
+
+// Application callbacks for the view model functions below, for the
+// parts of a row that depend on the rest of the program
+struct UiViewHooks
+{
+	// copy a running process's displayed fields from its process table
+	// entry to its row
+	void (*FillProcessRow)(int slot);
+
+	// set a saved program placeholder row's displayed fields
+	void (*FillPlaceholderRow)(SavedProc &sp, ListViewData *data);
+
+	// a row is about to be deleted
+	void (*RowDeleted)(ListViewData *data);
+
+	// fetch a process's start time, if the scan skipped it, before the
+	// view is rebuilt with a row for it
+	void (*FetchStartTime)(int slot);
+};
+
+// Apply the pending change sets to the sorted view model, and clear
+// them.  Each change moves only the rows it affects.  Returns false if
+// there were no changes.
+bool ApplyUiChangeSet(const UiViewHooks &hooks);
+
+// Tear down the view model, deleting all of the rows, including any
+// pending additions and removals, and turn off change recording
+// (g_uiLive) until BuildViewModel().
+void TearDownViewModel(const UiViewHooks &hooks);
+
+// Build the view model in one batch, with a row for each running
+// process and a placeholder for each saved program that isn't
+// running, and turn on change recording.
+void BuildViewModel(const UiViewHooks &hooks);
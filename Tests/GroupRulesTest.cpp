@@ -0,0 +1,213 @@
+// Group rule tests.
+//
+// These run process list scans through the group rules the way the
+// process list update does: each new process takes its parent's group
+// from the running processes, or if the parent isn't running any more,
+// from the group exits the rules are keeping, and the exits are noted
+// as the scans find processes gone.  They check that a child started
+// by a launcher that exited just before the scan that found the child
+// still joins the launcher's group, and that the exits are forgotten
+// after a scan, and don't hand a group to a process that's older than
+// the exited one.
+
+#include "stdafx.h"
+#include <map>
+#include "PinAffinity.h"
+#include "GroupRules.h"
+#include "TestUtil.h"
+
+// the process types
+std::vector<ProcTypeDesc> g_procTypes;
+
+// Program keys.  The group rules identify programs by interned key
+// pointers, so each program uses one literal throughout.
+static const TCHAR *const keyCmd = _T("cmd.exe");
+static const TCHAR *const keyLauncher = _T("launcher.exe");
+static const TCHAR *const keyGame = _T("game.exe");
+static const TCHAR *const keyOther = _T("other.exe");
+
+// Simulated process table: the running processes, by PID, with their
+// groups and start times
+struct SimProc
+{
+	int groupType;
+	INT64 startTime;
+};
+static std::map<DWORD, SimProc> s_procs;
+static DWORD s_scan;
+
+// start a scan
+static void BeginScan()
+{
+	++s_scan;
+}
+
+// A new process turns up in the current scan.  This figures its group
+// the same way the process list update does, and returns it.
+static int NewProcess(DWORD pid, DWORD parentPid, const TCHAR *key, INT64 startTime)
+{
+	int parentGroup = -1;
+	INT64 parentStart = 0;
+	auto itparent = s_procs.find(parentPid);
+	if (itparent != s_procs.end())
+	{
+		parentGroup = itparent->second.groupType;
+		parentStart = itparent->second.startTime;
+	}
+	if (parentPid != 0 && (itparent == s_procs.end() || parentStart > startTime))
+		FindGroupExit(parentPid, parentGroup, parentStart);
+
+	int groupType = GroupTypeForProcess(key, parentGroup, parentStart, startTime, (DWORD)-1);
+	s_procs[pid] = { groupType, startTime };
+	return groupType;
+}
+
+// The current scan finds a process gone.  The last scan that found it
+// running was the one before.
+static void ExitProcess(DWORD pid)
+{
+	auto it = s_procs.find(pid);
+	if (it->second.groupType >= 0)
+		NoteGroupExit(pid, it->second.groupType, it->second.startTime, s_scan - 1);
+	s_procs.erase(it);
+}
+
+// end the current scan
+static void EndScan()
+{
+	if (HaveGroupExits())
+		ExpireGroupExits(s_scan);
+}
+
+static void Reset()
+{
+	s_procs.clear();
+	s_scan = 0;
+	ClearGroupExits();
+}
+
+// cmd.exe -> launcher.exe -> game.exe, with the launcher exiting before
+// the scan that finds the game
+static void TestLauncherChain()
+{
+	Reset();
+
+	// the scan that finds cmd and the launcher
+	BeginScan();
+	CHECK(NewProcess(10, 1, keyCmd, 100) == 0);
+	CHECK(NewProcess(20, 10, keyLauncher, 200) == 0);
+	EndScan();
+
+	// the launcher starts the game and exits; this scan finds it gone
+	BeginScan();
+	ExitProcess(20);
+	EndScan();
+	CHECK(HaveGroupExits());
+
+	// the next scan finds the game, which still joins the group
+	BeginScan();
+	CHECK(NewProcess(30, 20, keyGame, 300) == 0);
+	EndScan();
+
+	// and its own children join through it as usual
+	BeginScan();
+	CHECK(NewProcess(40, 30, keyOther, 400) == 0);
+	EndScan();
+}
+
+// the same chain, with the launcher starting the game and exiting
+// between two scans
+static void TestLauncherChainOneScan()
+{
+	Reset();
+
+	BeginScan();
+	CHECK(NewProcess(10, 1, keyCmd, 100) == 0);
+	CHECK(NewProcess(20, 10, keyLauncher, 200) == 0);
+	EndScan();
+
+	BeginScan();
+	ExitProcess(20);
+	CHECK(NewProcess(30, 20, keyGame, 300) == 0);
+	EndScan();
+}
+
+// an exit is kept through the scan after the one that notes it, and no
+// longer
+static void TestExpiry()
+{
+	Reset();
+
+	BeginScan();
+	CHECK(NewProcess(10, 1, keyCmd, 100) == 0);
+	CHECK(NewProcess(20, 10, keyLauncher, 200) == 0);
+	EndScan();
+
+	BeginScan();
+	ExitProcess(20);
+	EndScan();
+
+	BeginScan();
+	EndScan();
+	CHECK(!HaveGroupExits());
+
+	// a process that claims the launcher as its parent now gets nothing
+	BeginScan();
+	CHECK(NewProcess(30, 20, keyGame, 300) == -1);
+	EndScan();
+
+	// and non-members aren't kept at all
+	BeginScan();
+	CHECK(NewProcess(50, 1, keyOther, 500) == -1);
+	EndScan();
+	BeginScan();
+	ExitProcess(50);
+	CHECK(!HaveGroupExits());
+	EndScan();
+}
+
+// PID reuse: an exit only passes its group to processes started after
+// it, and a newer process running under the parent's PID doesn't hide it
+static void TestPidReuse()
+{
+	Reset();
+
+	BeginScan();
+	CHECK(NewProcess(10, 1, keyCmd, 100) == 0);
+	CHECK(NewProcess(20, 10, keyLauncher, 200) == 0);
+	EndScan();
+
+	// The launcher exits, and its PID goes to an unrelated process.  A
+	// process that started before the launcher can't be its child.
+	BeginScan();
+	ExitProcess(20);
+	CHECK(NewProcess(20, 1, keyOther, 400) == -1);
+	CHECK(NewProcess(30, 20, keyOther, 150) == -1);
+	EndScan();
+
+	// The game, started by the launcher before the PID was reused, is
+	// found after the new process took the PID.  It's older than the
+	// process running under its parent's PID, so its parent is the
+	// launcher that exited.
+	BeginScan();
+	CHECK(NewProcess(31, 20, keyGame, 300) == 0);
+
+	// and a child of the new process doesn't get the launcher's group
+	CHECK(NewProcess(32, 20, keyGame, 450) == -1);
+	EndScan();
+}
+
+int main()
+{
+	// one type, with cmd.exe as a tree root
+	g_procTypes.emplace_back(_T("Games"));
+	g_procTypes.back().treeRoots.push_back(keyCmd);
+	GroupRulesInit();
+
+	TestLauncherChain();
+	TestLauncherChainOneScan();
+	TestExpiry();
+	TestPidReuse();
+	printf("GroupRulesTest: %d failure(s)\n", g_failures);
+	return g_failures != 0 ? 1 : 0;
+}
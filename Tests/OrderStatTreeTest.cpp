@@ -0,0 +1,357 @@
+// Order-statistics tree and sorted view model tests.
+//
+// These check OrderStatTree against std::set as a reference through
+// random sequences of inserts, erases and re-keys, and check that the
+// SortedView model keeps its rows in order and reports the right
+// changed ranges as rows come, go and move.  With "--bench", they also
+// time the operations at large sizes.
+
+#include "stdafx.h"
+#include <set>
+#include <iterator>
+#include "OrderStatTree.h"
+#include "SortedView.h"
+#include "TestUtil.h"
+
+typedef OrderStatTree<int, int, std::less<int>> IntTree;
+
+// position of a key in the reference set
+static int RefPos(const std::set<int> &ref, int key)
+{
+	return (int)std::distance(ref.begin(), ref.lower_bound(key));
+}
+
+// check the whole tree against the reference set
+static void CheckTree(const IntTree &tree, const std::set<int> &ref)
+{
+	CHECK(tree.Count() == (int)ref.size());
+
+	// At() and Find() agree with the reference at every position
+	int pos = 0;
+	for (int key : ref)
+	{
+		CHECK(tree.At(pos) == key * 10);
+		CHECK(tree.Find(key) == pos);
+		++pos;
+	}
+
+	// ForEach() visits in order
+	std::vector<int> vals;
+	tree.ForEach([&vals](int v) { vals.push_back(v); });
+	CHECK(vals.size() == ref.size());
+	CHECK(std::is_sorted(vals.begin(), vals.end()));
+}
+
+static void TestTreeRandom()
+{
+	TestRandom rnd(12345);
+	IntTree tree;
+	std::set<int> ref;
+	for (int round = 0; round < 20000; ++round)
+	{
+		int key = rnd.Below(2000);
+		switch (rnd.Below(3))
+		{
+		case 0:
+			// insert, if it's not already there; Insert() returns the position
+			if (ref.count(key) == 0)
+			{
+				ref.insert(key);
+				CHECK(tree.Insert(key, key * 10) == RefPos(ref, key));
+			}
+			break;
+
+		case 1:
+			// erase; Erase() returns the old position, or -1 if absent
+			{
+				int expect = ref.count(key) != 0 ? RefPos(ref, key) : -1;
+				CHECK(tree.Erase(key) == expect);
+				ref.erase(key);
+			}
+			break;
+
+		case 2:
+			// Re-key an entry, the way SortedView::Reposition() moves a
+			// row: erase it at its old key and insert it at the new one.
+			if (ref.size() != 0)
+			{
+				int oldKey = *std::next(ref.begin(), rnd.Below((int)ref.size()));
+				if (ref.count(key) == 0)
+				{
+					int from = RefPos(ref, oldKey);
+					CHECK(tree.Erase(oldKey) == from);
+					ref.erase(oldKey);
+					ref.insert(key);
+					CHECK(tree.Insert(key, key * 10) == RefPos(ref, key));
+				}
+			}
+			break;
+		}
+
+		// a lookup of a missing key finds nothing
+		if (ref.count(key) == 0)
+			CHECK(tree.Find(key) == -1);
+
+		// check the whole tree now and then
+		if (round % 1000 == 0)
+			CheckTree(tree, ref);
+	}
+	CheckTree(tree, ref);
+
+	// Clear() empties it, and the tree is reusable afterwards
+	tree.Clear();
+	ref.clear();
+	CheckTree(tree, ref);
+	for (int i = 100; i > 0; --i)
+	{
+		ref.insert(i);
+		tree.Insert(i, i * 10);
+	}
+	CheckTree(tree, ref);
+}
+
+static void TestTreeOrdering()
+{
+	// an ordering with state: descending
+	struct Desc
+	{
+		bool operator()(int a, int b) const { return a > b; }
+	};
+	OrderStatTree<int, int, Desc> tree;
+	for (int i = 0; i < 10; ++i)
+		tree.Insert(i, i);
+	for (int i = 0; i < 10; ++i)
+		CHECK(tree.At(i) == 9 - i);
+	CHECK(tree.Find(0) == 9);
+}
+
+// names for the view rows, interned by construction (each row's name
+// points into one stable array)
+static std::vector<std::basic_string<TCHAR>> s_names;
+
+static void MakeRows(std::vector<ListViewData> &rows, int n, TestRandom &rnd)
+{
+	s_names.clear();
+	for (int i = 0; i < n; ++i)
+	{
+		char buf[32];
+		sprintf(buf, "prog%03d.exe", rnd.Below(n / 4 + 1));
+		s_names.push_back(std::basic_string<TCHAR>(buf, buf + strlen(buf)));
+	}
+
+	rows.clear();
+	rows.reserve(n);
+	for (int i = 0; i < n; ++i)
+	{
+		FILETIME start = { rnd.Next(), 0 };
+		const TCHAR *name = s_names[i].c_str();
+		rows.emplace_back((DWORD)(i * 4 + 4), name, name, (SavedProc*)NULL, (int)rnd.Below(3), start);
+		rows.back().cpu = (UINT16)rnd.Below(1000);
+	}
+
+	// a couple of saved program placeholders
+	rows[0].effPid = (DWORD)-1;
+	rows[1].effPid = (DWORD)-1;
+}
+
+// check that the view's rows are in order, and that Find() agrees with At()
+static void CheckView(const SortedView &view, ViewSortField field, int dir, int expectCount)
+{
+	CHECK(view.Count() == expectCount);
+	for (int i = 0; i < view.Count(); ++i)
+	{
+		const ListViewData *r = view.At(i);
+		CHECK(view.Find(r) == i);
+		if (i == 0)
+			continue;
+
+		// compare the primary fields the way the view defines them
+		const ListViewData *p = view.At(i - 1);
+		INT64 a = 0, b = 0;
+		switch (field)
+		{
+		case SortFieldCpu:
+			a = p->cpu;
+			b = r->cpu;
+			break;
+
+		case SortFieldStatus:
+			a = p->IsPlaceholder() ? 0 : 1;
+			b = r->IsPlaceholder() ? 0 : 1;
+			break;
+
+		default:
+			break;
+		}
+		CHECK(dir > 0 ? a <= b : a >= b);
+		if (a == b && field != SortFieldPid)
+			CHECK(dir > 0 ? _tcscmp(p->key, r->key) <= 0 : _tcscmp(p->key, r->key) >= 0);
+	}
+}
+
+static void TestSortedView()
+{
+	TestRandom rnd(777);
+	std::vector<ListViewData> rows;
+	const int n = 500;
+	MakeRows(rows, n, rnd);
+
+	SortedView view;
+	int first, last;
+	for (int dir = 1; dir >= -1; dir -= 2)
+	{
+		view.Clear();
+		view.TakeChanges(first, last);
+		view.SetOrder(SortFieldCpu, dir);
+
+		// insert everything
+		for (auto &r : rows)
+		{
+			int pos = view.Insert(&r);
+			CHECK(view.At(pos) == &r);
+		}
+		CheckView(view, SortFieldCpu, dir, n);
+		CHECK(view.TakeChanges(first, last));
+		CHECK(!view.TakeChanges(first, last));
+
+		// Change rows' CPU figures and reposition them.  The changed
+		// range has to cover both the old and new positions.
+		for (int round = 0; round < 2000; ++round)
+		{
+			ListViewData &r = rows[rnd.Below(n)];
+			int from = view.Find(&r);
+			r.cpu = (UINT16)rnd.Below(1000);
+			int to = view.Reposition(&r);
+			CHECK(view.At(to) == &r);
+			CHECK(view.TakeChanges(first, last));
+			CHECK(first <= min(from, to) && last >= max(from, to));
+		}
+		CheckView(view, SortFieldCpu, dir, n);
+
+		// A reposition without a key change stays put, and only dirties
+		// the row itself
+		ListViewData &same = rows[5];
+		int pos = view.Find(&same);
+		CHECK(view.Reposition(&same) == pos);
+		CHECK(view.TakeChanges(first, last) && first == pos && last == pos);
+
+		// remove half of the rows; the changed range runs from the
+		// removed row to the old end of the list
+		int count = n;
+		for (int i = 0; i < n; i += 2)
+		{
+			int p = view.Remove(&rows[i]);
+			CHECK(p >= 0);
+			CHECK(view.Find(&rows[i]) == -1);
+			CHECK(view.Remove(&rows[i]) == -1);
+			CHECK(view.TakeChanges(first, last) && first == p && last == count - 1);
+			--count;
+		}
+		CheckView(view, SortFieldCpu, dir, count);
+
+		// re-sorting by another column keeps every row
+		view.SetOrder(SortFieldStatus, dir);
+		CheckView(view, SortFieldStatus, dir, count);
+		view.SetOrder(SortFieldCpu, dir);
+
+		// put them back
+		for (int i = 0; i < n; i += 2)
+			view.Insert(&rows[i]);
+		CheckView(view, SortFieldCpu, dir, n);
+	}
+
+	// removed rows aren't in the view after Clear()
+	view.Clear();
+	CHECK(view.Count() == 0);
+	CHECK(view.Find(&rows[3]) == -1);
+	CHECK(view.Reposition(&rows[3]) == -1);
+}
+
+static void Bench()
+{
+	// tree operations at a large size
+	const int n = 1000000;
+	TestRandom rnd(99);
+	std::vector<int> keys(n);
+	for (int i = 0; i < n; ++i)
+		keys[i] = i * 2;
+	for (int i = n - 1; i > 0; --i)
+		std::swap(keys[i], keys[rnd.Below(i + 1)]);
+
+	IntTree tree;
+	TestTimer tInsert;
+	for (int k : keys)
+		tree.Insert(k, k);
+	printf("OrderStatTree, n = %d:\n  insert      %7.1f ns\n", n, tInsert.NsPer(n));
+
+	TestTimer tFind;
+	long long sum = 0;
+	for (int k : keys)
+		sum += tree.Find(k);
+	printf("  find        %7.1f ns\n", tFind.NsPer(n));
+
+	TestTimer tAt;
+	for (int i = 0; i < n; ++i)
+		sum += tree.At(rnd.Below(n));
+	printf("  at          %7.1f ns\n", tAt.NsPer(n));
+
+	TestTimer tMove;
+	for (int i = 0; i < n; ++i)
+	{
+		int &k = keys[rnd.Below(n)];
+		// each key's pair (k ^ 1) is never in the tree at the same time
+		tree.Erase(k);
+		k ^= 1;
+		tree.Insert(k, k);
+	}
+	printf("  re-key      %7.1f ns\n", tMove.NsPer(n));
+
+	TestTimer tErase;
+	for (int k : keys)
+		tree.Erase(k);
+	printf("  erase       %7.1f ns\n", tErase.NsPer(n));
+
+	std::set<int> ref;
+	TestTimer tSet;
+	for (int k : keys)
+		ref.insert(k);
+	printf("  (std::set insert for comparison: %.1f ns)\n", tSet.NsPer(n));
+
+	// the view model at a large process count
+	const int nRows = 50000;
+	std::vector<ListViewData> rows;
+	MakeRows(rows, nRows, rnd);
+	SortedView view;
+	view.SetOrder(SortFieldCpu, -1);
+	TestTimer tViewInsert;
+	for (auto &r : rows)
+		view.Insert(&r);
+	printf("SortedView, %d rows:\n  insert      %7.1f ns\n", nRows, tViewInsert.NsPer(nRows));
+
+	const int nMoves = 1000000;
+	TestTimer tReposition;
+	for (int i = 0; i < nMoves; ++i)
+	{
+		ListViewData &r = rows[rnd.Below(nRows)];
+		r.cpu = (UINT16)rnd.Below(1000);
+		view.Reposition(&r);
+	}
+	printf("  reposition  %7.1f ns\n", tReposition.NsPer(nMoves));
+
+	// keep the optimizer from discarding the lookups
+	if (sum == 42)
+		printf(" \n");
+}
+
+int main(int argc, char **argv)
+{
+	TestTreeRandom();
+	TestTreeOrdering();
+	TestSortedView();
+	printf("OrderStatTreeTest: %d failure(s)\n", g_failures);
+
+	if (g_failures == 0 && WantBench(argc, argv))
+		Bench();
+
+	return g_failures != 0 ? 1 : 0;
+}
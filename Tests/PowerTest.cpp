@@ -0,0 +1,276 @@
+// Processor power settings tests.
+//
+// These run the power scheme changes through a fake power system: a
+// table of scheme settings, an active scheme, and an in-memory file
+// store.  They check that the original values are saved to the file
+// before anything changes, that they're restored at the end, and that
+// a run that ends without restoring them (a crash, say) gets them
+// restored by the next run's recovery step.
+
+#include "stdafx.h"
+#include <map>
+#include <tuple>
+#include "Power.h"
+#include "TestUtil.h"
+
+// the settings Power.cpp changes (GUID_PROCESSOR_THROTTLE_MINIMUM and
+// GUID_PROCESSOR_IDLE_DISABLE)
+static const GUID guidMinState = { 0x893dee8e, 0x2bef, 0x41e0, { 0x89, 0xc6, 0xb5, 0x5d, 0x09, 0x29, 0x96, 0x4c } };
+static const GUID guidIdle = { 0x5d76a2ca, 0xe8c0, 0x402f, { 0xa1, 0x33, 0x21, 0x58, 0x49, 0x2d, 0x58, 0xad } };
+
+// two power schemes
+static const GUID schemeA = { 0xA, 0, 0, { 0 } };
+static const GUID schemeB = { 0xB, 0, 0, { 0 } };
+
+// Fake power system state
+static struct
+{
+	// setting values, by scheme, setting and AC/DC
+	std::map<std::tuple<DWORD, DWORD, bool>, DWORD> values;
+
+	// active scheme, and the number of activations
+	GUID active;
+	int activations;
+
+	// files
+	std::map<std::string, std::string> files;
+
+	// failure injection: fail setting writes, or file writes
+	bool failWrites;
+	bool failSave;
+
+	// did a setting write happen while the originals file was missing?
+	bool writeWithoutFile;
+} s_sys;
+
+static const TCHAR *const origFile = _T("PinAffinity-Power.dat");
+
+static std::tuple<DWORD, DWORD, bool> Key(const GUID &scheme, const GUID &setting, bool ac)
+{
+	return std::make_tuple(scheme.Data1, setting.Data1, ac);
+}
+
+static bool FakeGetActiveScheme(GUID &scheme)
+{
+	scheme = s_sys.active;
+	return true;
+}
+
+static void FakeSetActiveScheme(const GUID &scheme)
+{
+	s_sys.active = scheme;
+	s_sys.activations++;
+}
+
+static bool FakeReadSetting(const GUID &scheme, const GUID &setting, bool ac, DWORD &value)
+{
+	auto it = s_sys.values.find(Key(scheme, setting, ac));
+	if (it == s_sys.values.end())
+		return false;
+	value = it->second;
+	return true;
+}
+
+static bool FakeWriteSetting(const GUID &scheme, const GUID &setting, bool ac, DWORD value)
+{
+	if (s_sys.failWrites)
+		return false;
+	if (s_sys.files.count(origFile) == 0)
+		s_sys.writeWithoutFile = true;
+	s_sys.values[Key(scheme, setting, ac)] = value;
+	return true;
+}
+
+static bool FakeSaveFile(const TCHAR *fname, const void *data, DWORD len)
+{
+	if (s_sys.failSave)
+		return false;
+	s_sys.files[fname] = std::string((const char *)data, len);
+	return true;
+}
+
+static int FakeLoadFile(const TCHAR *fname, void *data, DWORD len)
+{
+	auto it = s_sys.files.find(fname);
+	if (it == s_sys.files.end())
+		return -1;
+	size_t n = min((size_t)len, it->second.size());
+	memcpy(data, it->second.data(), n);
+	return (int)n;
+}
+
+static void FakeRemoveFile(const TCHAR *fname)
+{
+	s_sys.files.erase(fname);
+}
+
+static const PowerApi s_fakePowerApi = {
+	FakeGetActiveScheme,
+	FakeSetActiveScheme,
+	FakeReadSetting,
+	FakeWriteSetting,
+	FakeSaveFile,
+	FakeLoadFile,
+	FakeRemoveFile
+};
+
+// Power.cpp uses the fake system throughout
+const PowerApi *g_powerApi = &s_fakePowerApi;
+
+// set up a fresh system: scheme A active, min state 5%/3%, idle enabled
+static void ResetSystem()
+{
+	s_sys.values.clear();
+	s_sys.files.clear();
+	for (const GUID *scheme : { &schemeA, &schemeB })
+	{
+		s_sys.values[Key(*scheme, guidMinState, true)] = 5;
+		s_sys.values[Key(*scheme, guidMinState, false)] = 3;
+		s_sys.values[Key(*scheme, guidIdle, true)] = 0;
+		s_sys.values[Key(*scheme, guidIdle, false)] = 0;
+	}
+	s_sys.active = schemeA;
+	s_sys.activations = 0;
+	s_sys.failWrites = false;
+	s_sys.failSave = false;
+	s_sys.writeWithoutFile = false;
+}
+
+static DWORD Value(const GUID &scheme, const GUID &setting, bool ac)
+{
+	return s_sys.values[Key(scheme, setting, ac)];
+}
+
+// is a scheme at its original values?
+static bool IsOriginal(const GUID &scheme)
+{
+	return Value(scheme, guidMinState, true) == 5 && Value(scheme, guidMinState, false) == 3
+		&& Value(scheme, guidIdle, true) == 0 && Value(scheme, guidIdle, false) == 0;
+}
+
+static void TestApplyRestore()
+{
+	ResetSystem();
+	RecoverProcessorPowerSettings(origFile);
+	CHECK(s_sys.files.empty());
+	CHECK(IsOriginal(schemeA));
+
+	// apply: both settings change on AC and DC, after the originals
+	// are on file, and the scheme is re-activated
+	CHECK(ApplyProcessorPowerSettings(100, true));
+	CHECK(!s_sys.writeWithoutFile);
+	CHECK(s_sys.files.count(origFile) == 1);
+	CHECK(Value(schemeA, guidMinState, true) == 100 && Value(schemeA, guidMinState, false) == 100);
+	CHECK(Value(schemeA, guidIdle, true) == 1 && Value(schemeA, guidIdle, false) == 1);
+	CHECK(s_sys.activations == 1);
+
+	// a second apply with weaker settings goes back to the originals
+	// for what it doesn't override
+	CHECK(ApplyProcessorPowerSettings(-1, false));
+	CHECK(IsOriginal(schemeA));
+	CHECK(s_sys.files.count(origFile) == 1);
+
+	// restore puts back the originals and deletes the file
+	CHECK(ApplyProcessorPowerSettings(50, false));
+	RestoreProcessorPowerSettings();
+	CHECK(IsOriginal(schemeA));
+	CHECK(s_sys.files.empty());
+
+	// restoring again does nothing
+	s_sys.values[Key(schemeA, guidMinState, true)] = 77;
+	RestoreProcessorPowerSettings();
+	CHECK(Value(schemeA, guidMinState, true) == 77);
+}
+
+static void TestCrashRecovery()
+{
+	ResetSystem();
+	RecoverProcessorPowerSettings(origFile);
+
+	// apply, then "crash": the session ends without restoring
+	CHECK(ApplyProcessorPowerSettings(100, true));
+	CHECK(!IsOriginal(schemeA));
+
+	// The next session's startup restores the originals from the file
+	// and deletes it.  The user might have switched schemes since; the
+	// changed scheme gets restored either way.
+	s_sys.active = schemeB;
+	RecoverProcessorPowerSettings(origFile);
+	CHECK(IsOriginal(schemeA));
+	CHECK(IsOriginal(schemeB));
+	CHECK(s_sys.files.empty());
+
+	// and that session can apply and restore normally
+	CHECK(ApplyProcessorPowerSettings(80, false));
+	CHECK(Value(schemeB, guidMinState, true) == 80);
+	RestoreProcessorPowerSettings();
+	CHECK(IsOriginal(schemeB));
+	CHECK(s_sys.files.empty());
+}
+
+static void TestBadFile()
+{
+	// a damaged file is deleted without touching the settings
+	ResetSystem();
+	s_sys.files[origFile] = "garbage";
+	s_sys.values[Key(schemeA, guidMinState, true)] = 42;
+	RecoverProcessorPowerSettings(origFile);
+	CHECK(s_sys.files.empty());
+	CHECK(Value(schemeA, guidMinState, true) == 42);
+}
+
+static void TestFailures()
+{
+	// If the restore fails, the file stays for the next run to retry
+	ResetSystem();
+	RecoverProcessorPowerSettings(origFile);
+	CHECK(ApplyProcessorPowerSettings(100, true));
+	s_sys.failWrites = true;
+	RestoreProcessorPowerSettings();
+	CHECK(s_sys.files.count(origFile) == 1);
+	s_sys.failWrites = false;
+	RecoverProcessorPowerSettings(origFile);
+	CHECK(IsOriginal(schemeA));
+	CHECK(s_sys.files.empty());
+
+	// if the file can't be saved, the settings still apply and restore
+	ResetSystem();
+	RecoverProcessorPowerSettings(origFile);
+	s_sys.failSave = true;
+	CHECK(ApplyProcessorPowerSettings(100, false));
+	CHECK(Value(schemeA, guidMinState, true) == 100);
+	RestoreProcessorPowerSettings();
+	CHECK(IsOriginal(schemeA));
+}
+
+static void TestSchemeSwitch()
+{
+	// if the user switches schemes while our changes are in effect,
+	// the next apply restores the old scheme before changing the new one
+	ResetSystem();
+	RecoverProcessorPowerSettings(origFile);
+	CHECK(ApplyProcessorPowerSettings(100, true));
+	s_sys.active = schemeB;
+	CHECK(ApplyProcessorPowerSettings(100, true));
+	CHECK(IsOriginal(schemeA));
+	CHECK(Value(schemeB, guidMinState, true) == 100);
+	CHECK(s_sys.files.count(origFile) == 1);
+
+	// and the file now describes the new scheme
+	s_sys.values[Key(schemeA, guidMinState, true)] = 99;
+	RecoverProcessorPowerSettings(origFile);
+	CHECK(IsOriginal(schemeB));
+	CHECK(Value(schemeA, guidMinState, true) == 99);
+	CHECK(s_sys.files.empty());
+}
+
+int main()
+{
+	TestApplyRestore();
+	TestCrashRecovery();
+	TestBadFile();
+	TestFailures();
+	TestSchemeSwitch();
+	printf("PowerTest: %d failure(s)\n", g_failures);
+	return g_failures != 0 ? 1 : 0;
+}
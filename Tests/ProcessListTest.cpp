@@ -0,0 +1,323 @@
+// Process list scan tests.
+//
+// These build synthetic native process snapshots, in the same layout as
+// the SystemProcessInformation result, and run them through the scan
+// path the way the process list update does: ReadProcessSnapshot()
+// reads the entries and interns the names, and the update matches them
+// against the process table, interning the keys and adding the new
+// processes, then removes the ones that are gone.  They check that the
+// entries read back exactly, and that a scan with no new programs
+// doesn't allocate any memory for the snapshot or the names.  With
+// "--bench", they also report the scan rate in processes per second
+// and the memory allocations per scan, by component, under a steady
+// trickle of process starts and exits.
+
+#include "stdafx.h"
+#include <new>
+#include <stdlib.h>
+#include "ProcessList.h"
+#include "NtApi.h"
+#include "StringTable.h"
+#include "ProcessTable.h"
+#include "TestUtil.h"
+
+// Counting allocator.  This replaces the global operator new, and
+// charges each allocation to the scan phase in progress.
+enum AllocPhase { PhaseOther, PhaseSnapshot, PhaseKeys, PhaseTable, NumPhases };
+static AllocPhase s_phase = PhaseOther;
+static long long s_allocs[NumPhases];
+
+void *operator new(size_t size)
+{
+	++s_allocs[s_phase];
+	if (void *p = malloc(size != 0 ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+// Simulated system process, as the snapshot reports it
+struct SimProc
+{
+	DWORD pid;
+	DWORD parentPid;
+	DWORD nThreads;
+	DWORD sessionId;
+	INT64 createTime;
+	INT64 cpuTime;
+	std::string name;
+};
+
+// our own PID, for the context switch count
+static const DWORD selfPid = 4000;
+
+// Build a native snapshot of the processes.  Each entry is the process
+// record, then its thread records, then its name, padded to keep the
+// next entry aligned.
+static void BuildSnapshot(const std::vector<SimProc> &procs, std::vector<BYTE> &buf)
+{
+	auto entrySize = [](const SimProc &p) {
+		size_t n = sizeof(NtSystemProcessInfo) + p.nThreads * sizeof(NtSystemThreadInfo)
+			+ p.name.size() * sizeof(WCHAR);
+		return (n + 7) & ~(size_t)7;
+	};
+
+	size_t total = 0;
+	for (auto &p : procs)
+		total += entrySize(p);
+	buf.assign(total, 0);
+
+	BYTE *e = buf.data();
+	for (size_t i = 0; i < procs.size(); ++i)
+	{
+		const SimProc &p = procs[i];
+		NtSystemProcessInfo *pi = (NtSystemProcessInfo *)e;
+		pi->NextEntryOffset = i + 1 < procs.size() ? (ULONG)entrySize(p) : 0;
+		pi->NumberOfThreads = p.nThreads;
+		pi->CreateTime.QuadPart = p.createTime;
+		pi->KernelTime.QuadPart = p.cpuTime / 4;
+		pi->UserTime.QuadPart = p.cpuTime - p.cpuTime / 4;
+		pi->UniqueProcessId = (HANDLE)(ULONG_PTR)p.pid;
+		pi->InheritedFromUniqueProcessId = (HANDLE)(ULONG_PTR)p.parentPid;
+		pi->SessionId = p.sessionId;
+
+		// each thread has switched (thread index + 1) * 10 times
+		NtSystemThreadInfo *ti = (NtSystemThreadInfo *)(pi + 1);
+		for (DWORD t = 0; t < p.nThreads; ++t)
+			ti[t].ContextSwitches = (t + 1) * 10;
+
+		// the name follows the threads (the idle process has none)
+		WCHAR *name = (WCHAR *)(ti + p.nThreads);
+		memcpy(name, p.name.data(), p.name.size() * sizeof(WCHAR));
+		pi->ImageName.Length = (USHORT)(p.name.size() * sizeof(WCHAR));
+		pi->ImageName.MaximumLength = pi->ImageName.Length;
+		pi->ImageName.Buffer = p.name.size() != 0 ? name : NULL;
+
+		e += entrySize(p);
+	}
+}
+
+// Update the process table from the list, the way the process list
+// update does: existing processes (matched by PID and name) are marked
+// with the scan number, new ones get their keys interned and are added,
+// and the ones the scan didn't find are removed.
+static void UpdateTable(const std::vector<ProcessDesc> &lst, DWORD scan)
+{
+	for (auto const &p : lst)
+	{
+		int slot = g_procTable.Find(p.pid);
+		if (slot >= 0 && g_procTable.name[slot] == p.name)
+		{
+			g_procTable.gen[slot] = scan;
+			continue;
+		}
+		if (slot >= 0)
+			g_procTable.RemoveAt(slot);
+
+		s_phase = PhaseKeys;
+		const TCHAR *key = g_strings.InternLower(p.name);
+		s_phase = PhaseTable;
+		g_procTable.Add(p.pid, p.name, scan, 0, 0, ProcListItem(key, 0, 0, p.startTime));
+	}
+
+	s_phase = PhaseTable;
+	for (int i = 0; i < g_procTable.Count(); )
+	{
+		if (g_procTable.gen[i] != scan)
+			g_procTable.RemoveAt(i);
+		else
+			++i;
+	}
+	s_phase = PhaseOther;
+}
+
+// run one scan of the snapshot
+static void Scan(const std::vector<BYTE> &buf, std::vector<ProcessDesc> &lst, ProcessListStats &stats, DWORD scan)
+{
+	lst.clear();
+	s_phase = PhaseSnapshot;
+	ReadProcessSnapshot(buf.data(), selfPid, lst, stats);
+	s_phase = PhaseOther;
+	UpdateTable(lst, scan);
+}
+
+// empty the process table
+static void ClearTable()
+{
+	while (g_procTable.Count() != 0)
+		g_procTable.RemoveAt(g_procTable.Count() - 1);
+}
+
+// make a simulated process
+static SimProc MakeProc(DWORD pid, const std::string &name)
+{
+	return { pid, 4, 1 + pid % 7, pid % 3, 1000000 + pid, pid * 100, name };
+}
+
+// the entries read back exactly as the snapshot has them
+static void TestRead()
+{
+	std::vector<SimProc> procs;
+	procs.push_back({ 0, 0, 8, 0, 0, 0, "" });
+	procs.push_back(MakeProc(4, "System"));
+	procs.push_back(MakeProc(selfPid, "PinAffinity.exe"));
+	for (DWORD i = 0; i < 20; ++i)
+		procs.push_back(MakeProc(100 + i * 4, "Prog" + std::to_string(i % 5) + ".exe"));
+
+	std::vector<BYTE> buf;
+	BuildSnapshot(procs, buf);
+	std::vector<ProcessDesc> lst;
+	ProcessListStats stats = { };
+	ReadProcessSnapshot(buf.data(), selfPid, lst, stats);
+
+	CHECK(lst.size() == procs.size());
+	for (size_t i = 0; i < lst.size() && i < procs.size(); ++i)
+	{
+		const ProcessDesc &d = lst[i];
+		const SimProc &p = procs[i];
+		CHECK(d.pid == p.pid);
+		CHECK(d.parentPid == p.parentPid);
+		CHECK(d.nThreads == p.nThreads);
+		CHECK(d.sessionId == p.sessionId);
+		CHECK(d.haveTimes);
+		CHECK(d.cpuTime == (ULONGLONG)p.cpuTime);
+		CHECK((((INT64)d.startTime.dwHighDateTime << 32) | d.startTime.dwLowDateTime) == p.createTime);
+
+		// names are interned, and the idle process gets the toolhelp name
+		const char *expect = p.name.size() != 0 ? p.name.c_str() : "[System Process]";
+		CHECK(strcmp(d.name, expect) == 0);
+		CHECK(d.name == g_strings.Intern(expect));
+	}
+
+	// our own threads' context switches: (1 + 2 + ... + n) * 10
+	DWORD n = procs[2].nThreads;
+	CHECK(stats.selfSwitches == (ULONGLONG)n * (n + 1) / 2 * 10);
+}
+
+// Once the names are known and the vectors have grown to size, a scan
+// allocates nothing for the snapshot or the names, and the table only
+// allocates for the processes that started
+static void TestSteadyState()
+{
+	ClearTable();
+	std::vector<SimProc> procs;
+	for (DWORD i = 0; i < 500; ++i)
+		procs.push_back(MakeProc(1000 + i * 4, "Steady" + std::to_string(i % 50) + ".exe"));
+
+	std::vector<BYTE> buf;
+	std::vector<ProcessDesc> lst;
+	ProcessListStats stats = { };
+	BuildSnapshot(procs, buf);
+	Scan(buf, lst, stats, 1);
+	CHECK(g_procTable.Count() == (int)procs.size());
+
+	// the same processes again
+	memset(s_allocs, 0, sizeof(s_allocs));
+	Scan(buf, lst, stats, 2);
+	CHECK(s_allocs[PhaseSnapshot] == 0);
+	CHECK(s_allocs[PhaseKeys] == 0);
+	CHECK(s_allocs[PhaseTable] == 0);
+
+	// ten exits, and ten starts of programs we've seen before
+	for (DWORD i = 0; i < 10; ++i)
+	{
+		procs[i * 7].pid = 9000 + i * 4;
+		procs[i * 7].name = "Steady" + std::to_string(i) + ".exe";
+	}
+	BuildSnapshot(procs, buf);
+	memset(s_allocs, 0, sizeof(s_allocs));
+	Scan(buf, lst, stats, 3);
+	CHECK(s_allocs[PhaseSnapshot] == 0);
+	CHECK(s_allocs[PhaseKeys] == 0);
+	CHECK(s_allocs[PhaseTable] <= 10);
+
+	// the table matches the system
+	CHECK(g_procTable.Count() == (int)procs.size());
+	for (auto &p : procs)
+	{
+		int slot = g_procTable.Find(p.pid);
+		CHECK(slot >= 0 && strcmp(g_procTable.name[slot], p.name.c_str()) == 0);
+	}
+	ClearTable();
+}
+
+// Run scans of a system of n processes, with a few process starts and
+// exits between scans, and now and then a program we haven't seen
+// before.  Reports the scan rate and allocations per scan.
+static void BenchScans(int n, TestRandom &rnd)
+{
+	ClearTable();
+	std::vector<SimProc> procs;
+	DWORD nextPid = 100000;
+	int nextName = 0;
+	auto newName = [&]() { return "Bench" + std::to_string(n) + "_" + std::to_string(nextName++) + ".exe"; };
+	std::vector<std::string> names;
+	for (int i = 0; i < n / 10 + 1; ++i)
+		names.push_back(newName());
+	for (int i = 0; i < n; ++i)
+		procs.push_back(MakeProc(nextPid += 4, names[rnd.Below((int)names.size())]));
+
+	std::vector<BYTE> buf;
+	std::vector<ProcessDesc> lst;
+	ProcessListStats stats = { };
+	BuildSnapshot(procs, buf);
+	DWORD scan = 1;
+	Scan(buf, lst, stats, scan++);
+
+	const int nScans = max(20, 3000000 / n);
+	const int churn = 5;
+	long long nanos = 0, nProcs = 0;
+	memset(s_allocs, 0, sizeof(s_allocs));
+	for (int s = 0; s < nScans; ++s)
+	{
+		// some processes exit and others start; every tenth scan brings
+		// a new program
+		for (int c = 0; c < churn; ++c)
+		{
+			SimProc &p = procs[rnd.Below(n)];
+			if (c == 0 && s % 10 == 0)
+				names.push_back(newName());
+			const std::string &name = c == 0 && s % 10 == 0 ? names.back() : names[rnd.Below((int)names.size())];
+			p = MakeProc(nextPid += 4, name);
+		}
+		s_phase = PhaseOther;
+		BuildSnapshot(procs, buf);
+
+		auto t0 = std::chrono::steady_clock::now();
+		Scan(buf, lst, stats, scan++);
+		nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+		nProcs += (long long)lst.size();
+	}
+	CHECK(g_procTable.Count() == n);
+
+	printf("  %6d processes  %8.1f M processes/s  %6.1f us/scan  allocations/scan: snapshot %.2f, keys %.2f, table %.2f\n",
+		n, nanos != 0 ? nProcs * 1000.0 / nanos : 0.0, nanos / 1000.0 / nScans,
+		(double)s_allocs[PhaseSnapshot] / nScans, (double)s_allocs[PhaseKeys] / nScans,
+		(double)s_allocs[PhaseTable] / nScans);
+	ClearTable();
+}
+
+static void Bench()
+{
+	TestRandom rnd(7);
+	printf("Process list scans (5 starts/exits per scan, a new program every 10 scans):\n");
+	printf("  (snapshot = reading and interning names; keys = key interning; table = process table)\n");
+	for (int n : { 300, 3000, 30000 })
+		BenchScans(n, rnd);
+}
+
+int main(int argc, char **argv)
+{
+	TestRead();
+	TestSteadyState();
+	printf("ProcessListTest: %d failure(s)\n", g_failures);
+
+	if (g_failures == 0 && WantBench(argc, argv))
+		Bench();
+
+	return g_failures != 0 ? 1 : 0;
+}
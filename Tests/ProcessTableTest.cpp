@@ -0,0 +1,280 @@
+// Process table and string table tests.
+//
+// These run random sequences of process arrivals and exits through
+// ProcessTable and check every lookup against reference maps.  Exits
+// exercise the backward-shift deletion in the PID index, and PIDs are
+// chosen to collide in the index, so that the probe runs get long.
+// With "--bench", they also measure lookup time and memory use for a
+// table of 50,000 processes.
+
+#include "stdafx.h"
+#include <map>
+#include <set>
+#include "StringTable.h"
+#include "ProcessTable.h"
+#include "TestUtil.h"
+
+// check the whole table against the reference maps
+static void CheckTable(const ProcessTable &table,
+	const std::unordered_map<DWORD, const TCHAR*> &ref,
+	const std::vector<const TCHAR*> &keys)
+{
+	CHECK(table.Count() == (int)ref.size());
+
+	// every PID finds its own slot, and the slot's fields match
+	for (auto &r : ref)
+	{
+		int slot = table.Find(r.first);
+		CHECK(slot >= 0 && slot < table.Count());
+		if (slot >= 0)
+		{
+			CHECK(table.pid[slot] == r.first);
+			CHECK(table.item[slot].key == r.second);
+			CHECK(table.name[slot] == r.second);
+			CHECK(table.gen[slot] == r.first / 4);
+			CHECK(table.mask[slot] == (DWORD_PTR)r.first);
+		}
+	}
+
+	// every slot is reachable through the index
+	for (int slot = 0; slot < table.Count(); ++slot)
+		CHECK(table.Find(table.pid[slot]) == slot);
+
+	// the key index finds exactly the running instances of each program
+	for (auto key : keys)
+	{
+		std::set<DWORD> expect;
+		for (auto &r : ref)
+		{
+			if (r.second == key)
+				expect.insert(r.first);
+		}
+
+		std::vector<int> slots;
+		table.FindByKey(key, slots);
+		std::set<DWORD> found;
+		for (int slot : slots)
+		{
+			CHECK(slot >= 0);
+			if (slot >= 0)
+				found.insert(table.pid[slot]);
+		}
+		CHECK(slots.size() == expect.size());
+		CHECK(found == expect);
+	}
+}
+
+static void TestProcessTable()
+{
+	TestRandom rnd(4242);
+
+	// a few program keys, interned the way the application does it
+	std::vector<const TCHAR*> keys;
+	for (int i = 0; i < 20; ++i)
+	{
+		char buf[32];
+		sprintf(buf, "program%d.exe", i);
+		keys.push_back(g_strings.Intern(buf));
+	}
+
+	ProcessTable table;
+	std::unordered_map<DWORD, const TCHAR*> ref;
+	std::vector<DWORD> live;
+	for (int round = 0; round < 50000; ++round)
+	{
+		// Grow for the first part of the run, then hover.  PIDs are
+		// multiples of 4, as on Windows; drawing them from a small range
+		// gives dense clusters in the index.
+		bool add = live.empty() || (int)rnd.Below(100) < (round < 20000 ? 70 : 50);
+		if (add)
+		{
+			DWORD pid = (DWORD)(rnd.Below(8192) * 4 + 4);
+			if (ref.count(pid) != 0)
+			{
+				CHECK(table.Find(pid) >= 0);
+				continue;
+			}
+			const TCHAR *key = keys[rnd.Below((int)keys.size())];
+			int slot = table.Add(pid, key, pid / 4, 0, pid, ProcListItem(key, 0, 0, { 0, 0 }));
+			CHECK(slot == (int)ref.size());
+			ref[pid] = key;
+			live.push_back(pid);
+		}
+		else
+		{
+			// remove a random live process
+			int i = rnd.Below((int)live.size());
+			DWORD pid = live[i];
+			live[i] = live.back();
+			live.pop_back();
+			int slot = table.Find(pid);
+			CHECK(slot >= 0);
+			if (slot >= 0)
+				table.RemoveAt(slot);
+			ref.erase(pid);
+			CHECK(table.Find(pid) == -1);
+		}
+
+		if (round % 2500 == 0)
+			CheckTable(table, ref, keys);
+	}
+	CheckTable(table, ref, keys);
+
+	// empty it completely, in slot order from the front, which moves
+	// the last entry each time
+	while (table.Count() != 0)
+	{
+		ref.erase(table.pid[0]);
+		table.RemoveAt(0);
+	}
+	CheckTable(table, ref, keys);
+	CHECK(table.Find(4) == -1);
+}
+
+static void TestStringTable()
+{
+	StringTable strings;
+
+	// equal strings intern to the same pointer, different ones don't
+	std::map<std::string, const TCHAR*> ref;
+	TestRandom rnd(31337);
+	for (int i = 0; i < 20000; ++i)
+	{
+		char buf[64];
+		sprintf(buf, "name%u", rnd.Below(5000));
+		const TCHAR *p = strings.Intern(buf);
+		CHECK(strcmp(p, buf) == 0);
+		auto it = ref.find(buf);
+		if (it != ref.end())
+			CHECK(it->second == p);
+		else
+			ref[buf] = p;
+	}
+
+	// interned strings survive the index growing
+	for (auto &r : ref)
+		CHECK(strings.Intern(r.first.c_str()) == r.second && r.first == r.second);
+
+	// a prefix or length-limited intern is a distinct string
+	const TCHAR *abc = strings.Intern(_T("abc"));
+	CHECK(strings.Intern(_T("abcd"), 3) == abc);
+	CHECK(strings.Intern(_T("ab")) != abc);
+	CHECK(strings.Intern(_T("")) == strings.Intern(_T("xyz"), 0));
+
+	// lower-case interning
+	CHECK(strings.InternLower(_T("ABC")) == abc);
+	CHECK(strings.InternLower(_T("aBc")) == abc);
+
+	// a string longer than MAX_PATH, and one longer than a storage block
+	std::string big(MAX_PATH + 10, 'Q');
+	std::string lower(MAX_PATH + 10, 'q');
+	CHECK(strings.InternLower(big.c_str()) == strings.Intern(lower.c_str()));
+	std::string huge(20000, 'z');
+	const TCHAR *h = strings.Intern(huge.c_str());
+	CHECK(huge == h);
+	CHECK(strings.Intern(_T("after")) != NULL && abc == strings.Intern(_T("abc")));
+}
+
+static void Bench()
+{
+	const int n = 50000;
+	TestRandom rnd(2024);
+
+	// a realistic mix: many instances of a few hundred programs
+	std::vector<const TCHAR*> keys;
+	for (int i = 0; i < 300; ++i)
+	{
+		char buf[32];
+		sprintf(buf, "program%d.exe", i);
+		keys.push_back(g_strings.Intern(buf));
+	}
+
+	std::vector<DWORD> pids;
+	std::set<DWORD> used;
+	while ((int)pids.size() < n)
+	{
+		DWORD pid = (DWORD)(rnd.Below(1 << 22) * 4 + 4);
+		if (used.insert(pid).second)
+			pids.push_back(pid);
+	}
+
+	ProcessTable table;
+	TestTimer tAdd;
+	for (DWORD pid : pids)
+	{
+		const TCHAR *key = keys[rnd.Below((int)keys.size())];
+		table.Add(pid, key, 1, 0, 0, ProcListItem(key, 0, 0, { 0, 0 }));
+	}
+	printf("ProcessTable, %d processes:\n  add         %7.1f ns\n", n, tAdd.NsPer(n));
+
+	// lookups that hit, as in the update pass for processes still running
+	const int nLookups = 2000000;
+	long long sum = 0;
+	TestTimer tFind;
+	for (int i = 0; i < nLookups; ++i)
+		sum += table.Find(pids[rnd.Below(n)]);
+	printf("  find (hit)  %7.1f ns\n", tFind.NsPer(nLookups));
+
+	// lookups that miss, as for newly started processes
+	TestTimer tMiss;
+	for (int i = 0; i < nLookups; ++i)
+		sum += table.Find((DWORD)(rnd.Below(1 << 22) * 4 + 2));
+	printf("  find (miss) %7.1f ns\n", tMiss.NsPer(nLookups));
+
+	// a scan over one hot field, like the exit check in the update pass
+	TestTimer tScan;
+	const int nScans = 200;
+	for (int s = 0; s < nScans; ++s)
+	{
+		for (int slot = 0; slot < table.Count(); ++slot)
+			sum += table.gen[slot];
+	}
+	printf("  gen scan    %7.2f ns/process\n", tScan.NsPer((long long)nScans * n));
+
+	// Memory for the table's own structures: the hot arrays and the PID
+	// index, which the table keeps at a power of two at least twice the
+	// process count.  The key index is a node-based map, estimated at a node
+	// (key, value, next pointer, cached hash) per entry plus a bucket
+	// pointer.  The item records are the application's ProcListItem,
+	// so they aren't counted here.
+	size_t hot = table.pid.capacity() * sizeof(DWORD) + table.gen.capacity() * sizeof(DWORD)
+		+ table.name.capacity() * sizeof(const TCHAR*) + table.type.capacity() * sizeof(int)
+		+ table.mask.capacity() * sizeof(DWORD_PTR);
+	size_t indexSize = 256;
+	while (indexSize < (size_t)n * 2)
+		indexSize *= 2;
+	size_t pidIndex = indexSize * sizeof(int);
+	size_t keyIndex = (size_t)n * (sizeof(const TCHAR*) + sizeof(DWORD) + 2 * sizeof(void*)) + (size_t)n * sizeof(void*);
+	printf("  memory      %7.1f bytes/process (hot arrays %.1f, PID index %.1f, key index ~%.1f)\n",
+		(double)(hot + pidIndex + keyIndex) / n, (double)hot / n, (double)pidIndex / n, (double)keyIndex / n);
+
+	// remove everything, in random order
+	for (int i = n - 1; i > 0; --i)
+		std::swap(pids[i], pids[rnd.Below(i + 1)]);
+	TestTimer tRemove;
+	for (DWORD pid : pids)
+		table.RemoveAt(table.Find(pid));
+	printf("  remove      %7.1f ns\n", tRemove.NsPer(n));
+
+	// string interning of names that are already present
+	TestTimer tIntern;
+	for (int i = 0; i < nLookups; ++i)
+		sum += (long long)(size_t)g_strings.Intern(keys[rnd.Below((int)keys.size())]);
+	printf("StringTable:\n  intern (hit) %6.1f ns\n", tIntern.NsPer(nLookups));
+
+	// keep the optimizer from discarding the lookups
+	if (sum == 42)
+		printf(" \n");
+}
+
+int main(int argc, char **argv)
+{
+	TestProcessTable();
+	TestStringTable();
+	printf("ProcessTableTest: %d failure(s)\n", g_failures);
+
+	if (g_failures == 0 && WantBench(argc, argv))
+		Bench();
+
+	return g_failures != 0 ? 1 : 0;
+}
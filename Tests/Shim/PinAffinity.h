@@ -0,0 +1,81 @@
+#pragma once
+#include "Util.h"
+#include "SavedProcess.h"
+
+// Stand-in for the application header, for building the portable
+// modules in the test programs.  This has just the parts of the list
+// view row, process record, process type and saved program table that
+// the modules under test use, with the same names and types as the real
+// thing.
+
+// Saved process table, by key (lower-case program name)
+extern std::unordered_map<TSTRING, SavedProc> g_savedProcs;
+
+// process type, with the group rule fields (GroupRules.cpp)
+struct ProcTypeDesc
+{
+	ProcTypeDesc(const TCHAR *name) : name(name) { }
+
+	TSTRING name;
+	std::vector<const TCHAR*> treeRoots;
+	std::vector<DWORD> sessions;
+};
+extern std::vector<ProcTypeDesc> g_procTypes;
+
+struct ListViewData;
+
+// list view sort key
+struct ViewSortKey
+{
+	INT64 primary;
+	const TCHAR *name;
+	INT64 pid;
+	const ListViewData *row;
+};
+
+// list view row
+struct ListViewData
+{
+	ListViewData(DWORD pid, const TCHAR *name, const TCHAR *key, SavedProc *saved, int iType, FILETIME startTime)
+		: pid(pid), name(name), key(key), iType(iType), startTime(startTime), cpu(0),
+		saved(saved), processDeleted(false), inView(false)
+	{
+		effPid = saved != 0 ? -1 : pid;
+	}
+
+	DWORD pid;
+	DWORD effPid;
+	const TCHAR *name;
+	const TCHAR *key;
+	int iType;
+	FILETIME startTime;
+	UINT16 cpu;
+
+	SavedProc *saved;
+	bool processDeleted;
+
+	bool inView;
+	ViewSortKey sortKey;
+
+	bool IsPlaceholder() const { return effPid == (DWORD)-1; }
+
+	// pooled allocation (ProcessTable.cpp)
+	static void *operator new(size_t size);
+	static void operator delete(void *p);
+};
+
+// process record
+struct ProcListItem
+{
+	ProcListItem(const TCHAR *key, DWORD_PTR origAffinity, DWORD_PTR sysAffinity, FILETIME startTime)
+		: dirty(false), origAffinity(origAffinity), sysAffinity(sysAffinity), key(key),
+		startTime(startTime), lvd(NULL)
+	{ }
+
+	bool dirty;
+	DWORD_PTR origAffinity;
+	DWORD_PTR sysAffinity;
+	const TCHAR *key;
+	FILETIME startTime;
+	ListViewData *lvd;
+};
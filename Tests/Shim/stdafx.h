@@ -0,0 +1,85 @@
+#pragma once
+
+// Stand-in for the application's precompiled header, for building the
+// portable modules in the test programs.  On Windows, this pulls in the
+// real system headers.  Elsewhere, it defines the handful of Windows
+// types and CRT names that the portable modules use, with TCHAR as a
+// plain char.
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <type_traits>
+
+#ifdef _WIN32
+
+#include <Windows.h>
+#include <tchar.h>
+
+#else
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint32_t DWORD;
+typedef int64_t INT64;
+typedef uint64_t UINT64;
+typedef uintptr_t UINT_PTR;
+typedef uintptr_t DWORD_PTR;
+typedef void *HANDLE;
+typedef char TCHAR;
+
+// native API types (NtApi.h).  The snapshot names are UTF-16 on Windows,
+// where TCHAR is WCHAR; here, WCHAR follows TCHAR, so the tests build
+// their snapshots with the same character type as the string table.
+typedef uint16_t USHORT;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef uint64_t ULONGLONG;
+typedef uintptr_t ULONG_PTR;
+typedef size_t SIZE_T;
+typedef void *PVOID;
+typedef TCHAR WCHAR;
+typedef WCHAR *PWSTR;
+typedef ULONG *PULONG;
+union LARGE_INTEGER
+{
+	int64_t QuadPart;
+};
+#define WINAPI
+
+struct FILETIME
+{
+	DWORD dwLowDateTime;
+	DWORD dwHighDateTime;
+};
+
+struct GUID
+{
+	DWORD Data1;
+	WORD Data2;
+	WORD Data3;
+	BYTE Data4[8];
+};
+inline bool operator==(const GUID &a, const GUID &b) { return memcmp(&a, &b, sizeof(GUID)) == 0; }
+inline bool operator!=(const GUID &a, const GUID &b) { return !(a == b); }
+
+#define _T(x) x
+#define _tcslen strlen
+#define _tcscmp strcmp
+#define _tcsncmp strncmp
+#define _totlower tolower
+#define MAX_PATH 260
+#define UNREFERENCED_PARAMETER(p) ((void)(p))
+
+inline int CloseHandle(HANDLE) { return 1; }
+
+using std::min;
+using std::max;
+
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+// Minimal test harness.  CHECK() counts and reports failures without
+// stopping, so that one run shows everything that's wrong; main()
+// returns the failure count as the exit code.
+
+static int g_failures = 0;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { ++g_failures; printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #cond); } } while (0)
+
+// Small deterministic random number generator (xorshift), so that a
+// failure reproduces from run to run
+struct TestRandom
+{
+	TestRandom(unsigned int seed) : state(seed != 0 ? seed : 1) { }
+
+	unsigned int Next()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	// random number in [0, n)
+	int Below(int n) { return (int)(Next() % (unsigned int)n); }
+
+	unsigned int state;
+};
+
+// elapsed-time timer for the benchmarks
+struct TestTimer
+{
+	TestTimer() : start(std::chrono::steady_clock::now()) { }
+
+	// nanoseconds per operation since construction
+	double NsPer(long long ops) const
+	{
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		return ops != 0 ? (double)ns / ops : 0.0;
+	}
+
+	std::chrono::steady_clock::time_point start;
+};
+
+// is the program running its benchmarks ("--bench" on the command line)?
+inline bool WantBench(int argc, char **argv)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--bench") == 0)
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,526 @@
+// UI change set tests.
+//
+// These drive the engine side of the UI change sets the way the process
+// list update does: processes start, change and exit, and saved
+// programs are added, changed and deleted, with the change recording
+// calls in the same places.  Then they apply the changes to the sorted
+// view model and check that the view matches the process table and
+// saved programs exactly.  With "--bench", they also time applying a
+// tick's changes, to show that the cost follows the number of changes
+// rather than the number of rows.
+
+#include "stdafx.h"
+#include <set>
+#include "StringTable.h"
+#include "ProcessTable.h"
+#include "SortedView.h"
+#include "UiChanges.h"
+#include "TestUtil.h"
+
+// the saved programs
+std::unordered_map<TSTRING, SavedProc> g_savedProcs;
+
+// view model callback counters
+static struct
+{
+	int fillProcess;
+	int fillPlaceholder;
+	int rowDeleted;
+	int fetchStart;
+} s_calls;
+
+// update counter, which the process row callback mixes into the CPU
+// figure, so that refreshed rows move in the CPU sort order
+static int s_tick = 0;
+
+static void FillProcessRow(int slot)
+{
+	s_calls.fillProcess++;
+	ListViewData *data = g_procTable.item[slot].lvd;
+	data->iType = g_procTable.type[slot];
+	data->cpu = (UINT16)((g_procTable.pid[slot] * 7 + s_tick * 13) % 1000);
+}
+
+static void FillPlaceholderRow(SavedProc &sp, ListViewData *data)
+{
+	UNREFERENCED_PARAMETER(sp);
+	UNREFERENCED_PARAMETER(data);
+	s_calls.fillPlaceholder++;
+}
+
+static void RowDeleted(ListViewData *data)
+{
+	UNREFERENCED_PARAMETER(data);
+	s_calls.rowDeleted++;
+}
+
+static void FetchStartTime(int slot)
+{
+	UNREFERENCED_PARAMETER(slot);
+	s_calls.fetchStart++;
+}
+
+static const UiViewHooks s_hooks = {
+	FillProcessRow,
+	FillPlaceholderRow,
+	RowDeleted,
+	FetchStartTime
+};
+
+// Engine side.  These follow the process list update and the saved
+// settings commands.
+
+static SavedProc *FindSaved(const TCHAR *key)
+{
+	auto it = g_savedProcs.find(key);
+	return it != g_savedProcs.end() ? &it->second : NULL;
+}
+
+static void StartProcess(DWORD pid, const TCHAR *name)
+{
+	const TCHAR *key = g_strings.InternLower(name);
+	SavedProc *saved = FindSaved(key);
+	int type = saved != NULL ? saved->iType : 0;
+	FILETIME start = { pid, 1 };
+	int slot = g_procTable.Add(pid, g_strings.Intern(name), 0, type, 0, ProcListItem(key, 0, 0, start));
+	ProcListItem &proc = g_procTable.item[slot];
+	if (g_uiLive)
+	{
+		proc.lvd = new ListViewData(pid, g_procTable.name[slot], key, NULL, type, start);
+		MarkRowAdded(proc.lvd);
+		MarkProcessChanged(slot);
+	}
+	if (saved != NULL && saved->numInstances++ == 0)
+		MarkSavedChanged(*saved);
+}
+
+static void ExitProcess(DWORD pid)
+{
+	int slot = g_procTable.Find(pid);
+	ProcListItem &proc = g_procTable.item[slot];
+	SavedProc *saved = FindSaved(proc.key);
+	if (saved != NULL && --saved->numInstances == 0)
+		MarkSavedChanged(*saved);
+	if (proc.lvd != NULL)
+		MarkRowRemoved(proc.lvd);
+	g_procTable.RemoveAt(slot);
+}
+
+static void ChangeProcess(DWORD pid)
+{
+	MarkProcessChanged(g_procTable.Find(pid));
+}
+
+// add a saved program with no running instances
+static void AddSaved(const TCHAR *name, int iType)
+{
+	TSTRING key = name;
+	std::transform(key.begin(), key.end(), key.begin(), ::_totlower);
+	auto it = g_savedProcs.emplace(std::piecewise_construct,
+		std::forward_as_tuple(key.c_str()), std::forward_as_tuple(name, iType));
+	MarkSavedChanged(it.first->second);
+}
+
+// change a saved program's type
+static void ChangeSaved(const TCHAR *key, int iType)
+{
+	SavedProc &sp = *FindSaved(key);
+	sp.iType = iType;
+	sp.dirty = true;
+	MarkSavedChanged(sp);
+}
+
+// delete a saved program, detaching its placeholder row
+static void DeleteSaved(const TCHAR *key)
+{
+	auto it = g_savedProcs.find(key);
+	if (it->second.placeholder != NULL)
+	{
+		it->second.placeholder->saved = NULL;
+		MarkRowRemoved(it->second.placeholder);
+	}
+	g_savedProcs.erase(it);
+}
+
+// apply the pending changes, as the UI update does
+static bool Apply()
+{
+	++s_tick;
+	return ApplyUiChangeSet(s_hooks);
+}
+
+// Check that the view matches the process table and saved programs:
+// a row for each process, a placeholder for each saved program with no
+// running instances, and nothing else
+static void CheckView()
+{
+	CHECK(g_uiChanges.Empty());
+	int expect = g_procTable.Count();
+	std::set<const ListViewData*> rows;
+	for (int slot = 0; slot < g_procTable.Count(); ++slot)
+	{
+		const ProcListItem &proc = g_procTable.item[slot];
+		CHECK(!proc.dirty);
+		CHECK(proc.lvd != NULL);
+		if (proc.lvd == NULL)
+			continue;
+		CHECK(proc.lvd->pid == g_procTable.pid[slot]);
+		CHECK(!proc.lvd->processDeleted);
+		CHECK(g_sortedView.Find(proc.lvd) >= 0);
+		rows.insert(proc.lvd);
+	}
+	for (auto &it : g_savedProcs)
+	{
+		const SavedProc &sp = it.second;
+		CHECK(!sp.queued && !sp.dirty);
+		if (sp.numInstances != 0)
+		{
+			CHECK(sp.placeholder == NULL);
+			continue;
+		}
+		++expect;
+		CHECK(sp.placeholder != NULL);
+		if (sp.placeholder == NULL)
+			continue;
+		CHECK(sp.placeholder->saved == &sp && sp.placeholder->IsPlaceholder());
+		CHECK(sp.placeholder->iType == sp.iType);
+		CHECK(g_sortedView.Find(sp.placeholder) >= 0);
+		rows.insert(sp.placeholder);
+	}
+	CHECK(g_sortedView.Count() == expect);
+	CHECK((int)rows.size() == expect);
+
+	// the view is in CPU order
+	for (int i = 1; i < g_sortedView.Count(); ++i)
+		CHECK(g_sortedView.At(i - 1)->cpu >= g_sortedView.At(i)->cpu);
+}
+
+// clear everything out between tests
+static void Reset()
+{
+	TearDownViewModel(s_hooks);
+	while (g_procTable.Count() != 0)
+		g_procTable.RemoveAt(0);
+	g_savedProcs.clear();
+	g_sortedView.SetOrder(SortFieldCpu, -1);
+	BuildViewModel(s_hooks);
+	memset(&s_calls, 0, sizeof(s_calls));
+}
+
+static void TestDedup()
+{
+	Reset();
+	StartProcess(100, _T("a.exe"));
+	StartProcess(104, _T("b.exe"));
+	AddSaved(_T("Game.exe"), 1);
+	Apply();
+	CheckView();
+
+	// many changes to one process between updates list it once, and
+	// refresh its row once
+	memset(&s_calls, 0, sizeof(s_calls));
+	for (int i = 0; i < 100; ++i)
+		ChangeProcess(100);
+	CHECK(g_uiChanges.procs.size() == 1);
+
+	// likewise for a saved program
+	for (int i = 0; i < 10; ++i)
+		ChangeSaved(_T("game.exe"), 1 + i % 2);
+	CHECK(g_uiChanges.saved.size() == 1);
+
+	CHECK(Apply());
+	CHECK(s_calls.fillProcess == 1);
+	CHECK(s_calls.fillPlaceholder == 1);
+	CheckView();
+
+	// after an update, the flags are clear, so a new change is listed again
+	ChangeProcess(100);
+	ChangeSaved(_T("game.exe"), 2);
+	CHECK(g_uiChanges.procs.size() == 1 && g_uiChanges.saved.size() == 1);
+	Apply();
+	CheckView();
+
+	// nothing to do
+	CHECK(!Apply());
+}
+
+static void TestAddRemoveOneTick()
+{
+	Reset();
+	StartProcess(100, _T("a.exe"));
+	Apply();
+	CheckView();
+
+	// a process that starts and exits between updates never shows up,
+	// and its row is deleted
+	memset(&s_calls, 0, sizeof(s_calls));
+	StartProcess(200, _T("quick.exe"));
+	ChangeProcess(200);
+	ExitProcess(200);
+	Apply();
+	CHECK(s_calls.fillProcess == 0);
+	CheckView();
+	CHECK(g_sortedView.Count() == 1);
+
+	// PID reuse within one tick: the new process gets a row, and the
+	// old process's queued refresh doesn't touch it twice
+	memset(&s_calls, 0, sizeof(s_calls));
+	StartProcess(300, _T("first.exe"));
+	ExitProcess(300);
+	StartProcess(300, _T("second.exe"));
+	CHECK(g_uiChanges.procs.size() == 2);
+	Apply();
+	CHECK(s_calls.fillProcess == 1);
+	CheckView();
+	CHECK(g_sortedView.Count() == 2);
+
+	// the exit of a saved program's only instance, started in the same
+	// tick, leaves its placeholder in place
+	AddSaved(_T("Game.exe"), 1);
+	Apply();
+	ListViewData *placeholder = FindSaved(_T("game.exe"))->placeholder;
+	StartProcess(400, _T("Game.exe"));
+	ExitProcess(400);
+	Apply();
+	CheckView();
+	CHECK(FindSaved(_T("game.exe"))->placeholder == placeholder);
+}
+
+static void TestSavedRemoval()
+{
+	Reset();
+	AddSaved(_T("Game.exe"), 1);
+	AddSaved(_T("Other.exe"), 2);
+	Apply();
+	CheckView();
+	CHECK(g_sortedView.Count() == 2);
+
+	// deleting a saved program with a live placeholder deletes the row
+	memset(&s_calls, 0, sizeof(s_calls));
+	DeleteSaved(_T("game.exe"));
+	Apply();
+	CHECK(s_calls.rowDeleted == 1);
+	CheckView();
+	CHECK(g_sortedView.Count() == 1);
+
+	// a queued change to a saved program deleted in the same tick
+	ChangeSaved(_T("other.exe"), 1);
+	DeleteSaved(_T("other.exe"));
+	Apply();
+	CheckView();
+	CHECK(g_sortedView.Count() == 0);
+
+	// the placeholder goes when an instance starts, and comes back when
+	// the last one exits
+	AddSaved(_T("Game.exe"), 1);
+	Apply();
+	StartProcess(100, _T("game.exe"));
+	StartProcess(104, _T("GAME.EXE"));
+	Apply();
+	CheckView();
+	CHECK(FindSaved(_T("game.exe"))->placeholder == NULL);
+	ExitProcess(100);
+	Apply();
+	CheckView();
+	CHECK(FindSaved(_T("game.exe"))->placeholder == NULL);
+	ExitProcess(104);
+	Apply();
+	CheckView();
+	CHECK(FindSaved(_T("game.exe"))->placeholder != NULL);
+
+	// deleting the saved entry while an instance runs leaves the
+	// process row alone
+	StartProcess(108, _T("game.exe"));
+	Apply();
+	DeleteSaved(_T("game.exe"));
+	Apply();
+	CheckView();
+	CHECK(g_sortedView.Count() == 1);
+}
+
+static void TestTearDownRebuild()
+{
+	Reset();
+	AddSaved(_T("Game.exe"), 1);
+	for (DWORD pid = 100; pid < 200; pid += 4)
+		StartProcess(pid, _T("a.exe"));
+	Apply();
+	CheckView();
+
+	// pending changes of every kind, then the window is hidden
+	StartProcess(500, _T("new.exe"));
+	ExitProcess(100);
+	StartProcess(504, _T("quick.exe"));
+	ExitProcess(504);
+	ChangeProcess(104);
+	ChangeSaved(_T("game.exe"), 2);
+	TearDownViewModel(s_hooks);
+	CHECK(!g_uiLive);
+	CHECK(g_uiChanges.Empty());
+	CHECK(g_sortedView.Count() == 0);
+	for (int slot = 0; slot < g_procTable.Count(); ++slot)
+		CHECK(g_procTable.item[slot].lvd == NULL && !g_procTable.item[slot].dirty);
+	CHECK(FindSaved(_T("game.exe"))->placeholder == NULL);
+
+	// while hidden, nothing is recorded
+	StartProcess(600, _T("hidden.exe"));
+	ExitProcess(104);
+	ChangeProcess(108);
+	StartProcess(604, _T("Game.exe"));
+	ExitProcess(604);
+	ChangeSaved(_T("game.exe"), 1);
+	AddSaved(_T("Another.exe"), 1);
+	CHECK(g_uiChanges.Empty());
+	CHECK(g_procTable.item[g_procTable.Find(108)].lvd == NULL);
+
+	// showing the window rebuilds everything in one batch
+	memset(&s_calls, 0, sizeof(s_calls));
+	BuildViewModel(s_hooks);
+	CHECK(g_uiLive);
+	CHECK(s_calls.fetchStart == g_procTable.Count());
+	CheckView();
+
+	// and change recording picks up where it left off
+	StartProcess(700, _T("after.exe"));
+	ExitProcess(108);
+	Apply();
+	CheckView();
+}
+
+static void TestRandom_()
+{
+	// random engine activity against the consistency check
+	Reset();
+	TestRandom rnd(2718);
+	static const TCHAR *const names[] = { _T("a.exe"), _T("b.exe"), _T("Game.exe"), _T("c.exe"), _T("Pinball.exe") };
+	std::vector<DWORD> live;
+	DWORD nextPid = 1000;
+	for (int round = 0; round < 20000; ++round)
+	{
+		switch (rnd.Below(8))
+		{
+		case 0:
+		case 1:
+			StartProcess(nextPid, names[rnd.Below(5)]);
+			live.push_back(nextPid);
+			nextPid += 4;
+			break;
+
+		case 2:
+			if (live.size() != 0)
+			{
+				int i = rnd.Below((int)live.size());
+				ExitProcess(live[i]);
+				live[i] = live.back();
+				live.pop_back();
+			}
+			break;
+
+		case 3:
+		case 4:
+			if (live.size() != 0)
+				ChangeProcess(live[rnd.Below((int)live.size())]);
+			break;
+
+		case 5:
+			{
+				// add, change or delete a saved program
+				const TCHAR *name = names[rnd.Below(5)];
+				const TCHAR *key = g_strings.InternLower(name);
+				if (FindSaved(key) == NULL)
+				{
+					// count its running instances, as loading the
+					// settings does
+					AddSaved(name, 1);
+					SavedProc &sp = *FindSaved(key);
+					std::vector<int> slots;
+					g_procTable.FindByKey(key, slots);
+					sp.numInstances = (int)slots.size();
+				}
+				else if (rnd.Below(2) == 0)
+					ChangeSaved(key, 1 + rnd.Below(3));
+				else
+					DeleteSaved(key);
+			}
+			break;
+
+		case 6:
+			// update the view, if the window is showing
+			if (g_uiLive)
+			{
+				Apply();
+				CheckView();
+			}
+			break;
+
+		case 7:
+			// hide or show the window now and then
+			if (rnd.Below(50) == 0)
+			{
+				if (g_uiLive)
+					TearDownViewModel(s_hooks);
+				else
+					BuildViewModel(s_hooks);
+			}
+			break;
+		}
+	}
+	if (!g_uiLive)
+		BuildViewModel(s_hooks);
+	Apply();
+	CheckView();
+}
+
+// time applying ticks of 'changes' process changes with 'rows' rows
+static double TimeApply(int rows, int changes, TestRandom &rnd)
+{
+	Reset();
+	for (int i = 0; i < rows; ++i)
+	{
+		char name[32];
+		sprintf(name, "prog%d.exe", i % 300);
+		StartProcess((DWORD)(i * 4 + 4), name);
+	}
+	Apply();
+
+	const int ticks = max(200, 200000 / max(changes, 1));
+	long long ns = 0;
+	for (int t = 0; t < ticks; ++t)
+	{
+		for (int c = 0; c < changes; ++c)
+			ChangeProcess((DWORD)(rnd.Below(rows) * 4 + 4));
+		TestTimer timer;
+		Apply();
+		ns += (long long)timer.NsPer(1);
+	}
+	return (double)ns / ticks;
+}
+
+static void Bench()
+{
+	TestRandom rnd(161);
+
+	printf("UI change sets, by number of changes per update (3000 rows):\n");
+	for (int changes : { 0, 1, 10, 100, 1000 })
+		printf("  %5d changes  %10.0f ns/update\n", changes, TimeApply(3000, changes, rnd));
+
+	printf("UI change sets, by number of rows (10 changes per update):\n");
+	for (int rows : { 300, 3000, 30000 })
+		printf("  %5d rows     %10.0f ns/update\n", rows, TimeApply(rows, 10, rnd));
+}
+
+int main(int argc, char **argv)
+{
+	g_sortedView.SetOrder(SortFieldCpu, -1);
+	TestDedup();
+	TestAddRemoveOneTick();
+	TestSavedRemoval();
+	TestTearDownRebuild();
+	TestRandom_();
+	printf("UiChangesTest: %d failure(s)\n", g_failures);
+
+	if (g_failures == 0 && WantBench(argc, argv))
+		Bench();
+
+	return g_failures != 0 ? 1 : 0;
+}